@@ -19,7 +19,8 @@ namespace bts { namespace bitname {
      name_header_msg,
      block_msg,
      block_index_msg,
-     headers_msg
+     headers_msg,
+     get_name_headers_msg
   };
 
   struct name_inv_message
@@ -73,6 +74,16 @@ namespace bts { namespace bitname {
     short_name_id_type name_trx_id;
   };
 
+  /**
+   *  Requests several name headers at once, each known header is sent back
+   *  as a separate name_header_message.
+   */
+  struct get_name_headers_message
+  {
+    static const message_type type;
+    std::vector<short_name_id_type> name_trx_ids;
+  };
+
   struct name_header_message
   {
     static const message_type type;
@@ -134,6 +145,7 @@ FC_REFLECT_ENUM( bts::bitname::message_type,
     (block_msg)
     (block_index_msg)
     (headers_msg)
+    (get_name_headers_msg)
 )
 
 #include <fc/reflect/reflect.hpp>
@@ -144,6 +156,7 @@ FC_REFLECT( bts::bitname::get_headers_message, (locator_hashes) )
 FC_REFLECT( bts::bitname::get_block_message, (block_id))
 FC_REFLECT( bts::bitname::get_block_index_message, (block_id))
 FC_REFLECT( bts::bitname::get_name_header_message, (name_trx_id))
+FC_REFLECT( bts::bitname::get_name_headers_message, (name_trx_ids))
 FC_REFLECT( bts::bitname::name_header_message, (trx))
 FC_REFLECT( bts::bitname::block_message,(block) )
 FC_REFLECT( bts::bitname::block_index_message,(index) )
@@ -1,5 +1,6 @@
 #pragma once
 #include <bts/bitname/bitname_block.hpp>
+#include <bts/config.hpp>
 
 namespace bts { namespace bitname {
 
@@ -25,6 +26,21 @@ namespace bts { namespace bitname {
           virtual void found_name_trx( const name_trx& t ){};
     };
 
+    /**
+     *  Counters describing the work done by the name miner, rates are measured
+     *  over the last MINER_STATS_PERIOD_SEC.
+     */
+    struct name_miner_stats
+    {
+       name_miner_stats():hashes(0),hash_rate(0),shares_found(0),blocks_found(0){}
+
+       uint64_t             hashes;             ///< headers hashed since the miner was created
+       double               hash_rate;          ///< hashes per second of all threads
+       std::vector<double>  thread_hash_rates;  ///< hashes per second of each thread
+       uint64_t             shares_found;       ///< headers that met the name trx target
+       uint64_t             blocks_found;       ///< headers that also met the block target
+    };
+
     namespace detail { class name_miner_impl; }
 
     /**
@@ -38,7 +54,10 @@ namespace bts { namespace bitname {
     class name_miner
     {
        public:
-          name_miner();
+          /**
+           *  @param threads - number of mining threads, 0 for one per core
+           */
+          name_miner( uint32_t threads = DEFAULT_MINING_THREADS );
           ~name_miner();
 
           void set_delegate( name_miner_delegate* d );
@@ -64,11 +83,19 @@ namespace bts { namespace bitname {
            */
           void add_name_trx( const name_header& );
 
+          /**
+           *  @param effort - fraction of each cycle of MINING_DUTY_CYCLE_MS that every
+           *                  thread spends hashing, between 0 and 1
+           */
           void start( float effort = 1 );
           void stop();
 
+          name_miner_stats get_stats()const;
+
        private:
           std::unique_ptr<detail::name_miner_impl> my;
     };
 
 } }  // namespace bts
+
+FC_REFLECT( bts::bitname::name_miner_stats, (hashes)(hash_rate)(thread_hash_rates)(shares_found)(blocks_found) )
@@ -46,6 +46,9 @@ namespace bts { namespace blockchain {
       fc::sha224   id()const;
 
       pow_hash  proof_of_work()const;
+
+      /** the input to bts::proof_of_work, used to evaluate many proofs as a batch */
+      fc::sha256   pow_seed()const;
       proof        pow; ///< contains the merkle branch + nonce
    };
 
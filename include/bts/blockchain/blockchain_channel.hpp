@@ -21,15 +21,29 @@ namespace bts { namespace blockchain {
         virtual void handle_trx_block( const trx_block& b ){};
   };
 
+  /**
+   *  Counters describing the transaction verification pipeline.
+   */
+  struct verify_stats
+  {
+     verify_stats():queue_depth(0),accepted(0),rejected(0),dropped(0),avg_latency_us(0),max_latency_us(0){}
+
+     uint32_t          queue_depth;  ///< trxs received but not yet verified
+     uint64_t          accepted;     ///< trxs added to the pending pool
+     uint64_t          rejected;     ///< trxs that failed validation
+     uint64_t          dropped;      ///< trxs discarded because the queue was full
+     uint64_t          avg_latency_us; ///< moving average time from receipt to verification
+     uint64_t          max_latency_us;
+  };
+
   /**
    *  The blockchain channel receives transactions, checks them
    *  against the current transaction DB and forwards them if they
    *  are valid.  
    *
    *  It any transactions that are deemed invalid are marked as such
-   *  and discarded.  Any double-spends are only forwarded if there
-   *  are more fees, both trx are valid are are held until one or
-   *  the other is made invalid by a block.
+   *  and discarded.  Any double-spends are only accepted and forwarded 
+   *  if they pay a higher fee rate than the pending trx they replace.
    *
    *  When a request for a trx_id comes in, the pending pool is checked
    *  first, then the trx_db.  Each connection is only allowed to make
@@ -59,6 +73,8 @@ namespace bts { namespace blockchain {
         */
        const std::unordered_map<uint160,signed_transaction>& get_pending_pool()const;
 
+       verify_stats get_verify_stats()const;
+
        /**
         *  Called when this node wishes to pubish a trx.
         */
@@ -76,3 +92,5 @@ namespace bts { namespace blockchain {
   typedef std::shared_ptr<channel> channel_ptr;
 
 } } // bts::blockchain
+
+FC_REFLECT( bts::blockchain::verify_stats, (queue_depth)(accepted)(rejected)(dropped)(avg_latency_us)(max_latency_us) )
@@ -2,6 +2,8 @@
 #include <bts/peer/peer_channel.hpp>
 #include <bts/extended_address.hpp>
 #include <bts/blockchain/asset.hpp>
+#include <bts/blockchain/blockchain_db.hpp>
+#include <bts/address.hpp>
 #include <fc/filesystem.hpp>
 
 namespace bts { namespace blockchain {
@@ -55,6 +57,19 @@ namespace bts { namespace blockchain {
       asset            get_balance( asset::type unit, uint32_t min_conf = 1  )const;
       asset            get_trx_balance( const std::string& contact_label, uint32_t trx_num, uint32_t min_conf = 1  )const;
 
+      /**
+       *  Mines blocks paying coinbase on top of the head of the chain.  The block template
+       *  includes the pending transactions and is refreshed whenever a transaction arrives
+       *  or a block is pushed, found blocks are pushed and broadcast.
+       *
+       *  @param effort - fraction of each mining thread's time spent hashing, 0 stops mining
+       */
+      void             start_mining( float effort, const address& coinbase );
+      void             stop_mining();
+
+      /** @pre configure() has been called */
+      blockchain_db_ptr get_chain()const;
+
     private:
       std::unique_ptr<detail::blockchain_client_impl> my;
   };
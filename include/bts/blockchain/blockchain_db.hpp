@@ -1,6 +1,7 @@
 #pragma once
 #include <bts/blockchain/block.hpp>
 #include <bts/blockchain/transaction.hpp>
+#include <bts/blockchain/blockchain_pow_cache.hpp>
 
 namespace fc 
 {
@@ -107,7 +108,8 @@ namespace bts { namespace blockchain {
           void open( const fc::path& dir, bool create = true );
           void close();
 
-          uint32_t head_block_num()const;
+          uint32_t   head_block_num()const;
+          fc::sha224 head_block_id()const;
 
          /**
           *  Validates that trx could be included in a future block, that
@@ -120,6 +122,15 @@ namespace bts { namespace blockchain {
           *  @throw exception if trx can not be applied to the current chain state.
           */
          trx_eval   evaluate_signed_transaction( const signed_transaction& trx );       
+
+         /**
+          *  Evaluates trx using addresses that were already recovered from its signatures, this
+          *  allows the expensive signature recovery to be performed on another thread.
+          *
+          *  @param signed_addresses - the result of trx.get_signed_addresses()
+          */
+         trx_eval   evaluate_signed_transaction( const signed_transaction& trx, 
+                                                 const std::unordered_set<address>& signed_addresses );
          trx_eval   evaluate_signed_transactions( const std::vector<signed_transaction>& trxs );
 
          std::vector<signed_transaction> match_orders();
@@ -177,6 +188,18 @@ namespace bts { namespace blockchain {
 
          std::string dump_market( asset::type quote, asset::type base );
 
+         /** 
+          *  Proof of work results for headers and blocks, use this rather than 
+          *  block_proof::proof_of_work() so that each is only evaluated once.
+          */
+         pow_cache& get_pow_cache();
+
+         /**
+          *  @return the greatest proof of work hash push_block accepts for the next block,
+          *          the chain does not define a difficulty yet so every hash is accepted.
+          */
+         const pow_hash& get_pow_target()const;
+
        private:
          void   store_trx( const signed_transaction& trx, const trx_num& t );
          std::unique_ptr<detail::blockchain_db_impl> my;          
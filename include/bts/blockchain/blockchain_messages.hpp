@@ -15,6 +15,8 @@ namespace bts { namespace blockchain {
       trxs_msg            = 8,
       full_block_msg      = 9,
       trx_block_msg       = 10,
+      get_headers_msg     = 11,
+      headers_msg         = 12,
       message_type_count     /// used to verify message type range
   };
 
@@ -115,6 +117,30 @@ namespace bts { namespace blockchain {
      trx_block block_data;
   };
 
+  /**
+   *  Requests the headers that follow the most recent block in
+   *  locator that the remote node has on its chain.
+   */
+  struct get_headers_message
+  {
+      static const message_type type = get_headers_msg;
+      /** block ids starting with the most recent block and going 
+       * back in powers of 2 to the genesis block.
+       */
+      std::vector<fc::sha224> locator;
+  };
+
+  /**
+   *  Up to BLOCKCHAIN_HEADERS_PER_MSG consecutive headers, including
+   *  proof of work, oldest first.  If the limit was reached the 
+   *  remote node may have more.
+   */
+  struct headers_message
+  {
+      static const message_type type = headers_msg;
+      std::vector<block_proof> headers;
+  };
+
 
 } } // bts::blockchain
 FC_REFLECT_ENUM( bts::blockchain::message_type,
@@ -128,6 +154,8 @@ FC_REFLECT_ENUM( bts::blockchain::message_type,
   (trxs_msg)
   (full_block_msg)
   (trx_block_msg)
+  (get_headers_msg)
+  (headers_msg)
 )
 
 FC_REFLECT( bts::blockchain::trx_inv_message, (items) )
@@ -140,4 +168,6 @@ FC_REFLECT( bts::blockchain::get_trx_block_message, (block_id) )
 FC_REFLECT( bts::blockchain::trxs_message, (trxs) )
 FC_REFLECT( bts::blockchain::full_block_message, (block_data) )
 FC_REFLECT( bts::blockchain::trx_block_message, (block_data) )
+FC_REFLECT( bts::blockchain::get_headers_message, (locator) )
+FC_REFLECT( bts::blockchain::headers_message, (headers) )
 
@@ -0,0 +1,83 @@
+#pragma once
+#include <bts/blockchain/block.hpp>
+#include <bts/config.hpp>
+#include <fc/reflect/reflect.hpp>
+
+namespace bts { namespace blockchain {
+
+  /**
+   *  Receives blocks found by the miner, called from the thread that
+   *  created the miner.
+   */
+  class miner_delegate
+  {
+     public:
+        virtual ~miner_delegate(){}
+
+        /**
+         *  Called with a copy of the current template whose nonce produces a
+         *  proof of work that satisfies the target.  Mining stops until a 
+         *  new template is set.
+         */
+        virtual void found_block( const trx_block& b ){};
+  };
+
+  /**
+   *  Hash rates measured over the last MINER_STATS_PERIOD_SEC.
+   */
+  struct miner_stats
+  {
+     miner_stats():hashes(0),hash_rate(0){}
+
+     uint64_t             hashes;             ///< total proof of work evaluated since the miner was created
+     double               hash_rate;          ///< hashes per second of all threads
+     std::vector<double>  thread_hash_rates;  ///< hashes per second of each thread
+  };
+
+  namespace detail { class miner_impl; }
+
+  /**
+   *  @brief Searches for a nonce whose proof of work satisfies the target.
+   *
+   *  The 32 bit nonce space is split into one contiguous range per thread, each 
+   *  thread owns a pow_buffer that is reused for every hash.  When the template
+   *  is replaced by one that builds on the same previous block, for example
+   *  because new transactions arrived, every thread continues from its current
+   *  position in its range; the hashes already tried are not repeated.  A 
+   *  template with a new previous block starts the search over.
+   */
+  class miner
+  {
+     public:
+        /**
+         *  @param threads - number of mining threads, 0 for one per core 
+         */
+        miner( uint32_t threads = BLOCKCHAIN_MINER_THREADS );
+        ~miner();
+
+        void set_delegate( miner_delegate* d );
+
+        /** a block is found when its proof of work is not greater than target */
+        void set_target( const pow_hash& target );
+
+        /**
+         *  @param b - the block to mine, such as the result of blockchain_db::generate_next_block.
+         *             Hashes in progress complete against the template they started with.
+         */
+        void set_block_template( const trx_block& b );
+
+        /**
+         *  @param effort - fraction of each thread's time spent hashing, between 0 and 1
+         */
+        void start( float effort = 1 );
+        void stop();
+
+        miner_stats get_stats()const;
+
+     private:
+        std::shared_ptr<detail::miner_impl> my;
+  };
+
+} } // bts::blockchain
+
+FC_REFLECT( bts::blockchain::miner_stats, (hashes)(hash_rate)(thread_hash_rates) )
@@ -0,0 +1,81 @@
+#pragma once
+#include <bts/blockchain/blockchain_db.hpp>
+#include <bts/config.hpp>
+#include <fc/time.hpp>
+
+#include <unordered_map>
+
+namespace bts { namespace blockchain {
+
+  namespace detail { class pending_pool_impl; }
+
+  /**
+   *  Holds validated transactions that have not yet been included in a block.
+   *
+   *  Transactions are indexed by fee rate (fees per byte) and by arrival time.  The
+   *  memory used by the pool, counting both the unpacked transactions and their packed
+   *  copies, is bounded, when it is exceeded the transactions paying the lowest fee
+   *  rate are evicted.  Every output spent by a transaction in
+   *  the pool is tracked so that a double spend only replaces the transactions it
+   *  conflicts with when it pays a higher fee rate than all of them.
+   */
+  class pending_pool
+  {
+     public:
+        pending_pool( uint64_t max_bytes = PENDING_POOL_MAX_BYTES );
+        ~pending_pool();
+
+        /**
+         *  @param eval - the result of evaluating trx against the current chain state
+         *  @param removed - if not null, the ids of transactions that were replaced or evicted
+         *                   to make room for trx
+         *
+         *  @return false if trx was not added because it conflicts with a transaction
+         *          paying a higher fee rate or because its fee rate is too low to fit in the pool.
+         */
+        bool store( const signed_transaction& trx, const trx_eval& eval,
+                    std::vector<uint160>* removed = nullptr );
+
+        bool                       contains( const uint160& trx_id )const;
+
+        /** @throw key_not_found_exception if trx_id is not in the pool */
+        const signed_transaction&  fetch( const uint160& trx_id )const;
+
+        /**
+         *  @return the transaction as serialized by fc::raw::pack, kept so that it
+         *          can be sent to peers without packing it again.
+         *  @throw key_not_found_exception if trx_id is not in the pool 
+         */
+        const std::vector<char>&   fetch_packed( const uint160& trx_id )const;
+
+        void                       remove( const uint160& trx_id );
+
+        /**
+         *  Removes trxs that were included in a block along with any transactions that
+         *  spend the same outputs as them.
+         */
+        void                       remove_included( const std::vector<signed_transaction>& trxs );
+
+        /**
+         *  Removes transactions that arrived before older_than.
+         *
+         *  @return the ids of the transactions that were removed
+         */
+        std::vector<uint160>       remove_expired( const fc::time_point& older_than );
+
+        /**
+         *  @return up to limit transaction ids ordered from highest to lowest fee rate
+         */
+        std::vector<uint160>       get_inventory( uint32_t limit )const;
+
+        const std::unordered_map<uint160,signed_transaction>& get_transactions()const;
+
+        size_t                     size()const;
+        /** the memory used by the unpacked and packed copies of the transactions */
+        uint64_t                   size_in_bytes()const;
+
+     private:
+        std::unique_ptr<detail::pending_pool_impl> my;
+  };
+
+} } // bts::blockchain
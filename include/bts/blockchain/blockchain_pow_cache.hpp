@@ -0,0 +1,60 @@
+#pragma once
+#include <bts/blockchain/block.hpp>
+#include <bts/config.hpp>
+
+namespace fc 
+{
+   class path;
+};
+
+namespace bts { namespace blockchain {
+
+  namespace detail { class pow_cache_impl; }
+
+  /**
+   *  Remembers the result of evaluating the proof of work of a header so that the
+   *  memory hard hash is computed once no matter how many peers send the header.
+   *
+   *  Results are indexed by block_proof::pow_seed(), which is all the hash depends 
+   *  on, and the least recently used are forgotten once there are more than 
+   *  max_entries.  The results for the most recent POW_CACHE_PERSIST_BLOCKS blocks
+   *  of the chain are also stored on disk so that they survive a restart.
+   *
+   *  Evaluation yields, so callers that ask for a seed which is already being
+   *  evaluated wait for that result instead of evaluating it again.
+   */
+  class pow_cache
+  {
+     public:
+        pow_cache( uint32_t max_entries = POW_CACHE_SIZE );
+        ~pow_cache();
+
+        void open( const fc::path& dir, bool create = true );
+        void close();
+
+        /** @return the proof of work of h, evaluated only if it is not cached */
+        pow_hash              evaluate( const block_proof& h );
+
+        /** 
+         *  Evaluates the headers that are not cached as one batch on the pow_engine.
+         *
+         *  @return the proof of work of each header in the same order
+         */
+        std::vector<pow_hash> evaluate( const std::vector<block_proof>& headers );
+
+        /**
+         *  Called as h is appended to the chain, stores its cached result on disk and
+         *  forgets results that are older than the persisted tail of the chain.
+         */
+        void                  block_pushed( const block_proof& h );
+
+        size_t                size()const;
+
+        /** @return the number of seeds that were evaluated on the pow_engine */
+        uint64_t              evaluated_count()const;
+
+     private:
+        std::unique_ptr<detail::pow_cache_impl> my;
+  };
+
+} } // bts::blockchain
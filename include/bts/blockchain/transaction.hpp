@@ -139,6 +139,12 @@ struct signed_transaction : public transaction
     std::unordered_set<fc::ecc::compact_signature> sigs;
 };
 
+/**
+ *  @return the id() of every transaction in trxs, calculated with a single
+ *          batch small_hash
+ */
+std::vector<uint160> calculate_trx_ids( const std::vector<signed_transaction>& trxs );
+
 } }  // namespace bts::blockchain
 
 namespace fc {
@@ -27,6 +27,7 @@
 #define BITNAME_BLOCK_INTERVAL_SEC       (5*1)  // 5 minutes
 #define BITNAME_TIMEKEEPER_WINDOW        (64)    // blocks used for estimating time
 #define BITNAME_BLOCK_FETCH_TIMEOUT_SEC  (60)
+#define BITNAME_FETCH_MAX_WAIT_MS        (1000)  // longest the fetch loop sleeps when no message arrives
 #define RPC_DEFAULT_PORT              (NETWORK_DEFAULT_PORT+1)
 
 #define SHARE                         (1000ll)                    // used to position the decimal place
@@ -49,17 +50,62 @@
 #define BITCHAT_CACHE_WINDOW_SEC      (60*60*24*30)       // 1 month
 #define BITCHAT_TARGET_BPS            (128*1024)          // 128 kbit / sec target data rate
 #define BITCHAT_BANDWIDTH_WINDOW_US   (5*60*1000*1000ll)  // 5 minutes
+#define BITCHAT_RELAY_REQUIRES_POW    (0)                 // only relay messages that meet the target, enable once senders do proof of work
 #define BITCHAT_INVENTORY_WINDOW_SEC  (60)                // seconds to keep inventory items around
 #define DEFAULT_MINING_EFFORT_PERCENT (50)                // percent of CPU to use for mining
-#define DEFAULT_MINING_THREADS        (1)                 // number of mining threads to use
+#define DEFAULT_MINING_THREADS        (0)                 // number of name mining threads to use, 0 for one per core
+#define MINING_DUTY_CYCLE_MS          (100)               // mining effort is applied as a fraction of each cycle
+#define POW_ENGINE_THREADS            (0)                 // threads verifying proof of work, 0 for one per core
+#define BLOCKCHAIN_MINER_THREADS      (0)                 // threads mining blocks, 0 for one per core
+#define MINER_STATS_PERIOD_SEC        (5)                 // period over which mining hash rates are measured
+#define POW_CACHE_SIZE                (4096)              // proof of work results remembered in memory
+#define POW_CACHE_PERSIST_BLOCKS      (2048)              // results for this many blocks at the end of the chain are kept on disk
 #define MIN_NAME_DIFFICULTY           (24)              // number if leeding 0 bits in double sha512 required to register a name
 //#define MIN_NAME_DIFFICULTY           (16)                // number if leeding 0 bits in double sha512 required to register a name
 #define PEER_HOST_CACHE_QUERY_LIMIT   (1000)              // number of ip/ports that we will cache
+#define PEER_DB_MAX_HOSTS             (10000)             // number of ip/ports stored in the peer db
+#define PEER_HOST_EXPIRE_SEC          (60*60*3)           // hosts not heard from in this long are forgotten
+#define PEER_CONNECT_INTERVAL_SEC     (5)                 // how often outbound connections are topped up
+#define PEER_CONNECT_TIMEOUT_SEC      (10)                // time allowed to connect and complete the handshake
+#define PEER_MAX_PARALLEL_DIALS       (8)                 // outbound connection attempts made at once
+#define PEER_EVAL_PERIOD_SEC          (60*5)              // time connected before a peer's throughput is judged
+#define PEER_REPLACE_THROUGHPUT_PCT   (25)                // peers delivering less than this % of the average are replaced
+#define HANDSHAKE_THREADS             (2)                 // threads performing the ECDH math for inbound handshakes
+#define HANDSHAKE_MAX_IN_PROGRESS     (64)                // inbound handshakes allowed at once, more are refused
+#define HANDSHAKE_MAX_PER_IP          (4)                 // inbound handshakes allowed at once from a single ip
+#define HANDSHAKE_TIMEOUT_SEC         (10)                // time an inbound connection has to complete the handshake
+#define INBOUND_ACCEPTS_PER_IP_PER_MIN (12)               // sustained rate of inbound connections accepted from one ip
 #define MAX_CHANNELS_PER_CONNECTION   (32)
+#define KNOWN_INV_FILTER_BITS         (8*1024)            // bits per generation of a peer's known inventory filter (1 KB)
+#define KNOWN_INV_FILTER_GENERATIONS  (4)                 // generations kept per filter, 4 KB per filter
+#define KNOWN_INV_FILTER_CAPACITY     (512)               // items inserted before the oldest generation is retired
+#define KNOWN_INV_FILTER_PERIOD_SEC   (60*5)              // max age of the newest generation
+#define KNOWN_INV_FILTER_HASHES       (4)                 // ~0.25% false positives per full generation
+#define FETCH_BATCH_SIZE              (64)                // max item ids requested from a peer in a single message
+#define FETCH_MAX_IN_FLIGHT           (256)               // max item ids outstanding per peer per channel
+#define FETCH_REQUEST_TIMEOUT_SEC     (15)                // seconds before an outstanding request is retried elsewhere
+#define FETCH_MAX_ATTEMPTS            (3)                 // requests made for an item before it is dropped
 
 // blockchain channel config
 #define TRX_INV_QUERY_LIMIT           (2000) // number of trx that may be sent as part of inventory or request msg
 #define BLOCK_INV_QUERY_LIMIT         (2000) // number of trx that may be sent as part of inventory or request msg
+#define BLOCKCHAIN_HEADERS_PER_MSG    (2000) // max headers sent in response to a get_headers msg
+#define BLOCK_DOWNLOAD_WINDOW         (128)  // blocks past the head that may be downloaded before they can be pushed
+#define BLOCK_DOWNLOAD_MAX_IN_FLIGHT  (8)    // block bodies requested from a single peer at once
+#define BLOCK_DOWNLOAD_TIMEOUT_SEC    (30)   // seconds before a block body request is sent to another peer
+#define BLOCK_DOWNLOAD_MAX_TIMEOUTS   (3)    // timed out block body requests before a peer is disconnected
+#define TRX_VERIFY_QUEUE_LIMIT        (4096) // received trxs awaiting verification before new ones are dropped
+#define TRX_VERIFY_BATCH_SIZE         (64)   // trxs whose signatures are recovered together on the verify thread
+#define PENDING_POOL_MAX_BYTES        (32*1024*1024) // memory used by unconfirmed trxs, packed and unpacked
+#define PENDING_TRX_MAX_AGE_SEC       (60*60*24)     // unconfirmed trxs are dropped from the pool after this long
+#define RECENT_BLOCK_CACHE_SIZE       (64)    // most recent blocks kept in memory for serving peers
+#define QUERY_BUDGET_MAX              (20000) // query cost a connection may accumulate while idle
+#define QUERY_BUDGET_PER_SEC          (2000)  // query cost a connection regains every second
+#define QUERY_COST_POOL               (1)     // serving a trx from the pending pool
+#define QUERY_COST_CACHE              (5)     // serving a block from the recent block cache
+#define QUERY_COST_HEADER             (1)     // reading one block header from the db
+#define QUERY_COST_DB                 (50)    // base cost of a db lookup, old data costs up to twice as much
+#define QUERY_COST_AGE_BLOCKS         (1000)  // db lookups cost 1 more for every this many blocks of age, at most QUERY_COST_DB more
 
 
 /**
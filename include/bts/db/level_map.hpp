@@ -134,6 +134,31 @@ namespace bts { namespace db {
            return iterator();
         } FC_RETHROW_EXCEPTIONS( warn, "error finding ${key}", ("key",key) ) }
 
+        /** @return an iterator to the first key that is not less than key */
+        iterator lower_bound( const Key& key )
+        { try {
+           std::vector<char> kslice = fc::raw::pack( key );
+           ldb::Slice key_slice( kslice.data(), kslice.size() );
+           iterator itr( _db->NewIterator( ldb::ReadOptions() ) );
+           itr._it->Seek( key_slice );
+           if( itr.valid() ) 
+           {
+              return itr;
+           }
+           return iterator();
+        } FC_RETHROW_EXCEPTIONS( warn, "error finding ${key}", ("key",key) ) }
+
+        /** @return an iterator to the greatest key, which may be decremented to iterate in reverse */
+        iterator last()
+        { try {
+           iterator itr( _db->NewIterator( ldb::ReadOptions() ) );
+           itr._it->SeekToLast();
+           if( itr.valid() )
+           {
+              return itr;
+           }
+           return iterator();
+        } FC_RETHROW_EXCEPTIONS( warn, "error seeking to last" ) }
 
         bool last( Key& k )
         {
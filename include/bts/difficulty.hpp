@@ -12,6 +12,16 @@ namespace bts
    */
   uint64_t difficulty( const fc::sha224& hash_value );
 
+  /** difficulty() implemented with fc::bigint, used to validate the fixed width version */
+  uint64_t difficulty_reference( const fc::sha224& hash_value );
+
+  /**
+   *  @return the greatest hash whose difficulty is greater than d, so that 
+   *          difficulty(h) > d can be tested by comparing h <= difficulty_target(d)
+   *          without a bigint division per hash.
+   */
+  fc::sha224 difficulty_target( uint64_t d );
+
   /** return 2^224 -1 */
   const fc::bigint&  max224();
 
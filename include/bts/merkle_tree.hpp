@@ -7,18 +7,36 @@ namespace bts {
   /**
    *  Provides a merkle branch that proves a hash was
    *  included in the root.
+   *
+   *  mid_states[0] is the leaf and mid_states[i] is the sibling of
+   *  the node on layer i-1 of the path from the leaf to the root.  Bit
+   *  i-1 of branch is set if the node on layer i-1 is a right child,
+   *  in which case mid_states[i] is hashed to its left.
    */
   struct merkle_branch
   {
      merkle_branch()
      :branch(0){}
 
+     /**
+      *  @throw out_of_range_exception if there are more mid states
+      *         than branch has bits
+      */
      uint160 calculate_root()const;
 
      uint32_t                branch;
      std::vector<uint160> mid_states;
   };
 
+  /**
+   *  Calculates the merkle root of leaves by hashing each layer in place,
+   *  layers with an odd number of nodes are padded with uint160().
+   *
+   *  @return uint160() if there are no leaves and the leaf itself if there
+   *          is only one.
+   */
+  uint160 calculate_merkle_root( std::vector<uint160> leaves );
+
   /**
    *  Maintains a merkle tree as updates are made via
    *  get/set.
@@ -26,38 +44,45 @@ namespace bts {
   struct merkle_tree
   {
        void     resize( uint64_t s );
-       uint64_t size();
+       uint64_t size()const;
 
-       /** 
+       /**
+        *  Replaces all leaves and rebuilds the tree.
+        */
+       void     set_leaves( std::vector<uint160> leaves );
+
+       /**
         *  Updates all hashes in the merkle branch to index.
-        *  @throw out_of_range_exception if index > size
+        *  @throw out_of_range_exception if index >= size
         */
        void       set( uint64_t index, const uint160& val );
 
        /**
-        *  @throw out_of_range_exception if index > size
+        *  @throw out_of_range_exception if index >= size
         */
-       uint160 get( uint32_t index );
+       uint160 get( uint32_t index )const;
 
        /**
         *  @return the full merkle branch for the tree.
+        *  @throw out_of_range_exception if index >= size
         */
        merkle_branch get_branch( uint32_t index )const;
-    
+
        /**
         *  @note do not modify this field directly, it will
         *        automatically be updated after every call to
-        *        set / get.
+        *        set / resize.
         */
        uint160                               mroot;
 
        /**
-        *  mtree[0] is the leef layer of the tree
-        *  mtree[mtree.size()-1].size() should always be 2
+        *  mtree[0] is the leaf layer of the tree, each following layer
+        *  holds the hashes of the pairs of the layer below it and
+        *  mtree[mtree.size()-1].size() is always 1.
         *
         *  @note only modify this via get/set to keep the
         *        struture accurate.  This is public for
-        *        serialization purposes only.  
+        *        serialization purposes only.
         *
         *        TODO: update fc::reflect to support private
         *              members.
@@ -65,8 +90,7 @@ namespace bts {
        std::vector< std::vector < uint160 > > mtree;
   };
 
-} 
+}
 #include <fc/reflect/reflect.hpp>
 FC_REFLECT( bts::merkle_branch, (branch)(mid_states) )
 FC_REFLECT( bts::merkle_tree, (mroot)(mtree) )
-
@@ -1,6 +1,10 @@
 #pragma once
+#include <algorithm>
 #include <deque>
+#include <queue>
 #include <unordered_map>
+#include <bts/network/connection.hpp>
+#include <bts/network/rolling_bloom_filter.hpp>
 #include <fc/exception/exception.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/io/json.hpp>
@@ -18,34 +22,23 @@ namespace bts { namespace network {
   {
     public:
       broadcast_manager()
-      :_new_since_broadcast(false){}
+      :_new_since_broadcast(false),_log_base_seq(0){}
 
       class channel_data 
       {
          public:
+           channel_data()
+           :_inventory_cursor(0){}
+
            void update_known( const Key& known )
            {
-              _known_keys[known] = fc::time_point::now();
+              _known_keys.insert( known );
            }
            void update_known( const std::vector<Key>& known )
            {
              for( auto itr = known.begin(); itr != known.end(); ++itr )
              {
-               _known_keys[*itr] = fc::time_point::now();
-             }
-           }
-           void clear_old( const fc::time_point& old )
-           {
-             for( auto itr = _known_keys.begin(); itr != known_keys.end(); )
-             {
-                if( *itr < old )
-                {
-                  itr= _known_keys.erase(itr);
-                }
-                else
-                {
-                  ++itr;
-                }
+               _known_keys.insert( *itr );
              }
            }
 
@@ -58,58 +51,219 @@ namespace bts { namespace network {
               FC_ASSERT( did_request( k ) );
               _requested_values.erase(k);
            }
+           /** 
+            *  May return true for a few keys the peer does not know, use it to avoid 
+            *  announcing keys the peer already has, not to decide who to fetch from. 
+            */
            bool knows( const Key& k )const
            {
-             return _known_keys.find(k) != _known_keys.end();
+             return _known_keys.contains(k);
            }
            bool has_pending_request()const
            {
              return _requested_values.size() != 0;
            }
+           size_t pending_request_count()const
+           {
+             return _requested_values.size();
+           }
            void requested( const Key& k )
            {
               _requested_values[k] = fc::time_point::now();
            }
-           const std::unordered_map<Key,fc::time_point>& known_keys()const
+
+           /** @return when the oldest outstanding request was made, fc::time_point::maximum() if there is none */
+           fc::time_point oldest_request()const
            {
-             return _known_keys;
+              fc::time_point oldest = fc::time_point::maximum();
+              for( auto itr = _requested_values.begin(); itr != _requested_values.end(); ++itr )
+              {
+                 oldest = std::min( oldest, itr->second );
+              }
+              return oldest;
+           }
+
+           /**
+            *  Forgets all requests made before older_than, pass fc::time_point::maximum()
+            *  to forget every outstanding request.
+            *
+            *  @return the keys that were removed 
+            */
+           std::vector<Key> expire_requests( const fc::time_point& older_than )
+           {
+             std::vector<Key> expired;
+             for( auto itr = _requested_values.begin(); itr != _requested_values.end(); )
+             {
+                if( itr->second < older_than )
+                {
+                   expired.push_back( itr->first );
+                   itr = _requested_values.erase(itr);
+                }
+                else
+                {
+                   ++itr;
+                }
+             }
+             return expired;
            }
          private:
-          std::unordered_map<Key,fc::time_point>  _known_keys;
+          friend class broadcast_manager;
+          rolling_bloom_filter<Key>               _known_keys;
           std::unordered_map<Key,fc::time_point>  _requested_values;
+          /** sequence number of the first validated item not yet considered for this peer */
+          uint64_t                                _inventory_cursor;
       };
 
-      void  received_inventory_notice( const Key& k )
+      /**
+       *  @param from the connection that announced k, values are only requested from 
+       *              connections that announced them, see announced_by().
+       */
+      void  received_inventory_notice( const Key& k, const connection_ptr& from )
       {
          auto itr = _inventory.find(k);
          if( itr != _inventory.end() )
          {
+           if( itr->second.value )
+           {
+              return;
+           }
+           add_source( itr->second, from );
            ++itr->second.inv_count;
+           if( itr->second.inv_count > 0 )
+           {
+              push_query( k );
+           }
          }
          else
          {
-           _inventory[k].inv_count = 1;
+           item_state& state = _inventory[k];
+           state.inv_count = 1;
+           add_source( state, from );
+           push_query( k );
          }
       }
 
-      bool find_next_query( Key& key )const
+      /**
+       *  @return the connections that announced key and have not failed to deliver it,
+       *          empty once the value has been received.
+       */
+      const std::vector<connection_ptr>& announced_by( const Key& key )const
       {
-        int32_t high_count = 0;
-        for( auto itr = _inventory.begin(); itr != _inventory.end(); ++itr )
+          auto itr = _inventory.find(key);
+          if( itr == _inventory.end() )
+            return _no_sources;
+          return itr->second.announced_by;
+      }
+
+      /** forgets every announcement made by c, called when c disconnects */
+      void  remove_source( const connection_ptr& c )
+      {
+          for( auto itr = _inventory.begin(); itr != _inventory.end(); ++itr )
+          {
+             auto& sources = itr->second.announced_by;
+             sources.erase( std::remove( sources.begin(), sources.end(), c ), sources.end() );
+          }
+      }
+
+      /**
+       *  Finds the unqueried item that has been announced by the most peers.
+       *
+       *  Entries in the query queue are invalidated lazily, any entry that is not the most
+       *  recent one pushed for its key is discarded as it reaches the top of the queue.
+       *
+       *  @return false if there is nothing left to query.
+       */
+      bool find_next_query( Key& key )
+      {
+        while( _query_queue.size() )
         {
-          if( itr->second.inv_count > high_count )
+          const pending_query& top = _query_queue.top();
+          if( is_current( top ) )
           {
-             high_count = itr->second.inv_count;
-             key = itr->first;
+             key = top.key;
+             return true;
           }
+          _query_queue.pop();
         }
-        return high_count != 0;
+        return false;
+      }
+
+      /**
+       *  Selects up to limit unqueried items in order of decreasing inventory count
+       *  so that they may be requested in a single message.  The items are not 
+       *  marked as queried, call item_queried() for each key actually requested.
+       *
+       *  @return the number of keys appended to keys
+       */
+      uint32_t find_next_queries( std::vector<Key>& keys, uint32_t limit )
+      {
+        std::vector<pending_query> selected;
+        selected.reserve( std::min<size_t>( limit, _query_queue.size() ) );
+        while( _query_queue.size() && selected.size() < limit )
+        {
+          if( is_current( _query_queue.top() ) )
+          {
+             selected.push_back( _query_queue.top() );
+             keys.push_back( _query_queue.top().key );
+          }
+          _query_queue.pop();
+        }
+        // the selected items remain pending until item_queried() is called
+        for( auto itr = selected.begin(); itr != selected.end(); ++itr )
+        {
+          _query_queue.push( *itr );
+        }
+        return selected.size();
       }
 
       void  item_queried( const Key& key )
       {
-          _inventory[key].query_time = fc::time_point::now();
-          _inventory[key].inv_count  = -10000; // flag so we don't query again
+          item_state& state = _inventory[key];
+          state.query_time = fc::time_point::now();
+          state.inv_count  = -10000; // flag so we don't query again
+          ++state.query_attempts;
+      }
+
+      /**
+       *  Called when a query for key timed out or the connection it was made on 
+       *  closed.  The item becomes eligible for find_next_query() again unless
+       *  it has already been queried FETCH_MAX_ATTEMPTS times, in which case it
+       *  is forgotten.
+       *
+       *  @param from the connection that failed to deliver key, it is no longer
+       *              considered a source of key.
+       */
+      void  query_failed( const Key& key, const connection_ptr& from = connection_ptr() )
+      {
+          auto itr = _inventory.find(key);
+          if( itr == _inventory.end() || itr->second.value )
+          {
+             return;
+          }
+          auto& sources = itr->second.announced_by;
+          sources.erase( std::remove( sources.begin(), sources.end(), from ), sources.end() );
+          if( itr->second.query_attempts >= FETCH_MAX_ATTEMPTS )
+          {
+             _inventory.erase(itr);
+             return;
+          }
+          itr->second.inv_count = 1;
+          push_query( key );
+      }
+
+      /**
+       *  Called when key cannot be queried because none of the connections that announced
+       *  it are available, it is queued behind every item that has been announced since.
+       */
+      void  query_deferred( const Key& key )
+      {
+          auto itr = _inventory.find(key);
+          if( itr == _inventory.end() || itr->second.value )
+          {
+             return;
+          }
+          itr->second.inv_count = 0;
+          push_query( key );
       }
 
       const fc::optional<Value>& get_value( const Key& key )
@@ -132,13 +286,19 @@ namespace bts { namespace network {
          state.recv_time = fc::time_point::now();
          state.value     = value;
          state.valid     = is_ok;
+         state.announced_by.clear();
 
+         if( is_ok )
+         {
+            _validated_log.push_back( key );
+         }
          _new_since_broadcast = true;
       }
 
       void  remove( const Key& key )
       {
           _inventory.erase(key);
+          trim_validated_log();
       }
 
       void remove_invalid()
@@ -155,27 +315,37 @@ namespace bts { namespace network {
               ++itr;
            }
          }
+         trim_validated_log();
       }
       
       /**
+       *  Only considers items validated since the last call for this filter, so the cost of
+       *  announcing inventory to a peer is proportional to the number of new items.
+       *
        *  @return a vector of validated keys that does not contain any items already 
        *          found in filter.
        */
-      std::vector<Key> get_inventory( const channel_data& filter )
+      std::vector<Key> get_inventory( channel_data& filter )
       {
+         const uint64_t end_seq   = _log_base_seq + _validated_log.size();
+         const uint64_t start_seq = std::max( filter._inventory_cursor, _log_base_seq );
+
          std::vector<Key> unique_items; 
-         unique_items.reserve( _inventory.size() );
+         unique_items.reserve( end_seq - start_seq );
 
-         for( auto itr = _inventory.begin(); itr != _inventory.end(); ++itr )
+         for( uint64_t seq = start_seq; seq < end_seq; ++seq )
          {
-           if( itr->second.value && itr->second.valid )
+           const Key& key = _validated_log[seq - _log_base_seq];
+           auto itr = _inventory.find( key );
+           if( itr != _inventory.end() && itr->second.value && itr->second.valid )
            {
-               if( filter.known_keys().find( itr->first ) == filter.known_keys().end() )
+               if( !filter.knows( key ) )
                {
-                  unique_items.push_back( itr->first ); 
+                  unique_items.push_back( key ); 
                }
            }
          }
+         filter._inventory_cursor = end_seq;
          return unique_items;
       }
       std::vector<Value> get_inventory_values()const
@@ -206,6 +376,9 @@ namespace bts { namespace network {
       {
          _new_since_broadcast = false;
          _inventory.clear();
+         _query_queue = std::priority_queue<pending_query>();
+         _log_base_seq += _validated_log.size();
+         _validated_log.clear();
       }
 
       /**
@@ -219,6 +392,8 @@ namespace bts { namespace network {
          {
            itr->second.valid = false;
          }
+         _log_base_seq += _validated_log.size();
+         _validated_log.clear();
       }
 
       void clear_old_inventory()
@@ -236,6 +411,7 @@ namespace bts { namespace network {
                ++itr;
             }
          }
+         trim_validated_log();
       }
 
       std::string debug()
@@ -250,22 +426,115 @@ namespace bts { namespace network {
       }
 
     private:
+      struct pending_query
+      {
+        pending_query( const Key& k = Key(), int32_t c = 0, uint32_t g = 0 )
+        :key(k),inv_count(c),query_gen(g){}
+
+        Key       key;
+        int32_t   inv_count; ///< the inv_count of key at the time this entry was queued
+        uint32_t  query_gen; ///< the query_gen of key at the time this entry was queued
+
+        bool operator < ( const pending_query& q )const { return inv_count < q.inv_count; }
+      };
+
+      /** 
+       *  A key that was queried and failed is queued again with the same inv_count
+       *  as its original notice, so only the entry with the latest query_gen counts.
+       *
+       *  @return true if q still reflects the state of the inventory 
+       */
+      bool is_current( const pending_query& q )const
+      {
+         auto itr = _inventory.find( q.key );
+         return itr != _inventory.end() && 
+                itr->second.inv_count == q.inv_count && 
+                itr->second.query_gen == q.query_gen && 
+                !itr->second.value;
+      }
+
+      /** queues k with its current inv_count and invalidates any entry queued before */
+      void push_query( const Key& k )
+      {
+         item_state& state = _inventory[k];
+         ++state.query_gen;
+         _query_queue.push( pending_query( k, state.inv_count, state.query_gen ) );
+
+         // every notice adds an entry, so occasionally drop the stale ones
+         if( _query_queue.size() > 2 * _inventory.size() + 64 )
+         {
+            rebuild_query_queue();
+         }
+      }
+
+      /** drops items from the front of the validated log that are no longer valid */
+      void trim_validated_log()
+      {
+         while( _validated_log.size() )
+         {
+            auto itr = _inventory.find( _validated_log.front() );
+            if( itr != _inventory.end() && itr->second.valid )
+            {
+               break;
+            }
+            _validated_log.pop_front();
+            ++_log_base_seq;
+         }
+      }
+
+      void rebuild_query_queue()
+      {
+         std::vector<pending_query> current;
+         current.reserve( _inventory.size() );
+         for( auto itr = _inventory.begin(); itr != _inventory.end(); ++itr )
+         {
+            if( itr->second.inv_count >= 0 && !itr->second.value )
+            {
+               current.push_back( pending_query( itr->first, itr->second.inv_count, itr->second.query_gen ) );
+            }
+         }
+         _query_queue = std::priority_queue<pending_query>( std::less<pending_query>(), std::move(current) );
+      }
+
       struct item_state
       {
         item_state()
-        :inv_count(0),valid(false){ assert(!value); }
+        :inv_count(0),query_attempts(0),query_gen(0),valid(false){ assert(!value); }
 
         int32_t               inv_count; ///< how many inventory msgs have I received
+        uint32_t              query_attempts;
+        uint32_t              query_gen; ///< incremented each time key is queued for query
         fc::time_point        recv_time;
         fc::time_point        query_time;
         bool                  valid;
         fc::optional<Value>   value;
+        /** connections that announced the item, cleared once the value is received */
+        std::vector<connection_ptr> announced_by;
       };
 
+      static void add_source( item_state& state, const connection_ptr& from )
+      {
+         if( from && std::find( state.announced_by.begin(), state.announced_by.end(), from ) == state.announced_by.end() )
+         {
+            state.announced_by.push_back( from );
+         }
+      }
+
 
       bool                                  _new_since_broadcast;
       fc::optional<Value>                   _unknown_value;
+      std::vector<connection_ptr>           _no_sources;
       std::unordered_map<Key,item_state>    _inventory;
+      /** max-heap on inv_count, may contain stale entries, see is_current() */
+      std::priority_queue<pending_query>    _query_queue;
+
+      /** 
+       *  Keys in the order they were validated, _validated_log[i] has sequence 
+       *  number _log_base_seq + i.  Entries may refer to items that have since
+       *  been invalidated or removed.
+       */
+      std::deque<Key>                       _validated_log;
+      uint64_t                              _log_base_seq;
   };
 
 } } 
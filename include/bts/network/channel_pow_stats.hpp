@@ -1,54 +1,64 @@
 #pragma once
-#include <bts/mini_pow.hpp>
+#include <bts/config.hpp>
+#include <fc/uint128.hpp>
+#include <fc/time.hpp>
 
 namespace bts { namespace network {
-  
+
   /**
    *  Tracks the bandwidth used by a specific channel and calculates
    *  the average proof-of-work per message to get an idea of what
-   *  is required to broadcast on the network.  
+   *  is required to broadcast on the network.
+   *
+   *  The proof of work of a message is its 128 bit message id, lower
+   *  values represent more work.
    *
    *  If the bandwidth is above the target bandwidth over the last
    *  5 minutes then the required proof-of-work for rebroadcast is
-   *  5% above average, otherwise it is 5% below average.
+   *  1% above average, otherwise it is 1% below average.
+   *
+   *  All of the math is done on fixed width integers, updating the
+   *  stats never allocates.
    */
   class channel_pow_stats
   {
     public:
-       channel_pow_stats();
+       channel_pow_stats( uint64_t target_bps = BITCHAT_TARGET_BPS );
 
        /**
-        *  Updates the weighted-average bits per microsecond handled by
+        *  Updates the weighted-average bits per second handled by
         *  a particular channel using the system clock to measure elapsed
         *  time between calls.
         *
-        *  @param bytes_received the bytes received since the last call
+        *  @param bytes_recv the bytes received since the last call
         *  @param msg_pow  the proof of work associated with these bytes.
+        *  @param now  the time the bytes were received
         *
-        *  @pre msg_pow < target_pow
+        *  The bytes and the proof of work are included in the averages whether
+        *  or not they meet the target, so that the target tracks the work
+        *  actually being done on the channel.
         *
-        *  @return true if these bytes can be received / processed at the given
-        *          proof of work level.
+        *  @return true if msg_pow met the target in effect when the bytes were
+        *          received.
         */
-       bool update_bpus_avg( uint64_t bytes_recv, const mini_pow& msg_pow );
+       bool update_bps_avg( uint64_t bytes_recv, const fc::uint128& msg_pow,
+                            const fc::time_point& now = fc::time_point::now() );
 
-       mini_pow        target_pow;
-       mini_pow        average_pow;
-       uint64_t        target_bits_per_usec;
-       uint64_t        avg_bits_per_usec;
+       fc::uint128     target_pow;
+       fc::uint128     average_pow;
+       uint64_t        target_bits_per_sec;
+       uint64_t        avg_bits_per_sec;
        fc::time_point  last_recv;
   };
-  
+
 } }
 
 #include <fc/reflect/reflect.hpp>
-FC_REFLECT( bts::network::channel_pow_stats, 
+FC_REFLECT( bts::network::channel_pow_stats,
     (target_pow)
     (average_pow)
-    (target_bits_per_usec)
-    (avg_bits_per_usec)
-    (last_recv) 
+    (target_bits_per_sec)
+    (avg_bits_per_sec)
+    (last_recv)
     )
-  
-
 
@@ -2,6 +2,7 @@
 #include <bts/network/stcp_socket.hpp>
 #include <bts/network/message.hpp>
 #include <fc/exception/exception.hpp>
+#include <fc/thread/future.hpp>
 
 namespace bts { namespace network {
   
@@ -11,6 +12,12 @@ namespace bts { namespace network {
    struct message;
    typedef std::shared_ptr<connection> connection_ptr;
 
+   /**
+    *  A message that has been serialized and padded to the wire format once
+    *  so that the same buffer can be shared by every connection it is sent to.
+    */
+   typedef std::shared_ptr<const std::vector<char> > framed_message_ptr;
+
    /** 
     * @brief defines callback interface for connections
     */
@@ -64,6 +71,9 @@ namespace bts { namespace network {
    
         stcp_socket_ptr  get_socket()const;
         fc::ip::endpoint remote_endpoint()const;
+
+        /** total size of the messages received that were handled without error */
+        uint64_t         bytes_received()const;
         
         /**
          *  @return nullptr if no data has been assigned to c
@@ -75,15 +85,59 @@ namespace bts { namespace network {
          */
         void             set_channel_data( const channel_id& c, const channel_data_ptr& d );
    
+        /**
+         *  Serializes the header and payload of m into the padded wire
+         *  format expected by send_framed().
+         */
+        static framed_message_ptr frame( const message& m );
+
         void send( const message& m );
+
+        /**
+         *  Writes a buffer produced by frame(), the buffer is only read so
+         *  it may be shared with other connections.  Encryption is performed
+         *  by this connection's socket as the buffer is written.
+         */
+        void send_framed( const framed_message_ptr& m );
+
+        /**
+         *  Queues m behind every message already sent or queued on this connection
+         *  and returns without waiting for it to be written.
+         *
+         *  @return ready once m has been written, holds the exception if the write failed
+         */
+        fc::future<void> queue_framed( const framed_message_ptr& m );
    
         void connect( const std::string& host_port );  
-        void connect( const fc::ip::endpoint& ep );
+        /** @param crypto_thread if not null the key exchange math is performed on this thread */
+        void connect( const fc::ip::endpoint& ep, fc::thread* crypto_thread = nullptr );
         void close();
 
       private:
         std::unique_ptr<detail::connection_impl> my;
    };
 
+   /**
+    *  Tracks the progress of a message being sent to a single
+    *  connection as part of a broadcast.
+    */
+   struct broadcast_delivery
+   {
+      connection_ptr    con;
+      fc::future<void>  complete; ///< ready once the message has been written to con, holds the exception if the write failed
+   };
+   typedef std::vector<broadcast_delivery> broadcast_status;
+
+   /**
+    *  Frames m once and then writes the shared buffer to every connection in 
+    *  cons concurrently.  This method returns immediately, the caller may wait 
+    *  on the returned futures to learn when (or if) each peer was sent the message.
+    *
+    *  The message is queued on each connection before this returns, so it is written
+    *  ahead of anything sent to the same connection afterward.  Failed writes are 
+    *  logged here.
+    */
+   broadcast_status broadcast( const std::vector<connection_ptr>& cons, const message& m );
+
     
 } } // bts::network 
@@ -0,0 +1,167 @@
+#pragma once
+#include <bts/config.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/time.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace bts { namespace network {
+
+  /**
+   *  A bloom filter with bounded memory that forgets old items.  Items are inserted
+   *  into the newest of several generations.  When the newest generation holds 
+   *  generation_capacity items, or is older than generation_period, the oldest
+   *  generation is cleared and becomes the newest.
+   *
+   *  Memory use is generations * bits_per_generation / 8 bytes no matter how many
+   *  items are inserted.  Lookups may return false positives.  They can only 
+   *  return false negatives for items that were last inserted before every 
+   *  current generation started.
+   *
+   *  This is used to track the inventory a peer is known to have, a false
+   *  positive means we skip announcing one item to that peer.
+   */
+  template<typename Key, typename Hasher = std::hash<Key> >
+  class rolling_bloom_filter
+  {
+     public:
+       rolling_bloom_filter( uint32_t bits_per_generation          = KNOWN_INV_FILTER_BITS,
+                             uint32_t generations                  = KNOWN_INV_FILTER_GENERATIONS,
+                             uint32_t generation_capacity          = KNOWN_INV_FILTER_CAPACITY,
+                             const fc::microseconds& generation_period = fc::seconds(KNOWN_INV_FILTER_PERIOD_SEC) )
+       :_bit_mask(bits_per_generation-1),
+        _generation_capacity(generation_capacity),
+        _generation_period(generation_period),
+        _head(0),
+        _generations(generations)
+       {
+          FC_ASSERT( bits_per_generation >= 64 && (bits_per_generation & (bits_per_generation-1)) == 0,
+                     "bits per generation must be a power of 2", ("bits",bits_per_generation) );
+          FC_ASSERT( generations > 0 );
+          for( auto itr = _generations.begin(); itr != _generations.end(); ++itr )
+          {
+             itr->bits.resize( bits_per_generation / 64 );
+          }
+          _generations[_head].start = fc::time_point::now();
+       }
+
+       /**
+        *  Adds k to the newest generation, refreshing it if it was only
+        *  known by an older generation.
+        *
+        *  @return true if k was not already in the filter
+        */
+       bool insert( const Key& k )
+       {
+          generation& head = current_generation();
+
+          uint64_t h1, h2;
+          hash( k, h1, h2 );
+          bool is_new = !contains( h1, h2 );
+
+          for( uint32_t i = 0; i < KNOWN_INV_FILTER_HASHES; ++i )
+          {
+             uint64_t bit = (h1 + i*h2) & _bit_mask;
+             head.bits[bit/64] |= uint64_t(1) << (bit%64);
+          }
+          ++head.count;
+          return is_new;
+       }
+
+       bool contains( const Key& k )const
+       {
+          uint64_t h1, h2;
+          hash( k, h1, h2 );
+          return contains( h1, h2 );
+       }
+
+       void clear()
+       {
+          for( auto itr = _generations.begin(); itr != _generations.end(); ++itr )
+          {
+             reset( *itr );
+          }
+          _generations[_head].start = fc::time_point::now();
+       }
+
+     private:
+       struct generation
+       {
+          generation():count(0){}
+
+          std::vector<uint64_t> bits;
+          uint32_t              count;
+          fc::time_point        start;
+       };
+
+       static void reset( generation& g )
+       {
+          std::fill( g.bits.begin(), g.bits.end(), 0 );
+          g.count = 0;
+       }
+
+       /** splitmix64 finalizer, std::hash is often the identity for integers */
+       static uint64_t mix( uint64_t z )
+       {
+          z += 0x9e3779b97f4a7c15ull;
+          z  = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+          z  = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+          return z ^ (z >> 31);
+       }
+
+       /** the hash functions are derived as h1 + i*h2 (Kirsch & Mitzenmacher) */
+       static void hash( const Key& k, uint64_t& h1, uint64_t& h2 )
+       {
+          h1 = mix( Hasher()(k) );
+          h2 = mix( h1 ) | 1;
+       }
+
+       bool contains( uint64_t h1, uint64_t h2 )const
+       {
+          for( auto itr = _generations.begin(); itr != _generations.end(); ++itr )
+          {
+             if( itr->count == 0 ) 
+             {
+                continue;
+             }
+             uint32_t i = 0;
+             for( ; i < KNOWN_INV_FILTER_HASHES; ++i )
+             {
+                uint64_t bit = (h1 + i*h2) & _bit_mask;
+                if( !(itr->bits[bit/64] & (uint64_t(1) << (bit%64))) )
+                {
+                   break;
+                }
+             }
+             if( i == KNOWN_INV_FILTER_HASHES )
+             {
+                return true;
+             }
+          }
+          return false;
+       }
+
+       /** retires the oldest generation if the newest one is full or expired */
+       generation& current_generation()
+       {
+          generation& head = _generations[_head];
+          if( head.count >= _generation_capacity || 
+              fc::time_point::now() - head.start > _generation_period )
+          {
+             _head = (_head + 1) % _generations.size();
+             reset( _generations[_head] );
+             _generations[_head].start = fc::time_point::now();
+          }
+          return _generations[_head];
+       }
+
+       uint64_t                 _bit_mask;
+       uint32_t                 _generation_capacity;
+       fc::microseconds         _generation_period;
+       uint32_t                 _head;
+       std::vector<generation>  _generations;
+  };
+
+} } // bts::network
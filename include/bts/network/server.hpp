@@ -108,8 +108,13 @@ namespace bts { namespace network {
          */
         std::vector<connection_ptr> get_connections()const;
 
-        /** send the message to all connected peers */
-        void broadcast( const message& m );
+        /** 
+         *  Send the message to all connected peers.  The message is serialized 
+         *  once and sent to every peer concurrently.
+         *
+         *  @return per-peer delivery state, may be ignored by the caller.
+         */
+        broadcast_status broadcast( const message& m );
       private:
         std::unique_ptr<detail::server_impl> my;
   };
@@ -3,6 +3,8 @@
 #include <fc/crypto/aes.hpp>
 #include <fc/crypto/elliptic.hpp>
 
+namespace fc { class thread; }
+
 namespace bts {  namespace network {
 
 /**
@@ -15,9 +17,23 @@ class stcp_socket : public virtual fc::iostream
     stcp_socket();
     ~stcp_socket();
     fc::tcp_socket&  get_socket() { return _sock; }
-    void             accept();
 
-    void             connect_to( const fc::ip::endpoint& ep );
+    /**
+     *  Performs the server side of the key exchange on a socket that has been
+     *  accepted.
+     *
+     *  @param crypto_thread - if not null the key generation and ECDH are performed
+     *                         on this thread while the calling task waits.
+     */
+    void             accept( fc::thread* crypto_thread = nullptr );
+
+    /**
+     *  Connects to ep and performs the client side of the key exchange.
+     *
+     *  @param crypto_thread - if not null the key generation and ECDH are performed
+     *                         on this thread while the calling task waits.
+     */
+    void             connect_to( const fc::ip::endpoint& ep, fc::thread* crypto_thread = nullptr );
 
     virtual size_t   readsome( char* buffer, size_t max );
     virtual bool     eof()const;
@@ -29,6 +45,8 @@ class stcp_socket : public virtual fc::iostream
     void             get( char& c ) { read( &c, 1 ); }
 
   private:
+    void             key_exchange( fc::thread* crypto_thread );
+
     fc::ecc::private_key _priv_key;
     fc::array<char,8>    _buf;
     uint32_t             _buf_len;
@@ -6,10 +6,47 @@
 #include <bts/network/server.hpp>
 #include <bts/peer/peer_host.hpp>
 
+namespace fc
+{
+   class path;
+};
+
 namespace bts { namespace peer {
 
   namespace detail { class peer_channel_impl; }
 
+  /**
+   *  An immutable snapshot of the connections subscribed to a channel.  The
+   *  snapshot is shared by every caller until the set of connections changes,
+   *  so requesting it does not allocate and it remains valid while the caller 
+   *  yields.
+   */
+  class connection_list
+  {
+     public:
+       typedef std::vector<network::connection_ptr>  vector_type;
+       typedef vector_type::const_iterator           const_iterator;
+
+       connection_list( const std::shared_ptr<const vector_type>& cons = nullptr )
+       :_cons(cons){}
+
+       const_iterator                begin()const                 { return get().begin();  }
+       const_iterator                end()const                   { return get().end();    }
+       size_t                        size()const                  { return get().size();   }
+       bool                          empty()const                 { return get().empty();  }
+       const network::connection_ptr& operator[]( size_t i )const { return get()[i];       }
+
+       operator const vector_type& ()const { return get(); }
+
+     private:
+       const vector_type& get()const
+       {
+          static const vector_type empty_list;
+          return _cons ? *_cons : empty_list;
+       }
+       std::shared_ptr<const vector_type> _cons;
+  };
+
   /**
    *  Tracks a contact address and the last time it was heard about.
   struct host
@@ -39,6 +76,11 @@ namespace bts { namespace peer {
          *  the minimum number of connections exist to this channel, new connections are
          *  opened.
          */
+        /**
+         *  Opens the database of known hosts and connects to the best of them.
+         */
+        void open( const fc::path& peer_db_dir );
+
         void subscribe_to_channel( const network::channel_id& chan, const network::channel_ptr& c );
         void unsubscribe_from_channel( const network::channel_id& chan );
 
@@ -50,7 +92,7 @@ namespace bts { namespace peer {
         /**
          *  @return a list of connections subscribed to a particular channel.
          */
-        std::vector<network::connection_ptr> get_connections( const network::channel_id& chan );
+        connection_list                      get_connections( const network::channel_id& chan );
       private:
         std::shared_ptr<detail::peer_channel_impl> my;
   };
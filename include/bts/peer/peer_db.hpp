@@ -1,13 +1,36 @@
 #pragma once
 #include <bts/peer/peer_host.hpp>
 
+namespace fc
+{
+   class path;
+};
+
 namespace bts { namespace peer {
 
   using network::channel_id;
 
+  namespace detail { class peer_db_impl; }
+
+  /**
+   *  Measures how useful a connection to a host has been in the past.
+   */
+  struct host_stats
+  {
+     host_stats()
+     :avg_latency_ms(0),uptime_sec(0),useful_bytes(0),failures(0){}
+
+     uint32_t  avg_latency_ms; ///< moving average request / reply round trip
+     uint64_t  uptime_sec;     ///< total time we have been connected to the host
+     uint64_t  useful_bytes;   ///< bytes received in messages that were handled without error
+     uint32_t  failures;       ///< failed connection attempts since the last successful one
+
+     /** higher scores are better candidates for a connection */
+     int64_t   score()const;
+  };
 
   /**
-   *  Maintains a database of peers indexed by age, channels, and features. This
+   *  Maintains a database of peers indexed by age, channels, score and features. This
    *  index is persistant and enables a node to maintain a large set of potential
    *  bootstrap nodes for future connections and to quickly connect to new channels
    *  when they need to.
@@ -28,11 +51,18 @@ namespace bts { namespace peer {
        */
       void                reset_ages( const fc::time_point_sec& s );
 
+      /**
+       *  Adds r to the database or updates the existing record for r.ep, the
+       *  first_com time and the stats of an existing record are preserved and
+       *  r.channels are added to the channels it is already known for.
+       */
       void                store( const host& r );
+
+      /** @throw key_not_found_exception if ep is not in the database */
       host                fetch_record( const fc::ip::endpoint& ep );
 
-      /**  Removes a host from the DB, presumably because we attempted to connect 
-       * to it and were unable to.  
+      /**  Removes a host from the DB, presumably because we attempted to connect
+       * to it and were unable to.
        *
        *   TODO: how do we prevent purging the entire DB if the internet goes down
        *   and no hosts are reachable?   Perhaps only perge nodes if we are successfully
@@ -43,9 +73,24 @@ namespace bts { namespace peer {
       void                add_channel( const fc::ip::endpoint& e, const channel_id& c );
       void                remove_channel( const fc::ip::endpoint& e, const channel_id& c );
 
+      /** @return the most recently heard from hosts subscribed to c */
       std::vector<host>   fetch_hosts( const channel_id& c, uint32_t limit = 10 );
+
+      /** @return the most recently heard from hosts on any channel */
+      std::vector<host>   fetch_recent_hosts( uint32_t limit );
+
+      /** @return the hosts with the highest host_stats::score(), the most recent first on ties */
+      std::vector<host>   fetch_best_hosts( uint32_t limit );
+
+      /** @throw key_not_found_exception if ep is not in the database */
+      host_stats          fetch_stats( const fc::ip::endpoint& ep );
+      void                update_stats( const fc::ip::endpoint& ep, const host_stats& s );
+
       void                purge_old( const fc::time_point& age );
 
+      /** the number of hosts in the database */
+      uint32_t            size()const;
+
      private:
       std::unique_ptr<detail::peer_db_impl> my;
 
@@ -53,4 +98,4 @@ namespace bts { namespace peer {
 
 } }  // bts::peer
 
-FC_REFLECT( bts::peer::host, (ep)(last_com)(first_com)(channels)(features) )
+FC_REFLECT( bts::peer::host_stats, (avg_latency_ms)(uptime_sec)(useful_bytes)(failures) )
@@ -20,6 +20,13 @@ namespace bts { namespace peer {
      get_subscribed  = 7
   };
 
+  /** the reasons given in an error_report_msg */
+  enum error_code
+  {
+     unspecified_error     = 0,
+     query_budget_exceeded = 1  ///< the sender exhausted its query budget, the request was not served
+  };
+
   struct config_msg
   {
       static const message_code type = message_code::config;
@@ -70,6 +77,10 @@ namespace bts { namespace peer {
   struct error_report_msg
   {
      static const message_code type = message_code::error_report;
+     error_report_msg():code(unspecified_error){}
+     error_report_msg( uint32_t c, std::string m )
+     :code(c),message( std::move(m) ){}
+
      uint32_t     code;
      std::string  message;
   };
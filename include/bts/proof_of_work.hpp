@@ -3,21 +3,104 @@
 #include <fc/crypto/ripemd160.hpp>
 #include <fc/uint128.hpp>
 
+#include <memory>
+#include <vector>
+
 namespace bts {
 
     /** typedef to the same size */
     typedef fc::ripemd160 pow_hash;
 
+    /** size of the scratch buffer required by proof_of_work */
+    const size_t pow_buffer_size = 8*1024*1024;
+
+    /**
+     *  Scratch space for proof_of_work.  The buffer is accessed at random so huge
+     *  pages save a TLB miss on nearly every step, when they are not available 
+     *  normal pages are used.  Allocate one per thread and reuse it.
+     */
+    class pow_buffer
+    {
+       public:
+          pow_buffer();
+          ~pow_buffer();
+
+          unsigned char* data()const { return _data; }
+
+       private:
+          pow_buffer( const pow_buffer& );
+          pow_buffer& operator=( const pow_buffer& );
+
+          unsigned char* _data;
+          bool           _mapped;
+    };
+
     /**
      *  The purpose of this method is to generate a determinstic proof-of-work
      *  that cannot be optimized via ASIC or extreme parallelism. 
      *
      *  @param in           - initial hash
-     *  @param buffer_128m  - 128 MB buffer used for scratch space.
+     *  @param buffer       - pow_buffer_size bytes used for scratch space.
      *  @return processed hash after doing proof of work.
      */
-    pow_hash proof_of_work( const fc::sha256& in, unsigned char* buffer_128m );
+    pow_hash proof_of_work( const fc::sha256& in, unsigned char* buffer );
+
+    /**
+     *  Evaluates the proof of work on the shared pow_engine::instance() 
+     */
     pow_hash proof_of_work( const fc::sha256& in );
 
-}
+    namespace detail 
+    { 
+       class pow_engine_impl; 
+
+       /** proof_of_work implemented with fc::aes_encoder, used when AES-NI is not available */
+       pow_hash proof_of_work_reference( const fc::sha256& in, unsigned char* buffer );
 
+       /** proof_of_work implemented with AES-NI instructions, requires aesni_supported() */
+       pow_hash proof_of_work_aesni( const fc::sha256& in, unsigned char* buffer );
+
+       bool     aesni_supported();
+
+       /** @return true if the AES-NI kernel is supported and matches the reference */
+       bool     aesni_kernel_verified();
+    }
+
+    /**
+     *  Evaluates proof_of_work on a pool of worker threads.  Each worker owns a 
+     *  scratch buffer that is allocated once, backed by huge pages where the OS
+     *  allows it, so evaluating a hash does not pay for allocating and faulting
+     *  in 8 MB of memory.
+     *
+     *  Work posted to a worker runs to completion before the next item is started,
+     *  so any number of tasks may call evaluate() at once.
+     */
+    class pow_engine
+    {
+       public:
+          /**
+           *  @param threads - number of worker threads, 0 for one per core 
+           */
+          pow_engine( uint32_t threads = 0 );
+          ~pow_engine();
+
+          /** the engine shared by the block chain, wallets and miners */
+          static pow_engine&    instance();
+
+          /** blocks the calling task until a worker has evaluated seed */
+          pow_hash              evaluate( const fc::sha256& seed );
+
+          /**
+           *  Splits seeds among all workers.
+           *
+           *  @return the proof of work of each seed, in the same order
+           */
+          std::vector<pow_hash> evaluate( const std::vector<fc::sha256>& seeds );
+
+          uint32_t              thread_count()const;
+
+       private:
+          std::unique_ptr<detail::pow_engine_impl> my;
+    };
+
+}
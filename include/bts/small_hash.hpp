@@ -18,4 +18,28 @@ namespace bts
    */
   uint160 small_hash( const char* data, size_t len );
 
+  /**
+   *  Performs out[i] = small_hash( data[i], len[i] ) for count independent
+   *  inputs, hashing several inputs at once in SIMD lanes where supported.
+   *
+   *  Every input is read before any output is written, so out may overlap
+   *  the inputs.
+   */
+  void    small_hash( const char* const* data, const size_t* len, size_t count, uint160* out );
+
+  /**
+   *  Performs out[i] = small_hash( data + i*len, len ) for count inputs of the
+   *  same size stored back to back, out may overlap data.
+   */
+  void    small_hash( const char* data, size_t len, size_t count, uint160* out );
+
+  namespace detail
+  {
+     /** multi-buffer SHA-512 (2 lanes) and RIPEMD-160 (4 lanes) with SSE2 */
+     void small_hash_sse2( const char* const* data, const size_t* len, size_t count, uint160* out );
+
+     /** @return true if small_hash_sse2 is available on this platform */
+     bool small_hash_sse2_supported();
+  }
+
 }
@@ -103,6 +103,7 @@ namespace bts {
      my->_server->configure( server_cfg );
 
      my->_peers            = std::make_shared<bts::peer::peer_channel>(my->_server);
+     my->_peers->open( cfg.data_dir / "peers" );
      my->_bitname_client   = std::make_shared<bts::bitname::client>( my->_peers );
      my->_bitname_client->set_delegate( my.get() );
 
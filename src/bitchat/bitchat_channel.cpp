@@ -2,9 +2,12 @@
 #include <bts/bitchat/bitchat_messages.hpp>
 #include <bts/bitchat/bitchat_private_message.hpp>
 #include <bts/bitchat/bitchat_message_cache.hpp>
+#include <bts/network/rolling_bloom_filter.hpp>
+#include <bts/network/channel_pow_stats.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/thread/thread.hpp>
 #include <fc/log/logger.hpp>
+#include <algorithm>
 #include <unordered_map>
 #include <map>
 
@@ -12,13 +15,17 @@ namespace bts { namespace bitchat {
 
   using network::channel_id;
   using network::connection_ptr;
+  using network::rolling_bloom_filter;
 
   namespace detail 
   {
      class chan_data : public network::channel_data
      {
         public:
-          std::unordered_set<fc::uint128> known_inv;
+          rolling_bloom_filter<fc::uint128> known_inv;
+
+          /** messages requested from this connection that have not been received */
+          std::unordered_map<fc::uint128,fc::time_point> requested_msgs;
      };
 
 
@@ -37,8 +44,14 @@ namespace bts { namespace bitchat {
           /// messages that we have recieved inv for, but have not requested the data for
           std::unordered_set<fc::uint128>                    unknown_msgs; 
           std::unordered_map<fc::uint128,fc::time_point>     requested_msgs; // messages that we have requested but not yet received
+          std::unordered_map<fc::uint128,uint32_t>           fetch_attempts; // number of times each requested message was asked for
+          /** the connections that announced each message we have not received and have not failed to deliver it */
+          std::unordered_map<fc::uint128,std::vector<connection_ptr> > msg_sources;
                                                              
           std::vector<fc::uint128>                           new_msgs;  // messages received since last inv broadcast
+
+          /** bandwidth and average work of the messages received on this channel */
+          network::channel_pow_stats                         _pow_stats;
                                                              
           fc::future<void>                                   fetch_loop_complete;
 
@@ -64,6 +77,12 @@ namespace bts { namespace bitchat {
           }
           virtual void handle_unsubscribe( const connection_ptr& c )
           {
+              // anything still requested from c should be fetched from someone else
+              expire_requests( c, get_channel_data(c), fc::time_point::maximum() );
+              for( auto itr = msg_sources.begin(); itr != msg_sources.end(); ++itr )
+              {
+                 itr->second.erase( std::remove( itr->second.begin(), itr->second.end(), c ), itr->second.end() );
+              }
               c->set_channel_data( chan_id, nullptr );
           }
           virtual void handle_message( const connection_ptr& c, const bts::network::message& m )
@@ -98,16 +117,17 @@ namespace bts { namespace bitchat {
                 while( !fetch_loop_complete.canceled() )
                 {
                    broadcast_inv();
+
+                   auto cons = peers->get_connections( chan_id );
+                   fc::time_point expired = fc::time_point::now() - fc::seconds( FETCH_REQUEST_TIMEOUT_SEC );
+                   for( auto c = cons.begin(); c != cons.end(); ++c )
+                   {
+                      expire_requests( *c, get_channel_data( *c ), expired );
+                   }
+
                    if( unknown_msgs.size()  )
                    {
-                      auto cons = peers->get_connections( chan_id );
-                      // copy so we don't hold shared state in the iterators
-                      // while we iterate and send fetch requests
-                      auto tmp = unknown_msgs; 
-                      for( auto itr = tmp.begin(); itr != tmp.end(); ++itr )
-                      {
-                          fetch_from_best_connection( cons, *itr );
-                      }
+                      fetch_unknown_msgs( cons );
                    }
                    /* By using a random sleep we give other peers the oppotunity to find
                     * out about messages before we pick who to fetch from.
@@ -127,20 +147,111 @@ namespace bts { namespace bitchat {
            *   is the host that we have fetched the least from and that has fetched the most from us.
            *
            */
-          void fetch_from_best_connection( const std::vector<connection_ptr>& cons, const fc::uint128& id )
+          void fetch_unknown_msgs( const std::vector<connection_ptr>& cons )
           {
+             if( cons.size() == 0 )
+             {
+                return;
+             }
+
+             std::vector<chan_data*>        con_data( cons.size() );
+             std::vector<get_priv_message>  requests( cons.size() );
+             std::unordered_map<connection_ptr,uint32_t> con_idx;
+             for( uint32_t i = 0; i < cons.size(); ++i )
+             {
+                con_data[i] = &get_channel_data(cons[i]);
+                con_idx[cons[i]] = i;
+             }
+
              // if request is made, move id from unknown_msgs to requested_msgs 
-             // TODO: update this algorithm to be something better. 
+             auto now = fc::time_point::now();
+             for( auto itr = unknown_msgs.begin(); itr != unknown_msgs.end(); )
+             {
+                // pick the least loaded connection that announced the message
+                int32_t best = -1;
+                const auto& sources = msg_sources[*itr];
+                if( sources.empty() )
+                {
+                   // everyone who announced it failed or left, wait for it to be announced again
+                   msg_sources.erase( *itr );
+                   fetch_attempts.erase( *itr );
+                   itr = unknown_msgs.erase(itr);
+                   continue;
+                }
+                for( auto src = sources.begin(); src != sources.end(); ++src )
+                {
+                   auto idx = con_idx.find( *src );
+                   if( idx == con_idx.end() )
+                   {
+                      continue;
+                   }
+                   uint32_t i = idx->second;
+                   size_t load = con_data[i]->requested_msgs.size();
+                   if( requests[i].items.size() < FETCH_BATCH_SIZE &&
+                       load < FETCH_MAX_IN_FLIGHT )
+                   {
+                      if( best == -1 || load < con_data[best]->requested_msgs.size() )
+                      {
+                         best = i;
+                      }
+                   }
+                }
+
+                if( best == -1 )
+                {
+                   ++itr;
+                   continue;
+                }
+                requests[best].items.push_back( *itr );
+                con_data[best]->requested_msgs[*itr] = now;
+                requested_msgs[*itr] = now;
+                ++fetch_attempts[*itr];
+                itr = unknown_msgs.erase(itr);
+             }
+
              for( uint32_t i = 0; i < cons.size(); ++i )
              {
-                 chan_data& cd = get_channel_data(cons[i]); 
-                 if( cd.known_inv.find( id ) !=  cd.known_inv.end() )
-                 {
-                    requested_msgs[id] = fc::time_point::now();
-                    unknown_msgs.erase(id);
-                    cons[i]->send( network::message( get_priv_message( id ), chan_id ) );
-                    return;
-                 }
+                if( requests[i].items.size() )
+                {
+                   cons[i]->send( network::message( requests[i], chan_id ) );
+                }
+             }
+          }
+
+          /**
+           *  Requests to c made before older_than are moved back to unknown_msgs so
+           *  they can be fetched from another connection, or dropped after 
+           *  FETCH_MAX_ATTEMPTS tries or if the message has since been received.
+           */
+          void expire_requests( const connection_ptr& c, chan_data& cd, const fc::time_point& older_than )
+          {
+             for( auto itr = cd.requested_msgs.begin(); itr != cd.requested_msgs.end(); )
+             {
+                if( itr->second >= older_than )
+                {
+                   ++itr;
+                   continue;
+                }
+                requested_msgs.erase( itr->first );
+                if( priv_msgs.find( itr->first ) != priv_msgs.end() )
+                {
+                   // already received from another connection
+                   fetch_attempts.erase( itr->first );
+                }
+                else if( fetch_attempts[itr->first] < FETCH_MAX_ATTEMPTS )
+                {
+                   // c failed to deliver, only ask the other connections that announced it
+                   auto& sources = msg_sources[itr->first];
+                   sources.erase( std::remove( sources.begin(), sources.end(), c ), sources.end() );
+                   unknown_msgs.insert( itr->first );
+                }
+                else
+                {
+                   wlog( "giving up on fetching message ${id}", ("id",itr->first) );
+                   fetch_attempts.erase( itr->first );
+                   msg_sources.erase( itr->first );
+                }
+                itr = cd.requested_msgs.erase(itr);
              }
           }
 
@@ -160,7 +271,7 @@ namespace bts { namespace bitchat {
                   chan_data& cd = get_channel_data( *c );
                   for( uint32_t i = 0; i < new_msgs.size(); ++i )
                   {
-                     if( cd.known_inv.insert( new_msgs[i] ).second )
+                     if( cd.known_inv.insert( new_msgs[i] ) )
                      {
                         msg.items.push_back( new_msgs[i] );
                      }
@@ -185,7 +296,16 @@ namespace bts { namespace bitchat {
               for( auto itr = msg.items.begin(); itr != msg.items.end(); ++itr )
               {
                  cd.known_inv.insert( *itr );
-                 if( priv_msgs.find( *itr ) == priv_msgs.end() )
+                 if( priv_msgs.find( *itr ) != priv_msgs.end() )
+                 {
+                    continue;
+                 }
+                 auto& sources = msg_sources[*itr];
+                 if( std::find( sources.begin(), sources.end(), c ) == sources.end() )
+                 {
+                    sources.push_back( c );
+                 }
+                 if( requested_msgs.find( *itr ) == requested_msgs.end() )
                  {
                     unknown_msgs.insert( *itr );
                  }
@@ -200,10 +320,9 @@ namespace bts { namespace bitchat {
              inv_message reply;
              for( auto itr = msg_time_index.lower_bound( fc::time_point(msg.after) ); itr != msg_time_index.end(); ++itr )
              {
-                if( cd.known_inv.insert( itr->second ).second )
+                if( cd.known_inv.insert( itr->second ) )
                 {
                    reply.items.push_back( itr->second );
-                   cd.known_inv.insert( itr->second );
                 }
              }
              c->send( network::message( reply, chan_id ) );
@@ -228,15 +347,27 @@ namespace bts { namespace bitchat {
           {
               auto mid = msg.id();
               // TODO: verify that we requested this message
+              cd.requested_msgs.erase( mid );
+              requested_msgs.erase( mid );
+              fetch_attempts.erase( mid );
+              unknown_msgs.erase( mid );
+              msg_sources.erase( mid );
 
               //TODO:
-              // validate proof of work 
               // validate timestamp
               // store in index
               // track messages that I've requested and make sure that no one sends us a msg we haven't requested
               if( priv_msgs.find(mid) == priv_msgs.end() )
               {
-                 new_msgs.push_back( mid );
+                 bool meets_target = _pow_stats.update_bps_avg( fc::raw::pack_size( msg ), mid );
+                 if( meets_target || !BITCHAT_RELAY_REQUIRES_POW )
+                 {
+                    new_msgs.push_back( mid );
+                 }
+                 else
+                 {
+                    wlog( "not relaying message ${mid} with insufficient proof of work", ("mid",mid) );
+                 }
                  msg_time_index[fc::time_point::now()] = mid;
                  const encrypted_message& m = (priv_msgs[mid] = std::move(msg));
 
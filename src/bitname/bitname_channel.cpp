@@ -83,6 +83,8 @@ namespace bts { namespace bitname {
 
           fetch_loop_state                                  _fetch_state;                          
           fc::future<void>                                  _fetch_loop;
+          /** set by wake_fetch_loop(), replaced each time the fetch loop runs */
+          fc::promise<void>::ptr                            _fetch_wakeup;
            
            // TODO: on connection disconnect, check to see if there was a pending fetch and
            // cancel it so we can get it from someone else.
@@ -236,17 +238,15 @@ namespace bts { namespace bitname {
              {
                 while( !_fetch_loop.canceled() )
                 {
+                   // anything that arrives while this pass runs wakes up the next one
+                   auto wakeup = fc::promise<void>::ptr( new fc::promise<void>( "bitname::fetch_wakeup" ) );
+                   _fetch_wakeup = wakeup;
+
                    broadcast_inv();
 
                    fetch_next_from_fork_db();
                    
-                   short_name_id_type trx_query = 0;
-                   if( _trx_broadcast_mgr.find_next_query( trx_query ) )
-                   {
-                      auto cons = _peers->get_connections( _chan_id );
-                      fetch_name_from_best_connection( cons, trx_query );
-                      _trx_broadcast_mgr.item_queried( trx_query );
-                   }
+                   fetch_names( _peers->get_connections( _chan_id ) );
                    
                    name_id_type blk_idx_query;
                    if( _block_index_broadcast_mgr.find_next_query( blk_idx_query ) )
@@ -256,17 +256,13 @@ namespace bts { namespace bitname {
                       _block_index_broadcast_mgr.item_queried( blk_idx_query );
                    }
 
-
-                   /* By using a random sleep we give other peers the oppotunity to find
-                    * out about messages before we pick who to fetch from.
-                    * TODO: move constants to config.hpp
-                    *
-                    * TODO: fetch set your fetch order based upon how many times we have received
-                    *        an inv regarding a particular item.
-                    *
-                    * TODO: make sure we seed rand()
-                    */
-                   fc::usleep( fc::microseconds( (rand() % 20000) + 100) );
+                   // sleep until a message arrives or a request times out rather than polling
+                   try {
+                      fc::future<void>( wakeup ).wait_until( next_fetch_deadline() );
+                   } 
+                   catch ( const fc::timeout_exception& )
+                   {
+                   }
                 }
              } 
              catch ( const fc::exception& e )
@@ -277,6 +273,46 @@ namespace bts { namespace bitname {
              }
           }
 
+          /** 
+           *  Called whenever something happens that may give the fetch loop work, such as
+           *  receiving a message or submitting a name.
+           */
+          void wake_fetch_loop()
+          {
+             if( _fetch_wakeup && !_fetch_wakeup->ready() )
+             {
+                _fetch_wakeup->set_value();
+             }
+          }
+
+          /** 
+           *  @return the time when the fetch loop must run again even if nothing arrives,
+           *          the earliest time an outstanding request times out.
+           */
+          fc::time_point next_fetch_deadline()
+          {
+             auto now = fc::time_point::now();
+             if( _new_block_info )
+             {
+                return now;
+             }
+             fc::time_point deadline = now + fc::milliseconds( BITNAME_FETCH_MAX_WAIT_MS );
+             if( _pending_block_fetch )
+             {
+                deadline = std::min( deadline, *_pending_block_fetch + fc::seconds( BITNAME_BLOCK_FETCH_TIMEOUT_SEC ) );
+             }
+             auto cons = _peers->get_connections( _chan_id );
+             for( auto c = cons.begin(); c != cons.end(); ++c )
+             {
+                auto oldest = get_channel_data( *c ).trxs_mgr.oldest_request();
+                if( oldest != fc::time_point::maximum() )
+                {
+                   deadline = std::min( deadline, oldest + fc::seconds( FETCH_REQUEST_TIMEOUT_SEC ) );
+                }
+             }
+             return deadline;
+          }
+
           void request_latest_blocks()
           {
               auto cons = _peers->get_connections( _chan_id );
@@ -336,29 +372,90 @@ namespace bts { namespace bitname {
 
 
           /**
-           *   For any given message id, there are many potential hosts from which it could be fetched.  We
-           *   want to distribute the load across all hosts equally and therefore, the best one to fetch from
-           *   is the host that we have fetched the least from and that has fetched the most from us.
+           *   For any given name there are many potential hosts from which it could be fetched.  The
+           *   most announced names are assigned to the least loaded connections that announced them,
+           *   up to FETCH_BATCH_SIZE names per connection, and each connection is then sent a single
+           *   request.  Requests that are not answered within FETCH_REQUEST_TIMEOUT_SEC are retried.
            */
-          void fetch_name_from_best_connection( const std::vector<connection_ptr>& cons, uint64_t id )
+          void fetch_names( const std::vector<connection_ptr>& cons )
           { try {
-              ilog( "${id}", ("id",id) );
-             // if request is made, move id from unknown_names to requested_msgs 
-             // TODO: update this algorithm to be something better. 
+             if( cons.size() == 0 ) 
+             {
+                return;
+             }
+
+             fc::time_point expired = fc::time_point::now() - fc::seconds( FETCH_REQUEST_TIMEOUT_SEC );
+             std::vector<chan_data*> con_data( cons.size() );
              for( uint32_t i = 0; i < cons.size(); ++i )
              {
-                 ilog( "con ${i}", ("i",i) );
-                 chan_data& chan_data = get_channel_data(cons[i]); 
-                 if( chan_data.trxs_mgr.knows( id ) && !chan_data.trxs_mgr.has_pending_request() )
-                 {
-                    chan_data.trxs_mgr.requested(id);
-                    get_name_header_message request( id );
-                    ilog( "request ${msg}", ("msg",request) );
-                    cons[i]->send( network::message( request, _chan_id ) );
-                    return;
-                 }
+                con_data[i] = &get_channel_data( cons[i] );
+                auto timed_out = con_data[i]->trxs_mgr.expire_requests( expired );
+                for( auto itr = timed_out.begin(); itr != timed_out.end(); ++itr )
+                {
+                   _trx_broadcast_mgr.query_failed( *itr, cons[i] );
+                }
              }
-          } FC_RETHROW_EXCEPTIONS( warn, "error fetching name ${name_hash}", ("name_hash",id) ) }
+
+             std::vector<short_name_id_type> candidates;
+             if( !_trx_broadcast_mgr.find_next_queries( candidates, FETCH_BATCH_SIZE * cons.size() ) )
+             {
+                return;
+             }
+
+             std::unordered_map<connection_ptr,uint32_t> con_idx;
+             for( uint32_t i = 0; i < cons.size(); ++i )
+             {
+                con_idx[cons[i]] = i;
+             }
+
+             std::vector<get_name_headers_message> requests( cons.size() );
+             for( auto id = candidates.begin(); id != candidates.end(); ++id )
+             {
+                int32_t best      = -1;
+                bool    connected = false;
+                const auto& sources = _trx_broadcast_mgr.announced_by( *id );
+                for( auto src = sources.begin(); src != sources.end(); ++src )
+                {
+                   auto idx = con_idx.find( *src );
+                   if( idx == con_idx.end() ) 
+                   {
+                      continue;
+                   }
+                   connected = true;
+                   uint32_t i = idx->second;
+                   size_t load = con_data[i]->trxs_mgr.pending_request_count();
+                   if( requests[i].name_trx_ids.size() < FETCH_BATCH_SIZE && 
+                       load < FETCH_MAX_IN_FLIGHT )
+                   {
+                      if( best == -1 || load < con_data[best]->trxs_mgr.pending_request_count() )
+                      {
+                         best = i;
+                      }
+                   }
+                }
+                if( best != -1 )
+                {
+                   con_data[best]->trxs_mgr.requested( *id );
+                   requests[best].name_trx_ids.push_back( *id );
+                   _trx_broadcast_mgr.item_queried( *id );
+                }
+                else if( !connected )
+                {
+                   // nobody we are connected to can provide it, let the names that can be fetched go first
+                   _trx_broadcast_mgr.query_deferred( *id );
+                }
+             }
+
+             for( uint32_t i = 0; i < cons.size(); ++i )
+             {
+                if( requests[i].name_trx_ids.size() )
+                {
+                   ilog( "requesting ${n} names from ${ep}", 
+                         ("n",requests[i].name_trx_ids.size())("ep",cons[i]->remote_endpoint()) );
+                   cons[i]->send( network::message( requests[i], _chan_id ) );
+                }
+             }
+          } FC_RETHROW_EXCEPTIONS( warn, "error fetching names" ) }
 
           void fetch_block_from_best_connection( const std::vector<connection_ptr>& cons,  const name_id_type& id )
           { try {
@@ -394,7 +491,9 @@ namespace bts { namespace bitname {
              {
                  ilog( "con ${i}", ("i",i) );
                  chan_data& chan_data = get_channel_data(cons[i]); 
-                 if( chan_data.block_mgr.knows(id) && !chan_data.block_mgr.has_pending_request() )
+                 const auto& sources  = _block_index_broadcast_mgr.announced_by( id );
+                 if( std::find( sources.begin(), sources.end(), cons[i] ) != sources.end() && 
+                     !chan_data.block_mgr.has_pending_request() )
                  {
                     ilog( "request ${msg}", ("msg",get_block_index_message(id)) );
                     chan_data.block_mgr.requested(id);
@@ -432,6 +531,14 @@ namespace bts { namespace bitname {
 
           virtual void handle_unsubscribe( const connection_ptr& c )
           {
+              // anything still requested from c should be fetched from someone else
+              auto pending = get_channel_data(c).trxs_mgr.expire_requests( fc::time_point::maximum() );
+              for( auto itr = pending.begin(); itr != pending.end(); ++itr )
+              {
+                 _trx_broadcast_mgr.query_failed( *itr, c );
+              }
+              _trx_broadcast_mgr.remove_source( c );
+              _block_index_broadcast_mgr.remove_source( c );
               c->set_channel_data( _chan_id, nullptr );
           }
 
@@ -466,6 +573,9 @@ namespace bts { namespace bitname {
                  case get_name_header_msg:
                    handle_get_name( con, cdat, m.as<get_name_header_message>() );
                    break;
+                 case get_name_headers_msg:
+                   handle_get_names( con, cdat, m.as<get_name_headers_message>() );
+                   break;
                  case name_header_msg:
                    handle_name( con, cdat, m.as<name_header_message>() );
                    break;
@@ -486,6 +596,7 @@ namespace bts { namespace bitname {
             {
               wlog( "${e}  ${from}", ("e",e.to_detail_string())("from",con->remote_endpoint()) );
             }
+            wake_fetch_loop();
           }  // handle_message
 
 
@@ -515,7 +626,7 @@ namespace bts { namespace bitname {
               ilog( "inv: ${msg}", ("msg",msg) );
               for( auto itr = msg.name_trxs.begin(); itr != msg.name_trxs.end(); ++itr )
               {
-                 _trx_broadcast_mgr.received_inventory_notice( *itr ); 
+                 _trx_broadcast_mgr.received_inventory_notice( *itr, con ); 
               }
               cdat.trxs_mgr.update_known( msg.name_trxs );
           }
@@ -526,7 +637,7 @@ namespace bts { namespace bitname {
               ilog( "inv: ${msg}", ("msg",msg) );
               for( auto itr = msg.block_ids.begin(); itr != msg.block_ids.end(); ++itr )
               {
-                 _block_index_broadcast_mgr.received_inventory_notice( *itr );
+                 _block_index_broadcast_mgr.received_inventory_notice( *itr, con );
               }
               cdat.block_mgr.update_known( msg.block_ids );
           }
@@ -622,6 +733,23 @@ namespace bts { namespace bitname {
              }
           }
    
+          /* ===================================================== */   
+          void handle_get_names( const connection_ptr& con,  chan_data& cdat, const get_name_headers_message& msg )
+          { try {
+             FC_ASSERT( msg.name_trx_ids.size() <= FETCH_BATCH_SIZE );
+             for( auto itr = msg.name_trx_ids.begin(); itr != msg.name_trx_ids.end(); ++itr )
+             {
+                // names that have expired from the broadcast cache are skipped, the requester
+                // will time out and ask someone else.
+                const fc::optional<name_header>& trx = _trx_broadcast_mgr.get_value( *itr );
+                if( trx )
+                {
+                   con->send( network::message( name_header_message( *trx ), _chan_id ) );
+                   cdat.trxs_mgr.update_known( *itr );
+                }
+             }
+          } FC_RETHROW_EXCEPTIONS( warn, "", ("msg",msg) ) }
+   
           void handle_block_index( const connection_ptr& con,  chan_data& cdat, const block_index_message& msg )
           {
              ilog( "${msg}", ("msg",msg) );
@@ -652,7 +780,7 @@ namespace bts { namespace bitname {
                     else
                     {
                        dlmgr.unknown[msg.index.name_trxs[i]] = i;
-                       _trx_broadcast_mgr.received_inventory_notice( msg.index.name_trxs[i] ); 
+                       _trx_broadcast_mgr.received_inventory_notice( msg.index.name_trxs[i], con ); 
                        cdat.trxs_mgr.update_known( msg.index.name_trxs[i] );
                     }
                 }
@@ -669,7 +797,15 @@ namespace bts { namespace bitname {
           { try {
              ilog( "${msg}", ("msg",msg) );
              auto short_id = msg.trx.short_id();
-             cdat.trxs_mgr.received_response( short_id );
+             if( cdat.trxs_mgr.did_request( short_id ) )
+             {
+                cdat.trxs_mgr.received_response( short_id );
+             }
+             if( _trx_broadcast_mgr.get_value( short_id ) )
+             {
+                // a late reply to a request that timed out and was retried elsewhere
+                return;
+             }
              try { 
                 // attempt to complete blocks without validating the trx so that
                 // we can then mark the block as 'complete' and then invalidate it
@@ -794,6 +930,7 @@ namespace bts { namespace bitname {
         if( my->_fetch_loop.valid() )
         {
             my->_fetch_loop.cancel();
+            my->wake_fetch_loop();
             my->_fetch_loop.wait();
         }
      } 
@@ -824,6 +961,7 @@ namespace bts { namespace bitname {
   void name_channel::submit_name( const name_header& new_name_trx )
   { 
      my->submit_name( new_name_trx );
+     my->wake_fetch_loop();
   }
 
   void name_channel::submit_block( const name_block& block_to_submit )
@@ -834,6 +972,7 @@ namespace bts { namespace bitname {
      if( block_difficulty >= my->_name_db.target_difficulty() )
      {
          my->submit_block( block_to_submit );
+         my->wake_fetch_loop();
      }
      else 
      {
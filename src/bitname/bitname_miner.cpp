@@ -8,106 +8,236 @@
 #include <fc/reflect/variant.hpp>
 #include <fc/log/logger.hpp>
 
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
 namespace bts { namespace bitname {
 
   namespace detail 
   {
+    /**
+     *  Hashes a name_header that only differs by nonce and utc_sec without packing
+     *  it again.  The nonce is the first field that is serialized so no midstate
+     *  can be shared between nonces, but the header is packed once and the two 
+     *  fields are patched in place.
+     */
+    class header_hasher
+    {
+       public:
+         header_hasher( const name_header& h )
+         :_packed( fc::raw::pack( h ) )
+         {
+            FC_ASSERT( _packed.size() >= time_offset + sizeof(uint32_t) );
+         }
+
+         void set_nonce( uint16_t nonce )
+         {
+            memcpy( _packed.data() + nonce_offset, (char*)&nonce, sizeof(nonce) );
+         }
+
+         void set_time( const fc::time_point_sec& t )
+         {
+            uint32_t sec = t.sec_since_epoch();
+            memcpy( _packed.data() + time_offset, (char*)&sec, sizeof(sec) );
+         }
+
+         name_id_type hash()const
+         {
+            return name_id_type::hash( _packed.data(), _packed.size() );
+         }
+
+       private:
+         // fields are packed in the order nonce, age, utc_sec...
+         static const size_t nonce_offset = 0;
+         static const size_t time_offset  = sizeof(uint16_t) + sizeof(uint32_t);
+
+         std::vector<char> _packed;
+    };
+
+    struct mining_thread
+    {
+       mining_thread( const std::string& name )
+       :thread(name),hashes(0),hash_rate(0){}
+
+       fc::thread             thread;
+       fc::future<void>       complete;
+       fc::time_point_sec     mine_time;
+       std::atomic<uint64_t>  hashes;
+       double                 hash_rate; ///< guarded by name_miner_impl::_stats_mutex
+    };
+
     class name_miner_impl
     {
       public:
-        name_miner_impl()
+        name_miner_impl( uint32_t threads )
         :_callback_thread( fc::thread::current() ),
          _callback_del(nullptr),
          _cur_effort(0), //TODO: restore.. DEFAULT_MINING_EFFORT_PERCENT/100.0)
          _block_ver(0),
          _block_target(0),
          _name_trx_target(0),
-         _min_name_trx_target(0)
+         _min_name_trx_target(0),
+         _shares_found(0),
+         _blocks_found(0)
          {
             _name_trx_target     = min_name_difficulty();
             _block_target        = _name_trx_target;
             _min_name_trx_target = _name_trx_target;
 
-            if( DEFAULT_MINING_THREADS > 0 ) _threads[0].set_name( "bitname1" );
-            if( DEFAULT_MINING_THREADS > 1 ) _threads[1].set_name( "bitname2" );
-            if( DEFAULT_MINING_THREADS > 2 ) _threads[2].set_name( "bitname3" );
-            if( DEFAULT_MINING_THREADS > 3 ) _threads[3].set_name( "bitname4" );
+            if( threads == 0 )
+            {
+               threads = std::max<uint32_t>( 1, std::thread::hardware_concurrency() );
+            }
+            for( uint32_t i = 0; i < threads; ++i )
+            {
+               _threads.push_back( std::unique_ptr<mining_thread>( 
+                                      new mining_thread( "bitname" + std::to_string( i + 1 ) ) ) );
+            }
          }
         ~name_miner_impl()
         {
           _block_ver = -1;
-          for( uint32_t i = 0; i < DEFAULT_MINING_THREADS; ++i )
+          for( uint32_t i = 0; i < _threads.size(); ++i )
           {
-            _threads[i].quit();
+            _threads[i]->thread.quit();
           }
         }
 
-        fc::thread&           _callback_thread;
-        name_miner_delegate*  _callback_del;
+        fc::thread&                                  _callback_thread;
+        name_miner_delegate*                         _callback_del;
 
-        fc::thread            _threads[DEFAULT_MINING_THREADS];
+        std::vector<std::unique_ptr<mining_thread>>  _threads;
 
-        fc::future<void>      _mining_complete[DEFAULT_MINING_THREADS];
+        std::atomic<float>                           _cur_effort;
+        name_block                                   _cur_block;
 
-        float                 _cur_effort;
-        name_block            _cur_block;
+        std::atomic<uint64_t>                        _block_ver; // incremented anytime block state changes
+        uint64_t                                     _block_target;
+        uint64_t                                     _name_trx_target;
+        uint64_t                                     _min_name_trx_target;
 
-        volatile uint64_t     _block_ver; // incremented anytime block state changes
-        uint64_t              _block_target;
-        uint64_t              _name_trx_target;
-        uint64_t              _min_name_trx_target;
-        fc::time_point_sec    _mine_time[DEFAULT_MINING_THREADS];
+        mutable std::mutex                           _stats_mutex;
+        std::atomic<uint64_t>                        _shares_found;
+        std::atomic<uint64_t>                        _blocks_found;
 
         /**
-         *  Called from mining thread
+         *  Limits the time spent hashing to effort * MINING_DUTY_CYCLE_MS of every
+         *  MINING_DUTY_CYCLE_MS, the thread sleeps for the rest of the cycle.
          */
-        void start_mining( name_block b, uint32_t thread_num, uint64_t ver )
+        void duty_cycle( fc::time_point& cycle_start )
+        {
+           float effort = _cur_effort;
+           if( effort >= 1 )
+           {
+              return;
+           }
+           auto period = fc::microseconds( MINING_DUTY_CYCLE_MS * 1000ll );
+           auto busy   = fc::time_point::now() - cycle_start;
+           if( busy.count() >= period.count() * effort )
+           {
+              fc::usleep( fc::microseconds( int64_t( period.count() * (1 - effort) ) ) );
+              cycle_start = fc::time_point::now();
+           }
+        }
+
+        void update_hash_rate( mining_thread& self, uint64_t hashes, const fc::time_point& start )
         {
+           auto elapsed = fc::time_point::now() - start;
+           if( elapsed.count() > 0 )
+           {
+              std::unique_lock<std::mutex> lock( _stats_mutex );
+              self.hash_rate = hashes / (elapsed.count() / 1000000.0);
+           }
+        }
+
+        /**
+         *  Called from mining thread, only the header is copied because the hash does
+         *  not depend upon the name trxs in the block.
+         */
+        void start_mining( std::shared_ptr<const name_block> blk, uint32_t thread_num, uint64_t ver )
+        {
+          mining_thread& self = *_threads[thread_num];
+          name_header    b    = *blk;
           try { 
             if( b.name_hash == 0 ) return;
 
-            uint16_t max_nonce = uint16_t(-1) - DEFAULT_MINING_THREADS;
+            // a header can only meet the target if its id is at most trx_target, the
+            // exact difficulty is only computed for those headers
+            name_id_type   trx_target    = bts::difficulty_target( _name_trx_target );
+            header_hasher  hasher( b );
+            hasher.set_time( b.utc_sec );
+            FC_ASSERT( hasher.hash() == b.id() );
+
+            uint32_t       threads       = _threads.size();
+            uint16_t       max_nonce     = uint16_t(-1) - threads;
+            fc::time_point cycle_start   = fc::time_point::now();
+            fc::time_point window_start  = cycle_start;
+            uint64_t       window_hashes = 0;
             while( ver >= _block_ver )
             {
-               if( (fc::time_point::now() - _mine_time[thread_num]) > fc::seconds( 10 ) )
+               if( (fc::time_point::now() - self.mine_time) > fc::seconds( 10 ) )
                {
-                 _mine_time[thread_num] = fc::time_point::now() - fc::seconds(10);
+                 self.mine_time = fc::time_point::now() - fc::seconds(10);
                }
-               b.utc_sec = _mine_time[thread_num];
-               for( uint32_t nonce = thread_num; ver >= _block_ver && nonce < max_nonce; nonce += DEFAULT_MINING_THREADS )
+               b.utc_sec = self.mine_time;
+               hasher.set_time( b.utc_sec );
+               for( uint32_t nonce = thread_num; ver >= _block_ver && nonce < max_nonce; nonce += threads )
                {
-                   b.nonce   = nonce;
-               
-                   uint64_t header_difficulty = b.difficulty();
+                   hasher.set_nonce( nonce );
+                   name_id_type id = hasher.hash();
+                   ++self.hashes;
+                   ++window_hashes;
 
-                   if( header_difficulty > _name_trx_target )
+                   if( !(trx_target < id) )
                    {
-            //          wlog( "++++   ${ver}  ++++++++++++found: ${f}    ${now}  difficulty: ${diff}", ("f",b)("now", fc::time_point::now())("diff",header_difficulty)("ver",ver)  );
-                      _mine_time[thread_num] += 1;
-                      if( ver == _block_ver )
+                      b.nonce = nonce;
+                      uint64_t header_difficulty = b.difficulty();
+                      if( header_difficulty <= _name_trx_target )
                       {
-                          ++_block_ver;
-                          _callback_thread.async( [=](){ _callback_del->found_name_block( b ); } );
+                         continue; // only possible if the difficulty overflowed int64
                       }
-                      else
+                      self.mine_time += 1;
+                      if( ver == _block_ver )
                       {
-             //             elog( "SKIPING OLD" );
+                          ++_block_ver;
+                          ++_shares_found;
+                          if( header_difficulty > _block_target ) 
+                          {
+                             ++_blocks_found;
+                          }
+                          name_block found = *blk;
+                          static_cast<name_header&>(found) = b;
+                          _callback_thread.async( [=](){ _callback_del->found_name_block( found ); } );
                       }
+                      update_hash_rate( self, window_hashes, window_start );
                       return;
                    }
 
-                   // exit if the block has been updated
-                   if( ver < _block_ver ) { /*ilog( "     EXIT  ${ver}", ("ver",ver) );*/ return; }
+                   // the clock is only read every 256 hashes
+                   if( (window_hashes & 0xff) == 0 )
+                   {
+                      duty_cycle( cycle_start );
+                      auto now = fc::time_point::now();
+                      if( now - window_start > fc::seconds( MINER_STATS_PERIOD_SEC ) )
+                      {
+                         update_hash_rate( self, window_hashes, window_start );
+                         window_start  = now;
+                         window_hashes = 0;
+                      }
+                   }
                }
-               _mine_time[thread_num] += 1;
-               b.utc_sec = _mine_time[thread_num];
+               self.mine_time += 1;
+               b.utc_sec = self.mine_time;
 
-               do {
-                   fc::usleep( fc::microseconds( 5000 + 1000000 * (1-_cur_effort) ) );
-               } while ( b.utc_sec > fc::time_point::now() );
-               
+               // the nonce space for this second is exhausted, wait until the timestamp is valid
+               auto wait = fc::time_point(b.utc_sec) - fc::time_point::now();
+               if( wait.count() > 0 )
+               {
+                   fc::usleep( wait );
+               }
             }
-           // ilog( "---EXIT  ------------------------thread: ${t}  ver ${ver}  blockver ${blockver}", ("t",thread_num)("ver",ver)("b",b)("blockver", _block_ver) );
           }
           catch ( const fc::exception& e )
           {
@@ -116,38 +246,37 @@ namespace bts { namespace bitname {
           }
         }
 
+        void wait_for_threads()
+        {
+           for( uint32_t i = 0; i < _threads.size(); ++i )
+           {
+              if( _threads[i]->complete.valid() ) _threads[i]->complete.wait();
+           }
+        }
+
         void start_new_block()
         {
-         //  elog( "-----------------     start_new_block           --------------------" );
            FC_ASSERT( _callback_del != nullptr ); // no point in mining if there is no one to tell when we find the result
 
            _cur_block.trxs_hash = _cur_block.calc_trxs_hash();
 
-           //uint64_t block_diff = _cur_block.calc_difficulty();
-           //name_pow_target = mini_pow_difficulty(min_name_pow);
-
            auto next_blk = ++_block_ver;
-
-        //  ilog( "wait for complete" );
-           for( uint32_t i = 0; i < DEFAULT_MINING_THREADS; ++i )
-           {
-              if( _mining_complete[i].valid() ) _mining_complete[i].wait();
-           }
-         // ilog( "start next" );
+           wait_for_threads();
 
            if( _cur_block.name_hash != 0 )
            {
-              for( uint32_t i = 0; i < DEFAULT_MINING_THREADS; ++i )
+              // one copy of the block is shared by all threads
+              auto b = std::make_shared<const name_block>( _cur_block );
+              for( uint32_t i = 0; i < _threads.size(); ++i )
               {
-                 auto b = _cur_block; // create a copy to pass to thread
-                 _mining_complete[i] = _threads[i].async( [b,i,this,next_blk](){ start_mining(b,i,next_blk); } );
+                 _threads[i]->complete = _threads[i]->thread.async( [b,i,this,next_blk](){ start_mining(b,i,next_blk); } );
               }
            }
         }
     };
   }
 
-  name_miner::name_miner() :my( new detail::name_miner_impl() ) {}
+  name_miner::name_miner( uint32_t threads ) :my( new detail::name_miner_impl( threads ) ) {}
   name_miner::~name_miner(){}
 
   void name_miner::set_delegate(  name_miner_delegate* callback_del )
@@ -165,10 +294,8 @@ namespace bts { namespace bitname {
 
   void name_miner::start( float effort )
   {
-  //  wlog( "START MINING ${effort}", ("effort",effort) );
-    bool kickoff = my->_cur_effort <= 0;
-    my->_cur_effort = effort;
-    if( effort  != 0 )
+    my->_cur_effort = std::min<float>( effort, 1 );
+    if( effort  > 0 )
     {
        my->start_new_block();
     }
@@ -182,13 +309,26 @@ namespace bts { namespace bitname {
 
     if( wait_stop )
     {
-       for( uint32_t i = 0; i < DEFAULT_MINING_THREADS; ++i )
-       {
-          my->_mining_complete[i].wait();
-       }
+       my->wait_for_threads();
     }
   }
 
+  name_miner_stats name_miner::get_stats()const
+  {
+     name_miner_stats stats;
+     stats.shares_found = my->_shares_found;
+     stats.blocks_found = my->_blocks_found;
+
+     std::unique_lock<std::mutex> lock( my->_stats_mutex );
+     for( auto itr = my->_threads.begin(); itr != my->_threads.end(); ++itr )
+     {
+        stats.hashes    += (*itr)->hashes;
+        stats.hash_rate += (*itr)->hash_rate;
+        stats.thread_hash_rates.push_back( (*itr)->hash_rate );
+     }
+     return stats;
+  }
+
   void name_miner::add_name_trx( const name_header& t )
   {
       if( my->_cur_block.name_hash == 0 )
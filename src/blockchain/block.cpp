@@ -69,42 +69,19 @@ namespace bts { namespace blockchain  {
   trx_block::operator full_block()const
   {
     full_block b( (const block&)*this );
-    b.trx_ids.reserve( trxs.size() );
-    for( auto itr = trxs.begin(); itr != trxs.end(); ++itr )
-    {
-      b.trx_ids.push_back( itr->id() );
-    }
+    b.trx_ids = calculate_trx_ids( trxs );
     return b;
   }
 
 
   uint160 trx_block::calculate_merkle_root()const
   {
-     if( trxs.size() == 0 ) return uint160();
-     if( trxs.size() == 1 ) return trxs.front().id();
-
-     std::vector<uint160> layer_one;
-     for( auto itr = trxs.begin(); itr != trxs.end(); ++itr )
-     {
-       layer_one.push_back(itr->id());
-     }
-     std::vector<uint160> layer_two;
-     while( layer_one.size() > 1 )
-     {
-        if( layer_one.size() % 2 == 1 )
-        {
-          layer_one.push_back( uint160() );
-        }
-
-        static_assert( sizeof(uint160[2]) == 40, "validate there is no padding between array items" );
-        for( uint32_t i = 0; i < layer_one.size(); i += 2 )
-        {
-            layer_two.push_back(  small_hash( (char*)&layer_one[i], 2*sizeof(uint160) ) );
-        }
-
-        layer_one = std::move(layer_two);
-     }
-     return layer_one.front();
+     return bts::calculate_merkle_root( calculate_trx_ids( trxs ) );
+  }
+
+  uint160 full_block::calculate_merkle_root()const
+  {
+     return bts::calculate_merkle_root( trx_ids );
   }
 
   uint160 block_state::digest()const
@@ -128,13 +105,18 @@ namespace bts { namespace blockchain  {
    *  Calculate the proof of work hash from the merkle root + nonce
    */
   pow_hash block_proof::proof_of_work()const
+  {
+     return bts::proof_of_work( pow_seed() );
+  }
+
+  fc::sha256 block_proof::pow_seed()const
   {
      FC_ASSERT( pow.branch_path.mid_states.size() > 0 );
      FC_ASSERT( pow.branch_path.mid_states[0] == block_header::digest() );
      fc::sha256::encoder enc;
      fc::raw::pack( enc, pow.nonce );
      fc::raw::pack( enc, pow.branch_path.calculate_root() );
-     return bts::proof_of_work( enc.result() );
+     return enc.result();
   }
 
   /**
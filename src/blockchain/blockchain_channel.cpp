@@ -1,10 +1,17 @@
+#include <bts/config.hpp>
 #include <bts/blockchain/blockchain_channel.hpp>
 #include <bts/blockchain/blockchain_db.hpp>
 #include <bts/blockchain/blockchain_messages.hpp>
+#include <bts/blockchain/blockchain_pending_pool.hpp>
+#include <bts/peer/peer_messages.hpp>
+#include <bts/network/rolling_bloom_filter.hpp>
 
 #include <fc/reflect/variant.hpp>
+#include <fc/thread/thread.hpp>
 #include <fc/log/logger.hpp>
 
+#include <algorithm>
+#include <deque>
 #include <map>
 
 namespace bts { namespace blockchain {
@@ -19,8 +26,11 @@ namespace bts { namespace blockchain {
      class chan_data : public network::channel_data
      {
         public:
-          std::unordered_set<uint160>     known_trx_inv;
-          std::unordered_set<fc::sha224>  known_block_inv;
+          chan_data()
+          :sync_timeouts(0),query_budget(QUERY_BUDGET_MAX),budget_updated( fc::time_point::now() ){}
+
+          rolling_bloom_filter<uint160>     known_trx_inv;
+          rolling_bloom_filter<fc::sha224>  known_block_inv;
 
           // fetches for which we have not yet received a reply...
           // TODO: add a timestamp so we can time it out properly....
@@ -32,6 +42,54 @@ namespace bts { namespace blockchain {
           // only one request at a time, null hash means nothing pending
           fc::sha224                     requested_full_block; 
           fc::sha224                     requested_trx_block; 
+          /** when requested_trx_block was requested, an unanswered request stops blocking new ones after BLOCK_DOWNLOAD_TIMEOUT_SEC */
+          fc::time_point                 requested_trx_block_time;
+
+          /** set while a get_headers request is outstanding */
+          fc::optional<fc::time_point>   requested_headers;
+          /** highest block number this connection has sent us a header for */
+          fc::optional<uint32_t>         known_head_num;
+          /** block bodies requested from this connection during sync, by block number */
+          std::unordered_map<uint32_t,fc::time_point> requested_sync_blocks;
+          /** block body requests to this connection that timed out */
+          uint32_t                       sync_timeouts;
+
+          /** 
+           *  Queries made by this connection are charged against a budget that refills over time 
+           *  so that a single connection cannot monopolize the db.
+           */
+          int64_t                        query_budget;
+          fc::time_point                 budget_updated;
+
+          /** 
+           *  Charges cost against the budget, the budget may go negative when the real cost of
+           *  a query is only known after it has been performed.
+           *
+           *  @return false if the budget is already exhausted, in which case nothing is charged
+           */
+          bool consume_query_budget( uint32_t cost )
+          {
+              auto now = fc::time_point::now();
+              query_budget += (now - budget_updated).count() * QUERY_BUDGET_PER_SEC / 1000000;
+              query_budget  = std::min<int64_t>( query_budget, QUERY_BUDGET_MAX );
+              budget_updated = now;
+              if( query_budget < 0 )
+              {
+                 return false;
+              }
+              query_budget -= cost;
+              return true;
+          }
+     };
+
+     /**
+      *  A header that has been validated and links to our chain, but
+      *  whose block has not yet been pushed.
+      */
+     struct sync_header
+     {
+        block_proof header;
+        fc::sha224  id;
      };
 
 
@@ -43,17 +101,97 @@ namespace bts { namespace blockchain {
         std::unordered_map<uint160,uint16_t>  missing_trx_idx;
         full_block                            full_blk;
         std::vector<signed_transaction>       trxs;
+        fc::time_point                        start_time;
+        /** the connection that sent the compact block and was asked for the missing trxs */
+        connection_ptr                        source;
+        /** every connection that sent us the compact block, any of them can provide the trxs */
+        std::vector<connection_ptr>           announced_by;
+     };
+
+     /**
+      *  The replies to get_full_block and get_trx_block requests for a block, serialized 
+      *  and framed once so they can be sent to any number of connections.
+      */
+     struct cached_block
+     {
+        fc::sha224                   id;
+        network::framed_message_ptr  full_block_msg;
+        network::framed_message_ptr  trx_block_msg;
+     };
+
+     /**
+      *  Keeps the most recently pushed blocks in memory so that the peers following the
+      *  head of the chain can be served without reading the db.
+      */
+     class recent_block_cache
+     {
+        public:
+          void store( const trx_block& b, const network::channel_id& chan_id )
+          {
+              cached_block& cb = _blocks[b.block_num];
+              _ids.erase( cb.id ); // replaced by a block on another fork
+              cb.id             = b.id();
+              cb.full_block_msg = connection::frame( network::message( full_block_message( b.operator full_block() ), chan_id ) );
+              cb.trx_block_msg  = connection::frame( network::message( trx_block_message( b ), chan_id ) );
+              _ids[cb.id] = b.block_num;
+
+              while( _blocks.size() > RECENT_BLOCK_CACHE_SIZE )
+              {
+                 _ids.erase( _blocks.begin()->second.id );
+                 _blocks.erase( _blocks.begin() );
+              }
+          }
+
+          /** @return nullptr if the block is not cached */
+          const cached_block* find( const fc::sha224& block_id )const
+          {
+              auto itr = _ids.find( block_id );
+              if( itr == _ids.end() )
+              {
+                 return nullptr;
+              }
+              return &_blocks.find( itr->second )->second;
+          }
+
+        private:
+          std::map<uint32_t,cached_block>          _blocks;
+          std::unordered_map<fc::sha224,uint32_t>  _ids;
+     };
+
+     /**
+      *  A transaction that has been announced to us but not yet received.
+      */
+     struct trx_fetch_state
+     {
+        trx_fetch_state():attempts(0){}
+
+        /** the connections that announced the trx and have not failed to deliver it */
+        std::vector<connection_ptr>  announced_by;
+        /** null if the trx is not currently requested */
+        connection_ptr               requested_from;
+        fc::time_point               request_time;
+        uint32_t                     attempts;
+     };
+
+     /**
+      *  A transaction received from the network that has not yet been verified.
+      */
+     struct queued_trx
+     {
+        signed_transaction  trx;
+        uint160             id;
+        fc::time_point      received;
      };
 
      class channel_impl  : public bts::network::channel
      {
         public:
-          bts::peer::peer_channel_ptr                      _peers;
-          /* used to quickly filter out / prioritize trxs */
-          std::map<fc::time_point, uint160>                _trx_time_index;
+          channel_impl()
+          :_verify_thread("verify"){}
 
-          /** validated transactions that are sent out with get inv msgs */
-          std::unordered_map<uint160,signed_transaction>   _pending_trx;
+          bts::peer::peer_channel_ptr                      _peers;
+          /** validated transactions that are sent out with get inv msgs, highest fees first */
+          pending_pool                                     _pending_pool;
 
           // full blocks that are awaiting verification, these should not be forwarded
           std::unordered_map<fc::sha224,full_block>        _pending_full_blocks;
@@ -65,7 +203,10 @@ namespace bts { namespace blockchain {
           blockchain_db_ptr                                _db;
           channel_delegate*                                _del;
 
-          block_download_state                             _block_download;
+          recent_block_cache                               _block_cache;
+
+          /** compact blocks waiting for missing transactions, indexed by block id */
+          std::unordered_map<fc::sha224,block_download_state> _block_downloads;
       
           /**
            * When in the course of processing transactions we come across an invalid trx, store
@@ -74,10 +215,29 @@ namespace bts { namespace blockchain {
            */
           std::unordered_set<uint160>                      _recently_invalid_trx;
 
-          std::unordered_set<uint160>                      _trxs_pending_fetch;
+          /** announced trxs that are requested by fetch_trxs() */
+          std::unordered_map<uint160,trx_fetch_state>      _trxs_pending_fetch;
           std::unordered_set<fc::sha224>                   _blocks_pending_fetch;
 
-          std::vector<signed_transaction>                  _verify_queue;
+          /**
+           *  Received transactions are verified in batches by _verify_loop, signatures are
+           *  recovered on _verify_thread so that the channel thread remains responsive.
+           */
+          std::deque<queued_trx>                           _verify_queue;
+          fc::thread                                       _verify_thread;
+          fc::future<void>                                 _verify_loop;
+          verify_stats                                     _verify_stats;
+
+          /**
+           *  Headers first synchronization state.  Validated headers past our head are kept in
+           *  _sync_headers, bodies are downloaded in parallel into _sync_bodies and pushed onto
+           *  the db in order once all prior blocks are present.
+           */
+          std::map<uint32_t,sync_header>                   _sync_headers;
+          std::map<uint32_t,trx_block>                     _sync_bodies;
+          std::unordered_set<uint32_t>                     _sync_requested;
+
+          fc::future<void>                                 _fetch_loop;
 
           chan_data& get_channel_data( const connection_ptr& c )
           {
@@ -91,23 +251,732 @@ namespace bts { namespace blockchain {
               return cdat;
           }
           
-          void attempt_push_download_block()
+          /**
+           *  Pushes a block reconstructed from a compact block and relays it to 
+           *  every peer that does not yet know about it.
+           */
+          void attempt_push_download_block( block_download_state& dl )
           { try {
-              _db->push_block( trx_block( _block_download.full_blk, std::move( _block_download.trxs) ) );
+              fc::sha224 block_id = dl.full_blk.id();
+              trx_block  blk( dl.full_blk, std::move( dl.trxs ) );
+              _db->push_block( blk );
+              block_pushed( blk );
+              broadcast_block( dl.full_blk, block_id );
           } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 
+          /**
+           *  Sends the compact form of a block, the header plus the transaction ids, to all
+           *  connections that have not seen it.  The message is serialized once.
+           */
+          void broadcast_block( const full_block& blk, const fc::sha224& block_id )
+          { try {
+              auto cons = _peers->get_connections( _chan_id );
+              std::vector<connection_ptr> targets;
+              targets.reserve( cons.size() );
+              for( auto c = cons.begin(); c != cons.end(); ++c )
+              {
+                 if( get_channel_data( *c ).known_block_inv.insert( block_id ) )
+                 {
+                    targets.push_back( *c );
+                 }
+              }
+              network::broadcast( targets, network::message( full_block_message( blk ), _chan_id ) );
+          } FC_RETHROW_EXCEPTIONS( warn, "", ("block_id",block_id) ) }
+
+          /**
+           *  Updates the channel state after b has been added to the db.
+           */
+          void block_pushed( const trx_block& b )
+          {
+              _pending_pool.remove_included( b.trxs );
+              _block_cache.store( b, _chan_id );
+              _sync_headers.erase( b.block_num );
+              _sync_bodies.erase( b.block_num );
+              _recently_invalid_trx.clear();
+
+              if( _del ) 
+              {
+                 try {
+                    _del->handle_trx_block( b );
+                 } 
+                 catch ( const fc::exception& e )
+                 {
+                    wlog( "delegate threw exception... it shouldn't do that!\n ${e}", ("e", e.to_detail_string() ) );
+                 }
+              }
+          }
+
 
           virtual void handle_subscribe( const connection_ptr& c )
           {
               get_channel_data(c); // creates it... 
-          //    request_latest_blocks();
+              request_headers( c );
           }
 
           virtual void handle_unsubscribe( const connection_ptr& c )
           {
+              // blocks requested from c will be requested from someone else
+              chan_data& cdat = get_channel_data(c);
+              for( auto itr = cdat.requested_sync_blocks.begin(); itr != cdat.requested_sync_blocks.end(); ++itr )
+              {
+                 _sync_requested.erase( itr->first );
+              }
+              // trxs announced by c will be requested from someone else
+              for( auto itr = _trxs_pending_fetch.begin(); itr != _trxs_pending_fetch.end(); ++itr )
+              {
+                 auto& sources = itr->second.announced_by;
+                 sources.erase( std::remove( sources.begin(), sources.end(), c ), sources.end() );
+                 if( itr->second.requested_from == c )
+                 {
+                    itr->second.requested_from.reset();
+                 }
+              }
+              // compact blocks waiting on trxs from c will be requested from someone else
+              for( auto dl = _block_downloads.begin(); dl != _block_downloads.end(); ++dl )
+              {
+                 if( dl->second.source == c )
+                 {
+                    dl->second.start_time = fc::time_point();
+                 }
+                 auto& sources = dl->second.announced_by;
+                 sources.erase( std::remove( sources.begin(), sources.end(), c ), sources.end() );
+              }
               c->set_channel_data( _chan_id, nullptr );
           }
 
+          /**
+           *  The cost of reading data stored in block_num from the db, older data is less 
+           *  likely to be in the db cache and is therefore more expensive to serve.
+           */
+          uint32_t db_query_cost( uint32_t block_num )const
+          {
+              uint32_t age = _db->head_block_num() > block_num ? _db->head_block_num() - block_num : 0;
+              return QUERY_COST_DB + std::min<uint32_t>( age / QUERY_COST_AGE_BLOCKS, QUERY_COST_DB );
+          }
+
+          /**
+           *  Charges cost against the query budget of c.  If the budget is exhausted c is told
+           *  so with an error report and the query is aborted by throwing.
+           */
+          void charge_query( const connection_ptr& c, chan_data& cdat, uint32_t cost )
+          {
+              if( !cdat.consume_query_budget( cost ) )
+              {
+                 peer::error_report_msg report( peer::query_budget_exceeded, "blockchain query budget exceeded" );
+                 c->send( network::message( report, network::channel_id( network::peer_proto ) ) );
+                 FC_THROW_EXCEPTION( exception, "query budget exceeded", ("cost",cost)("budget",cdat.query_budget) );
+              }
+          }
+
+          /** the number of the next block to be pushed onto the db, 0 if the db is empty */
+          uint32_t next_block_num()const
+          {
+              return _db->head_block_num() + 1;
+          }
+
+          /**
+           *  @return the id of block_num on our best known chain, which may be a 
+           *  header that has not yet been pushed.
+           */
+          fc::sha224 block_id( uint32_t block_num )
+          {
+              auto itr = _sync_headers.find( block_num );
+              if( itr != _sync_headers.end() )
+              {
+                 return itr->second.id;
+              }
+              return _db->fetch_block( block_num ).id();
+          }
+
+          /**
+           *  Block ids starting with the tip of our best known chain and going back 
+           *  in powers of 2 to the genesis block.
+           */
+          std::vector<fc::sha224> get_locator()
+          {
+              std::vector<fc::sha224> locator;
+              uint32_t tip = _sync_headers.size() ? _sync_headers.rbegin()->first : next_block_num();
+              if( tip == 0 ) // nothing known yet
+              {
+                 return locator;
+              }
+              if( _sync_headers.empty() ) 
+              {
+                 --tip;
+              }
+
+              uint32_t step = 1;
+              int64_t  num  = tip;
+              while( num > 0 )
+              {
+                 locator.push_back( block_id( num ) );
+                 if( locator.size() > 10 ) 
+                 {
+                    step *= 2;
+                 }
+                 num -= step;
+              }
+              locator.push_back( block_id( 0 ) );
+              return locator;
+          }
+
+          /**
+           *  @return the number of the most recent block in locator that is on our chain
+           *          or -1 if none of them are.
+           */
+          int64_t find_fork_point( const std::vector<fc::sha224>& locator )
+          {
+              for( auto itr = locator.begin(); itr != locator.end(); ++itr )
+              {
+                 try {
+                    return _db->fetch_block_num( *itr );
+                 } 
+                 catch ( const fc::key_not_found_exception& )
+                 {
+                 }
+              }
+              return -1;
+          }
+
+          /**
+           *  @return true if the chain described by locator branches off ours below our head,
+           *          following it would require popping blocks which blockchain_db does not 
+           *          support.
+           */
+          bool forks_below_head( const std::vector<fc::sha224>& locator, int64_t fork_point )
+          {
+              int64_t head = int64_t( next_block_num() ) - 1;
+              if( locator.empty() || head < 0 || fork_point >= head )
+              {
+                 return false;
+              }
+              return fork_point < 0 || _db->fetch_block( uint32_t(fork_point) ).id() != locator.front();
+          }
+
+          void request_headers( const connection_ptr& c )
+          { try {
+              chan_data& cdat = get_channel_data(c);
+              if( cdat.requested_headers && 
+                  *cdat.requested_headers > fc::time_point::now() - fc::seconds( BLOCK_DOWNLOAD_TIMEOUT_SEC ) ) 
+              {
+                 return;
+              }
+              get_headers_message request;
+              request.locator = get_locator();
+              cdat.requested_headers = fc::time_point::now();
+              c->send( network::message( request, _chan_id ) );
+          } FC_RETHROW_EXCEPTIONS( warn, "error requesting headers from ${ep}", ("ep",c->remote_endpoint()) ) }
+
+          /**
+           *  Checks that the header links to prev, the proof of work is checked by 
+           *  validate_header_pow() so that a whole message of headers can be evaluated
+           *  as one batch.  Transactions and state are validated when the block is pushed.
+           */
+          void validate_header( const block_proof& h, const fc::sha224& prev_id, uint32_t block_num )
+          { try {
+              FC_ASSERT( h.version   == 0 );
+              FC_ASSERT( h.prev      == prev_id );
+              FC_ASSERT( h.block_num == block_num );
+              FC_ASSERT( h.pow.branch_path.mid_states.size() > 0 );
+              FC_ASSERT( h.pow.branch_path.mid_states[0] == h.digest() );
+          } FC_RETHROW_EXCEPTIONS( warn, "invalid header", ("header",h) ) }
+
+          /** headers are held to the same target that push_block enforces on their blocks */
+          void validate_header_pow( const block_proof& h, const pow_hash& pow )
+          { try {
+              const pow_hash& target = _db->get_pow_target();
+              FC_ASSERT( !(target < pow), "insufficient proof of work", ("pow",pow)("target",target) );
+          } FC_RETHROW_EXCEPTIONS( warn, "invalid header", ("header",h) ) }
+
+          /** forget all sync progress, headers will be requested again */
+          void reset_sync()
+          {
+              _sync_headers.clear();
+              _sync_bodies.clear();
+              _sync_requested.clear();
+              auto cons = _peers->get_connections( _chan_id );
+              for( auto c = cons.begin(); c != cons.end(); ++c )
+              {
+                 chan_data& cdat = get_channel_data( *c );
+                 cdat.requested_sync_blocks.clear();
+                 cdat.known_head_num.reset();
+              }
+          }
+
+          /**
+           *  Requests the bodies of the validated headers that follow our head, up to 
+           *  BLOCK_DOWNLOAD_WINDOW blocks ahead, spreading the requests across all 
+           *  connections that reported having them.
+           */
+          void schedule_block_downloads()
+          { try {
+              if( _sync_headers.empty() ) 
+              {
+                 return;
+              }
+
+              auto cons = _peers->get_connections( _chan_id );
+              auto now  = fc::time_point::now();
+              auto expired = now - fc::seconds( BLOCK_DOWNLOAD_TIMEOUT_SEC );
+
+              std::vector<chan_data*> con_data( cons.size() );
+              for( uint32_t i = 0; i < cons.size(); ++i )
+              {
+                 con_data[i] = &get_channel_data( cons[i] );
+                 auto& requested = con_data[i]->requested_sync_blocks;
+                 for( auto itr = requested.begin(); itr != requested.end(); )
+                 {
+                    if( itr->second < expired )
+                    {
+                       wlog( "block ${n} request to ${ep} timed out", ("n",itr->first)("ep",cons[i]->remote_endpoint()) );
+                       _sync_requested.erase( itr->first );
+
+                       // the connection evidently cannot serve this block, do not ask it again
+                       auto& known = con_data[i]->known_head_num;
+                       if( known && *known >= itr->first )
+                       {
+                          known = itr->first - 1;
+                       }
+                       ++con_data[i]->sync_timeouts;
+                       itr = requested.erase(itr);
+                    }
+                    else
+                    {
+                       ++itr;
+                    }
+                 }
+              }
+
+              for( uint32_t i = 0; i < cons.size(); ++i )
+              {
+                 if( con_data[i]->sync_timeouts >= BLOCK_DOWNLOAD_MAX_TIMEOUTS )
+                 {
+                    wlog( "disconnecting ${ep} after ${n} block requests timed out", 
+                          ("ep",cons[i]->remote_endpoint())("n",con_data[i]->sync_timeouts) );
+                    for( auto itr = con_data[i]->requested_sync_blocks.begin(); itr != con_data[i]->requested_sync_blocks.end(); ++itr )
+                    {
+                       _sync_requested.erase( itr->first );
+                    }
+                    con_data[i]->requested_sync_blocks.clear();
+                    con_data[i]->known_head_num.reset();
+                    cons[i]->close();
+                 }
+              }
+
+              // if no connection can provide the next block the headers cannot be trusted, 
+              // start over with headers from the connections we still have
+              uint32_t next = next_block_num();
+              if( _sync_headers.find( next ) != _sync_headers.end() &&
+                  _sync_bodies.find( next ) == _sync_bodies.end() &&
+                  _sync_requested.find( next ) == _sync_requested.end() )
+              {
+                 bool available = false;
+                 for( uint32_t i = 0; i < cons.size() && !available; ++i )
+                 {
+                    available = con_data[i]->known_head_num && *con_data[i]->known_head_num >= next &&
+                                con_data[i]->sync_timeouts < BLOCK_DOWNLOAD_MAX_TIMEOUTS;
+                 }
+                 if( !available )
+                 {
+                    wlog( "no connection can provide block ${n}, restarting sync", ("n",next) );
+                    reset_sync();
+                    for( uint32_t i = 0; i < cons.size(); ++i )
+                    {
+                       if( con_data[i]->sync_timeouts < BLOCK_DOWNLOAD_MAX_TIMEOUTS )
+                       {
+                          request_headers( cons[i] );
+                       }
+                    }
+                    return;
+                 }
+              }
+
+              uint32_t first = next_block_num();
+              uint32_t last  = first + BLOCK_DOWNLOAD_WINDOW;
+              for( auto itr = _sync_headers.lower_bound( first ); itr != _sync_headers.end() && itr->first < last; ++itr )
+              {
+                 uint32_t num = itr->first;
+                 if( _sync_bodies.find(num) != _sync_bodies.end() || 
+                     _sync_requested.find(num) != _sync_requested.end() )
+                 {
+                    continue;
+                 }
+
+                 int32_t best = -1;
+                 for( uint32_t i = 0; i < cons.size(); ++i )
+                 {
+                    size_t load = con_data[i]->requested_sync_blocks.size();
+                    if( con_data[i]->known_head_num && *con_data[i]->known_head_num >= num && 
+                        load < BLOCK_DOWNLOAD_MAX_IN_FLIGHT )
+                    {
+                       if( best == -1 || load < con_data[best]->requested_sync_blocks.size() )
+                       {
+                          best = i;
+                       }
+                    }
+                 }
+                 if( best == -1 ) 
+                 {
+                    continue;
+                 }
+
+                 con_data[best]->requested_sync_blocks[num] = now;
+                 _sync_requested.insert(num);
+                 cons[best]->send( network::message( get_trx_block_message( itr->second.id ), _chan_id ) );
+              }
+          } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+          /**
+           *  Pushes downloaded blocks onto the db for as long as the next block is present. 
+           */
+          void push_downloaded_blocks()
+          {
+              for( auto itr = _sync_bodies.begin(); itr != _sync_bodies.end() && itr->first == next_block_num(); )
+              {
+                 trx_block blk = std::move( itr->second );
+                 _sync_bodies.erase( itr );
+                 try {
+                    _db->push_block( blk );
+                 } 
+                 catch ( const fc::exception& e )
+                 {
+                    // the headers were valid but the block is not, nothing built on it can be valid
+                    elog( "unable to push downloaded block ${n}\n${e}", ("n",blk.block_num)("e",e.to_detail_string()) );
+                    reset_sync();
+                    return;
+                 }
+                 block_pushed( blk );
+                 itr = _sync_bodies.begin();
+              }
+          }
+
+          /**
+           *  Drops compact blocks whose missing transactions were not delivered in time and
+           *  requests the whole block from another connection that announced it.
+           */
+          void expire_block_downloads()
+          { try {
+              auto expired = fc::time_point::now() - fc::seconds( BLOCK_DOWNLOAD_TIMEOUT_SEC );
+              for( auto dl = _block_downloads.begin(); dl != _block_downloads.end(); )
+              {
+                 if( dl->second.start_time >= expired )
+                 {
+                    ++dl;
+                    continue;
+                 }
+                 fc::sha224     block_id = dl->first;
+                 connection_ptr source   = dl->second.source;
+                 std::vector<connection_ptr> sources = std::move( dl->second.announced_by );
+                 wlog( "block ${id} timed out waiting for ${n} trxs from ${ep}", 
+                       ("id",block_id)("n",dl->second.missing_trx_idx.size())("ep",source->remote_endpoint()) );
+
+                 auto cd = source->get_channel_data( _chan_id ); // null if source unsubscribed
+                 if( cd )
+                 {
+                    auto& requested = cd->as<chan_data>().requested_trxs;
+                    for( auto itr = dl->second.missing_trx_idx.begin(); itr != dl->second.missing_trx_idx.end(); ++itr )
+                    {
+                       requested.erase( itr->first );
+                    }
+                 }
+                 dl = _block_downloads.erase( dl );
+
+                 request_trx_block( block_id, sources, source );
+              }
+          } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+          /**
+           *  Requests block_id with all of its transactions from one of sources other than 
+           *  exclude that is still connected and has no other block request outstanding.
+           */
+          void request_trx_block( const fc::sha224& block_id, const std::vector<connection_ptr>& sources, 
+                                  const connection_ptr& exclude )
+          {
+              auto now     = fc::time_point::now();
+              auto expired = now - fc::seconds( BLOCK_DOWNLOAD_TIMEOUT_SEC );
+              for( auto c = sources.begin(); c != sources.end(); ++c )
+              {
+                 auto cd = (*c)->get_channel_data( _chan_id ); // null once c unsubscribed
+                 if( *c == exclude || !cd ) 
+                 {
+                    continue;
+                 }
+                 chan_data& cdat = cd->as<chan_data>();
+                 if( cdat.requested_trx_block != fc::sha224() && cdat.requested_trx_block_time >= expired )
+                 {
+                    continue;
+                 }
+                 cdat.requested_trx_block      = block_id;
+                 cdat.requested_trx_block_time = now;
+                 (*c)->send( network::message( get_trx_block_message( block_id ), _chan_id ) );
+                 return;
+              }
+              wlog( "no other connection has announced block ${id}", ("id",block_id) );
+          }
+
+          /**
+           *  Requests the announced trxs that are not yet requested, or whose request timed 
+           *  out, from the least loaded connection that announced them.  Requests for the 
+           *  same connection are combined into messages of up to FETCH_BATCH_SIZE trxs and
+           *  the replies are verified by handle_trxs().
+           */
+          void fetch_trxs()
+          { try {
+              auto now     = fc::time_point::now();
+              auto expired = now - fc::seconds( FETCH_REQUEST_TIMEOUT_SEC );
+              std::unordered_map<connection_ptr,std::vector<uint160> > requests;
+
+              for( auto itr = _trxs_pending_fetch.begin(); itr != _trxs_pending_fetch.end(); )
+              {
+                 const uint160&   trx_id = itr->first;
+                 trx_fetch_state& state  = itr->second;
+                 if( _pending_pool.contains( trx_id ) || 
+                     _recently_invalid_trx.find( trx_id ) != _recently_invalid_trx.end() )
+                 {
+                    itr = _trxs_pending_fetch.erase( itr );
+                    continue;
+                 }
+                 if( state.requested_from )
+                 {
+                    if( state.request_time >= expired )
+                    {
+                       ++itr;
+                       continue;
+                    }
+                    // the connection did not deliver, ask another one that announced the trx
+                    auto cd = state.requested_from->get_channel_data( _chan_id );
+                    if( cd )
+                    {
+                       cd->as<chan_data>().requested_trxs.erase( trx_id );
+                    }
+                    auto& sources = state.announced_by;
+                    sources.erase( std::remove( sources.begin(), sources.end(), state.requested_from ), sources.end() );
+                    state.requested_from.reset();
+                 }
+                 if( state.announced_by.empty() || state.attempts >= FETCH_MAX_ATTEMPTS )
+                 {
+                    itr = _trxs_pending_fetch.erase( itr );
+                    continue;
+                 }
+
+                 chan_data* best      = nullptr;
+                 connection_ptr source;
+                 for( auto c = state.announced_by.begin(); c != state.announced_by.end(); ++c )
+                 {
+                    chan_data& cdat = get_channel_data( *c );
+                    if( cdat.requested_trxs.size() < FETCH_MAX_IN_FLIGHT && 
+                        ( !best || cdat.requested_trxs.size() < best->requested_trxs.size() ) )
+                    {
+                       best   = &cdat;
+                       source = *c;
+                    }
+                 }
+                 if( !best )
+                 {
+                    ++itr; // every source is busy, try again later
+                    continue;
+                 }
+                 best->requested_trxs.insert( trx_id );
+                 state.requested_from = source;
+                 state.request_time   = now;
+                 ++state.attempts;
+                 requests[source].push_back( trx_id );
+                 ++itr;
+              }
+
+              for( auto r = requests.begin(); r != requests.end(); ++r )
+              {
+                 for( size_t pos = 0; pos < r->second.size(); pos += FETCH_BATCH_SIZE )
+                 {
+                    get_trxs_message request;
+                    auto first = r->second.begin() + pos;
+                    request.items.assign( first, first + std::min<size_t>( FETCH_BATCH_SIZE, r->second.size() - pos ) );
+                    r->first->send( network::message( request, _chan_id ) );
+                 }
+              }
+          } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+          void fetch_loop()
+          {
+             try {
+                while( !_fetch_loop.canceled() )
+                {
+                   schedule_block_downloads();
+                   expire_block_downloads();
+                   fetch_trxs();
+                   _pending_pool.remove_expired( fc::time_point::now() - fc::seconds( PENDING_TRX_MAX_AGE_SEC ) );
+                   fc::usleep( fc::microseconds( 20*1000 ) );
+                }
+             }
+             catch ( const fc::exception& e )
+             {
+                elog( "fetch loop threw... something bad happened\n${e}", ("e", e.to_detail_string()) );
+             }
+          }
+
+          /**
+           *  Adds trx to the verify queue unless it is already known or the queue is full.
+           */
+          void queue_verify( const signed_transaction& trx, const uint160& trx_id )
+          {
+              if( _recently_invalid_trx.find( trx_id ) != _recently_invalid_trx.end() ||
+                  _pending_pool.contains( trx_id ) )
+              {
+                 return;
+              }
+              if( _verify_queue.size() >= TRX_VERIFY_QUEUE_LIMIT )
+              {
+                 // the sender will announce it again, dropping is cheaper than falling further behind
+                 ++_verify_stats.dropped;
+                 wlog( "verify queue full, dropping trx ${id}", ("id",trx_id) );
+                 return;
+              }
+              queued_trx q;
+              q.trx      = trx;
+              q.id       = trx_id;
+              q.received = fc::time_point::now();
+              _verify_queue.push_back( std::move(q) );
+          }
+
+          /**
+           *  Verifies up to TRX_VERIFY_BATCH_SIZE queued transactions.  All transactions in the
+           *  batch are evaluated without yielding so they see the same chain state.
+           */
+          void verify_batch()
+          { try {
+              auto batch = std::make_shared<std::vector<queued_trx> >();
+              std::unordered_set<uint160> batch_ids;
+              while( batch->size() < TRX_VERIFY_BATCH_SIZE && _verify_queue.size() )
+              {
+                 queued_trx q = std::move( _verify_queue.front() );
+                 _verify_queue.pop_front();
+                 if( _recently_invalid_trx.find( q.id ) != _recently_invalid_trx.end() ||
+                     _pending_pool.contains( q.id ) ||
+                     !batch_ids.insert( q.id ).second )
+                 {
+                    continue;
+                 }
+                 batch->push_back( std::move(q) );
+              }
+              if( batch->empty() ) 
+              {
+                 return;
+              }
+
+              // signature recovery is the most expensive part of validation and does not depend 
+              // upon chain state, batch is captured by value in case this fiber is canceled.
+              typedef std::vector< fc::optional< std::unordered_set<address> > > signed_address_list;
+              signed_address_list signers = _verify_thread.async( [batch]() -> signed_address_list 
+              {
+                 signed_address_list result( batch->size() );
+                 for( uint32_t i = 0; i < batch->size(); ++i )
+                 {
+                    try {
+                       result[i] = (*batch)[i].trx.get_signed_addresses();
+                    } 
+                    catch ( const fc::exception& e )
+                    {
+                       wlog( "unable to recover signatures\n${e}", ("e", e.to_detail_string()) );
+                    }
+                 }
+                 return result;
+              } ).wait();
+
+              std::vector<uint160> accepted;
+              auto now = fc::time_point::now();
+              for( uint32_t i = 0; i < batch->size(); ++i )
+              {
+                 const queued_trx& q = (*batch)[i];
+                 try {
+                    FC_ASSERT( !!signers[i], "invalid signature" );
+                    trx_eval eval = _db->evaluate_signed_transaction( q.trx, *signers[i] );
+                    if( _pending_pool.store( q.trx, eval ) )
+                    {
+                       accepted.push_back( q.id );
+                       ++_verify_stats.accepted;
+                    }
+                    else
+                    {
+                       // valid, but a conflicting or higher paying trx took its place
+                       ++_verify_stats.dropped;
+                    }
+                 } 
+                 catch ( const fc::exception& e )
+                 {
+                    wlog( "rejecting trx ${id}\n${e}", ("id",q.id)("e", e.to_detail_string()) );
+                    _recently_invalid_trx.insert( q.id );
+                    ++_verify_stats.rejected;
+                 }
+
+                 uint64_t latency = (now - q.received).count();
+                 _verify_stats.avg_latency_us = (_verify_stats.avg_latency_us * 15 + latency) / 16;
+                 _verify_stats.max_latency_us = std::max( _verify_stats.max_latency_us, latency );
+              }
+
+              for( auto itr = accepted.begin(); _del && itr != accepted.end(); ++itr )
+              {
+                 try {
+                    _del->handle_trx( _pending_pool.fetch( *itr ) );
+                 } 
+                 catch ( const fc::exception& e )
+                 {
+                    wlog( "delegate threw exception... it shouldn't do that!\n ${e}", ("e", e.to_detail_string() ) );
+                 }
+              }
+              announce_trxs( accepted );
+          } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+          /**
+           *  Sends one inventory message to each connection listing the trx_ids it does not know.
+           */
+          void announce_trxs( const std::vector<uint160>& trx_ids )
+          { try {
+              if( trx_ids.empty() ) 
+              {
+                 return;
+              }
+              auto cons = _peers->get_connections( _chan_id );
+              for( auto c = cons.begin(); c != cons.end(); ++c )
+              {
+                 chan_data& cdat = get_channel_data( *c );
+                 trx_inv_message inv;
+                 for( auto itr = trx_ids.begin(); itr != trx_ids.end(); ++itr )
+                 {
+                    if( cdat.known_trx_inv.insert( *itr ) )
+                    {
+                       inv.items.push_back( *itr );
+                    }
+                 }
+                 if( inv.items.size() )
+                 {
+                    (*c)->send( network::message( inv, _chan_id ) );
+                 }
+              }
+          } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+          void verify_loop()
+          {
+             while( !_verify_loop.canceled() )
+             {
+                try {
+                   if( _verify_queue.empty() )
+                   {
+                      fc::usleep( fc::microseconds( 20*1000 ) );
+                      continue;
+                   }
+                   verify_batch();
+                }
+                catch ( const fc::canceled_exception& )
+                {
+                   throw;
+                }
+                catch ( const fc::exception& e )
+                {
+                   elog( "error verifying transactions\n${e}", ("e", e.to_detail_string()) );
+                }
+             }
+          }
+
           virtual void handle_message( const connection_ptr& c, const bts::network::message& m )
           { 
             try { 
@@ -156,6 +1025,14 @@ namespace bts { namespace blockchain {
                       handle_trx_block( c, cdat, m.as<trx_block_message>() );
                       break;
 
+                  case get_headers_msg:
+                      handle_get_headers( c, cdat, m.as<get_headers_message>() );
+                      break;
+
+                  case headers_msg:
+                      handle_headers( c, cdat, m.as<headers_message>() );
+                      break;
+
                   default:
                      // TODO: figure out how to document this / punish the connection that sent us this 
                      // message.
@@ -176,13 +1053,31 @@ namespace bts { namespace blockchain {
           { try {
               for( auto itr = msg.items.begin(); itr != msg.items.end(); ++itr )
               {
-                 if( !cdat.known_trx_inv.insert( *itr ).second )
+                 if( !cdat.known_trx_inv.insert( *itr ) )
                  {
                     wlog( "received inventory item more than once from the same connection\n",
                               ("item", *itr) );
                     // TODO: why is this connection sending things multiple times... punish it
                  }
-                 _trxs_pending_fetch.insert( *itr );
+                 if( _pending_pool.contains( *itr ) || 
+                     _recently_invalid_trx.find( *itr ) != _recently_invalid_trx.end() )
+                 {
+                    continue;
+                 }
+                 auto fetch = _trxs_pending_fetch.find( *itr );
+                 if( fetch == _trxs_pending_fetch.end() )
+                 {
+                    if( _trxs_pending_fetch.size() >= TRX_VERIFY_QUEUE_LIMIT )
+                    {
+                       continue; // we could not verify it in time anyway, it will be announced again
+                    }
+                    fetch = _trxs_pending_fetch.insert( std::make_pair( *itr, trx_fetch_state() ) ).first;
+                 }
+                 auto& sources = fetch->second.announced_by;
+                 if( std::find( sources.begin(), sources.end(), c ) == sources.end() )
+                 {
+                    sources.push_back( c );
+                 }
               }
           } FC_RETHROW_EXCEPTIONS( warn, "", ("msg",msg) ) } // provide stack trace for errors
 
@@ -192,14 +1087,8 @@ namespace bts { namespace blockchain {
           void handle_get_trx_inv( const connection_ptr& c, chan_data& cdat, get_trx_inv_message msg )
           { try {
              // TODO: only allow this request once every couple of minutes to prevent flood attacks
-             
-             // TODO: make sure these inventory items are sorted by fees
              trx_inv_message reply;
-             reply.items.reserve( TRX_INV_QUERY_LIMIT ); 
-             for( auto itr = _pending_trx.begin(); reply.items.size() < TRX_INV_QUERY_LIMIT && itr != _pending_trx.end(); ++itr )
-             {
-                reply.items.push_back( itr->first );
-             }
+             reply.items = _pending_pool.get_inventory( TRX_INV_QUERY_LIMIT );
              c->send( network::message( reply, _chan_id ) );
           } FC_RETHROW_EXCEPTIONS( warn, "", ("msg",msg) ) } // provide stack trace for errors
 
@@ -208,15 +1097,24 @@ namespace bts { namespace blockchain {
            */
           void handle_block_inv( const connection_ptr& c, chan_data& cdat, block_inv_message msg )
           { try {
+              bool unknown_block = false;
               for( auto itr = msg.items.begin(); itr != msg.items.end(); ++itr )
               {
-                 if( !cdat.known_block_inv.insert( *itr ).second )
+                 if( !cdat.known_block_inv.insert( *itr ) )
                  {
                     wlog( "received inventory item more than once from the same connection\n",
                               ("item", *itr) );
                     // TODO: why is this connection sending things multiple times... punish it
                  }
-                 _blocks_pending_fetch.insert( *itr );
+                 if( find_fork_point( std::vector<fc::sha224>(1,*itr) ) == -1 )
+                 {
+                    unknown_block = true;
+                 }
+              }
+              // new blocks are fetched headers first, the headers tell us which bodies to fetch
+              if( unknown_block )
+              {
+                 request_headers( c );
               }
           } FC_RETHROW_EXCEPTIONS( warn, "", ("msg",msg) ) } // provide stack trace for errors
 
@@ -225,31 +1123,198 @@ namespace bts { namespace blockchain {
            */
           void handle_get_block_inv( const connection_ptr& c, chan_data& cdat, get_block_inv_message msg )
           { try {
+              charge_query( c, cdat, msg.known.size() * QUERY_COST_HEADER );
+              block_inv_message reply;
+              uint32_t end   = next_block_num();
+              uint32_t start = find_fork_point( msg.known ) + 1;
+              uint32_t count = std::min<uint32_t>( end - start, BLOCK_INV_QUERY_LIMIT );
+              charge_query( c, cdat, count * QUERY_COST_HEADER );
+              reply.items.reserve( count );
+              for( uint32_t num = start; num < end && reply.items.size() < BLOCK_INV_QUERY_LIMIT; ++num )
+              {
+                 reply.items.push_back( _db->fetch_block( num ).id() );
+              }
+              c->send( network::message( reply, _chan_id ) );
+          } FC_RETHROW_EXCEPTIONS( warn, "", ("msg",msg) ) } // provide stack trace for errors
+
+          /**
+           *  Replies with the headers following the fork point described by the locator.
+           */
+          void handle_get_headers( const connection_ptr& c, chan_data& cdat, get_headers_message msg )
+          { try {
+              charge_query( c, cdat, msg.locator.size() * QUERY_COST_HEADER );
+              int64_t fork_point = find_fork_point( msg.locator );
+              if( forks_below_head( msg.locator, fork_point ) )
+              {
+                 wlog( "${ep} is on a fork that branches off below our head at block ${n}, disconnecting", 
+                       ("ep",c->remote_endpoint())("n",fork_point) );
+                 c->close();
+                 return;
+              }
+              headers_message reply;
+              uint32_t end   = next_block_num();
+              uint32_t start = fork_point + 1;
+              uint32_t count = std::min<uint32_t>( end - start, BLOCKCHAIN_HEADERS_PER_MSG );
+              charge_query( c, cdat, count * QUERY_COST_HEADER );
+              reply.headers.reserve( count );
+              for( uint32_t num = start; num < end && reply.headers.size() < BLOCKCHAIN_HEADERS_PER_MSG; ++num )
+              {
+                 reply.headers.push_back( _db->fetch_block( num ) );
+              }
+              c->send( network::message( reply, _chan_id ) );
+          } FC_RETHROW_EXCEPTIONS( warn, "", ("msg",msg) ) } // provide stack trace for errors
+
+          /**
+           *  Validates the headers and appends them to the chain of headers to 
+           *  download, requesting more if the reply was full.
+           */
+          void handle_headers( const connection_ptr& c, chan_data& cdat, headers_message msg )
+          { try {
+              FC_ASSERT( !!cdat.requested_headers, "unsolicited headers" );
+              FC_ASSERT( msg.headers.size() <= BLOCKCHAIN_HEADERS_PER_MSG );
+              cdat.requested_headers.reset();
+
+              // link the headers first, then evaluate all of their proofs of work at once
+              uint32_t                 num     = _sync_headers.size() ? _sync_headers.rbegin()->first + 1 : next_block_num();
+              fc::sha224               prev_id = _sync_headers.size() ? _sync_headers.rbegin()->second.id : _db->head_block_id();
+              std::vector<sync_header> linked;
+              std::vector<block_proof> unverified;
+              bool                     links   = true;
+              for( auto itr = msg.headers.begin(); itr != msg.headers.end(); ++itr )
+              {
+                 fc::sha224 id = itr->id();
+
+                 // skip headers we already have
+                 auto known = _sync_headers.find( itr->block_num );
+                 if( known != _sync_headers.end() && known->second.id == id )
+                 {
+                    continue;
+                 }
+                 if( itr->block_num < next_block_num() && _db->fetch_block( itr->block_num ).id() == id )
+                 {
+                    continue;
+                 }
+
+                 if( itr->block_num < next_block_num() )
+                 {
+                    // switching to a fork below our head would require popping blocks
+                    wlog( "header ${n} from ${ep} is on a fork that branches off below our head, disconnecting", 
+                          ("n",itr->block_num)("ep",c->remote_endpoint()) );
+                    c->close();
+                    return;
+                 }
+                 if( itr->prev != prev_id )
+                 {
+                    wlog( "header ${n} from ${ep} does not link to our headers", 
+                          ("n",itr->block_num)("ep",c->remote_endpoint()) );
+                    links = false;
+                    break;
+                 }
+                 validate_header( *itr, prev_id, num );
 
+                 sync_header sh;
+                 sh.header = *itr;
+                 sh.id     = id;
+                 linked.push_back( sh );
+                 unverified.push_back( *itr );
+                 prev_id = id;
+                 ++num;
+              }
+
+              // headers that arrive again from other peers are not evaluated twice
+              std::vector<pow_hash> pows = _db->get_pow_cache().evaluate( unverified );
+
+              // evaluating yields, the headers or head may have changed in the mean time 
+              // and the batch must still extend our current tip
+              if( linked.size() )
+              {
+                 uint32_t   tip_num = _sync_headers.size() ? _sync_headers.rbegin()->first + 1 : next_block_num();
+                 fc::sha224 tip_id  = _sync_headers.size() ? _sync_headers.rbegin()->second.id : _db->head_block_id();
+                 if( linked.front().header.prev != tip_id || linked.front().header.block_num != tip_num )
+                 {
+                    wlog( "chain changed while evaluating headers from ${ep}, requesting them again", 
+                          ("ep",c->remote_endpoint()) );
+                    request_headers( c );
+                    return;
+                 }
+              }
+              for( size_t i = 0; i < linked.size(); ++i )
+              {
+                 validate_header_pow( linked[i].header, pows[i] );
+                 _sync_headers[linked[i].header.block_num] = linked[i];
+              }
+              if( !links )
+              {
+                 return;
+              }
+
+              if( msg.headers.size() )
+              {
+                 uint32_t last_num = msg.headers.back().block_num;
+                 if( !cdat.known_head_num || *cdat.known_head_num < last_num )
+                 {
+                    cdat.known_head_num = last_num;
+                 }
+              }
+
+              if( msg.headers.size() == BLOCKCHAIN_HEADERS_PER_MSG )
+              {
+                 request_headers( c );
+              }
           } FC_RETHROW_EXCEPTIONS( warn, "", ("msg",msg) ) } // provide stack trace for errors
 
           void handle_get_trxs( const connection_ptr& c, chan_data& cdat, get_trxs_message msg )
           { try {
-              trxs_message reply;
               FC_ASSERT( msg.items.size() < TRX_INV_QUERY_LIMIT );
-              reply.trxs.reserve( msg.items.size() );
+
+              // the reply is assembled from already packed trxs, the serialized form of a 
+              // trxs_message is the number of trxs followed by each packed trx.
+              std::vector<char> packed_trxs;
+              uint32_t          trx_count = 0;
               
+              // once the budget is exhausted the rest of the request is dropped, the
+              // connection may request it again later
               for( auto itr = msg.items.begin(); itr != msg.items.end(); ++itr )
               {
-                  auto pending_itr = _pending_trx.find( *itr );
-                  if( pending_itr == _pending_trx.end() )
+                  if( !_pending_pool.contains( *itr ) )
                   {
-                     // TODO DB queries are far more expensive, and therefore must be rationed and potentialy
-                     // require a proof of work paying us to fetch them
+                     if( !cdat.consume_query_budget( QUERY_COST_DB ) ) 
+                     {
+                        break;
+                     }
                      auto tx_num = _db->fetch_trx_num( *itr );
-                     reply.trxs.push_back( _db->fetch_trx(tx_num) );
+                     cdat.query_budget -= db_query_cost( tx_num.block_num ) - QUERY_COST_DB;
+                     auto packed = fc::raw::pack( signed_transaction( _db->fetch_trx(tx_num) ) );
+                     packed_trxs.insert( packed_trxs.end(), packed.begin(), packed.end() );
+                     ++trx_count;
                   }
                   else
                   {
-                     reply.trxs.push_back( pending_itr->second );
+                     if( !cdat.consume_query_budget( QUERY_COST_POOL ) ) 
+                     {
+                        break;
+                     }
+                     const std::vector<char>& packed = _pending_pool.fetch_packed( *itr );
+                     packed_trxs.insert( packed_trxs.end(), packed.begin(), packed.end() );
+                     ++trx_count;
                   }
               }
-              c->send( network::message( reply, _chan_id ) );
+              if( trx_count < msg.items.size() )
+              {
+                 wlog( "${ep} exceeded its query budget, sending ${n} of ${m} trxs", 
+                       ("ep",c->remote_endpoint())("n",trx_count)("m",msg.items.size()) );
+                 peer::error_report_msg report( peer::query_budget_exceeded, "blockchain query budget exceeded" );
+                 c->send( network::message( report, network::channel_id( network::peer_proto ) ) );
+              }
+
+              network::message reply;
+              reply.proto    = _chan_id.proto;
+              reply.chan_num = _chan_id.chan;
+              reply.msg_type = trxs_message::type;
+              reply.data     = fc::raw::pack( fc::unsigned_int( trx_count ) );
+              reply.data.insert( reply.data.end(), packed_trxs.begin(), packed_trxs.end() );
+              reply.size     = reply.data.size();
+              c->send( reply );
           } FC_RETHROW_EXCEPTIONS( warn, "", ("msg",msg) ) } // provide stack trace for errors
 
           /**
@@ -257,11 +1322,17 @@ namespace bts { namespace blockchain {
            */
           void handle_get_full_block( const connection_ptr& c, chan_data& cdat, get_full_block_message msg )
           { try {
-              // TODO: throttle attempts to query blocks by a single connection
-              // this request must hit the DB... cost in proof of work is proportional to age to prevent
-              // cache thrashing attacks and allowing us to keep newer blocks in the cache 
-              // penalize connections that request too many full blocks...
+              auto cached = _block_cache.find( msg.block_id );
+              if( cached )
+              {
+                 charge_query( c, cdat, QUERY_COST_CACHE );
+                 c->send_framed( cached->full_block_msg );
+                 return;
+              }
+              // cost is proportional to age to prevent cache thrashing attacks 
+              charge_query( c, cdat, QUERY_COST_DB );
               uint32_t blk_num = _db->fetch_block_num( msg.block_id );
+              charge_query( c, cdat, db_query_cost( blk_num ) - QUERY_COST_DB ); // the age surcharge
               full_block blk   = _db->fetch_full_block( blk_num );
               c->send( network::message(full_block_message( blk ), _chan_id ) );
 
@@ -272,9 +1343,23 @@ namespace bts { namespace blockchain {
            */
           void handle_get_trx_block( const connection_ptr& c, chan_data& cdat, get_trx_block_message msg )
           { try {
-              // TODO: throttle attempts to query blocks by a single connection
+              auto cached = _block_cache.find( msg.block_id );
+              if( cached )
+              {
+                 charge_query( c, cdat, QUERY_COST_CACHE );
+                 c->send_framed( cached->trx_block_msg );
+                 return;
+              }
+              charge_query( c, cdat, QUERY_COST_DB );
               uint32_t blk_num = _db->fetch_block_num( msg.block_id );
+              // every trx in the block is a separate db read, the first is charged before anything 
+              // is read and the rest once their number is known
+              charge_query( c, cdat, db_query_cost( blk_num ) );
               trx_block blk    = _db->fetch_trx_block( blk_num );
+              if( blk.trxs.size() > 1 )
+              {
+                 cdat.query_budget -= int64_t( db_query_cost( blk_num ) ) * ( blk.trxs.size() - 1 );
+              }
               c->send( network::message(trx_block_message( blk ), _chan_id ) );
           } FC_RETHROW_EXCEPTIONS( warn, "", ("msg",msg) ) } // provide stack trace for errors
 
@@ -291,21 +1376,36 @@ namespace bts { namespace blockchain {
                     FC_THROW_EXCEPTION( exception, "unsolicited transaction ${trx_id}", 
                                                     ("trx_id", item_id)("trx", *itr) );
                  }
-                 _verify_queue.push_back( *itr ); 
+                 cdat.requested_trxs.erase( item_id );
+                 _trxs_pending_fetch.erase( item_id );
+                 queue_verify( *itr, item_id );
 
                  // is this trx part of a block download
-                 auto trx_idx_itr =  _block_download.missing_trx_idx.find( item_id );
-                 if( trx_idx_itr != _block_download.missing_trx_idx.end() )
+                 for( auto dl = _block_downloads.begin(); dl != _block_downloads.end(); ++dl )
                  {
-                    _block_download.trxs[trx_idx_itr->second] = *itr;
-                    _block_download.missing_trx_idx.erase(trx_idx_itr);
-                    if( _block_download.missing_trx_idx.size() == 0 )
+                    auto trx_idx_itr = dl->second.missing_trx_idx.find( item_id );
+                    if( trx_idx_itr != dl->second.missing_trx_idx.end() )
                     {
-                       attempt_push_download_block();
-                       // TODO: attempt to push full block!
+                       dl->second.trxs[trx_idx_itr->second] = *itr;
+                       dl->second.missing_trx_idx.erase(trx_idx_itr);
                     }
                  }
               }
+
+              // push any blocks that are now complete
+              for( auto dl = _block_downloads.begin(); dl != _block_downloads.end(); )
+              {
+                 if( dl->second.missing_trx_idx.size() == 0 )
+                 {
+                    block_download_state complete = std::move( dl->second );
+                    dl = _block_downloads.erase( dl );
+                    attempt_push_download_block( complete );
+                 }
+                 else
+                 {
+                    ++dl;
+                 }
+              }
           } FC_RETHROW_EXCEPTIONS( warn, "", ("msg",msg) ) } // provide stack trace for errors
 
           /**
@@ -314,12 +1414,70 @@ namespace bts { namespace blockchain {
           void handle_full_block( const connection_ptr& c, chan_data& cdat, full_block_message msg )
           { try {
               fc::sha224 block_id = msg.block_data.id();
-              if( cdat.requested_full_block != block_id )
+              cdat.known_block_inv.insert( block_id );
+
+              bool extends_head = msg.block_data.block_num == next_block_num() && 
+                                  msg.block_data.prev      == _db->head_block_id();
+              if( cdat.requested_full_block == block_id )
+              {
+                 cdat.requested_full_block = fc::sha224();
+              }
+              else if( !extends_head )
+              {
+                 // compact blocks are only relayed for the next block, anything else
+                 // is either old or we are behind and should sync headers first.
+                 if( msg.block_data.block_num > next_block_num() )
+                 {
+                    request_headers( c );
+                 }
+                 return;
+              }
+              auto existing = _block_downloads.find( block_id );
+              if( existing != _block_downloads.end() )
               {
-                  FC_THROW_EXCEPTION( exception, "unsolicited full block ${block_id}", 
-                                      ("block_id", block_id)("block", msg.block_data) );
+                 // already reconstructing it from another connection, c can serve it if that one fails
+                 auto& sources = existing->second.announced_by;
+                 if( std::find( sources.begin(), sources.end(), c ) == sources.end() )
+                 {
+                    sources.push_back( c );
+                 }
+                 return; 
               }
+              FC_ASSERT( msg.block_data.trx_ids.size() > 0 );
+              FC_ASSERT( msg.block_data.trx_mroot == msg.block_data.calculate_merkle_root() );
+
               // attempt to create a trx_block by looking up missing transactions
+              block_download_state dl;
+              dl.start_time = fc::time_point::now();
+              dl.trxs.resize( msg.block_data.trx_ids.size() );
+              get_trxs_message request;
+              for( uint16_t i = 0; i < msg.block_data.trx_ids.size(); ++i )
+              {
+                 const uint160& trx_id = msg.block_data.trx_ids[i];
+                 if( _pending_pool.contains( trx_id ) )
+                 {
+                    dl.trxs[i] = _pending_pool.fetch( trx_id );
+                 }
+                 else if( dl.missing_trx_idx.insert( std::make_pair( trx_id, i ) ).second )
+                 {
+                    request.items.push_back( trx_id );
+                 }
+              }
+              dl.full_blk = std::move( msg.block_data );
+              dl.announced_by.push_back( c );
+
+              if( dl.missing_trx_idx.size() == 0 )
+              {
+                 attempt_push_download_block( dl );
+                 return;
+              }
+
+              // fetch everything we are missing from the peer that sent the block in one round trip
+              FC_ASSERT( request.items.size() < TRX_INV_QUERY_LIMIT );
+              cdat.requested_trxs.insert( request.items.begin(), request.items.end() );
+              dl.source = c;
+              _block_downloads[block_id] = std::move(dl);
+              c->send( network::message( request, _chan_id ) );
 
           } FC_RETHROW_EXCEPTIONS( warn, "", ("msg",msg) ) } // provide stack trace for errors
 
@@ -329,12 +1487,45 @@ namespace bts { namespace blockchain {
           void handle_trx_block( const connection_ptr& c, chan_data& cdat, trx_block_message msg )
           { try {
               fc::sha224 block_id = msg.block_data.id();
+              uint32_t   num      = msg.block_data.block_num;
+
+              auto requested = cdat.requested_sync_blocks.find( num );
+              if( requested != cdat.requested_sync_blocks.end() )
+              {
+                 cdat.requested_sync_blocks.erase( requested );
+                 _sync_requested.erase( num );
+
+                 auto header = _sync_headers.find( num );
+                 if( header == _sync_headers.end() || header->second.id != block_id )
+                 {
+                    // the sync was reset or the peer sent the wrong block
+                    FC_THROW_EXCEPTION( exception, "unexpected sync block ${block_id}", ("block_id",block_id) );
+                 }
+                 cdat.sync_timeouts = 0;
+                 _sync_bodies[num] = std::move( msg.block_data );
+                 push_downloaded_blocks();
+                 return;
+              }
+
               if( cdat.requested_trx_block != block_id )
               {
                   FC_THROW_EXCEPTION( exception, "unsolicited trx block ${block_id}", 
                                                 ("block_id", block_id)("block", msg.block_data) );
               }
-              // attempt to push it onto the block db... if successful broadcast a block inv
+              cdat.requested_trx_block = fc::sha224();
+
+              // requested after a compact block download timed out, push it if it is still the next block
+              if( num != next_block_num() || msg.block_data.prev != _db->head_block_id() )
+              {
+                 if( num > next_block_num() )
+                 {
+                    request_headers( c );
+                 }
+                 return;
+              }
+              _db->push_block( msg.block_data );
+              block_pushed( msg.block_data );
+              broadcast_block( msg.block_data.operator full_block(), block_id );
           } FC_RETHROW_EXCEPTIONS( warn, "", ("msg",msg) ) } // provide stack trace for errors
      };
 
@@ -353,10 +1544,27 @@ namespace bts { namespace blockchain {
      my->_del     = d;
 
      my->_peers->subscribe_to_channel( my->_chan_id, my );
+
+     my->_fetch_loop  = fc::async( [=](){ my->fetch_loop(); } );
+     my->_verify_loop = fc::async( [=](){ my->verify_loop(); } );
   }
 
   channel::~channel()
   {
+     my->_peers->unsubscribe_from_channel( my->_chan_id );
+     my->_del = nullptr;
+     try {
+        my->_fetch_loop.cancel();
+        my->_verify_loop.cancel();
+        my->_fetch_loop.wait();
+        my->_verify_loop.wait();
+     } 
+     catch ( const fc::canceled_exception& )
+     {} // expected
+     catch ( ... ) 
+     {
+        wlog( "unexpected exception ${e}", ("e", fc::except_str()));
+     }
   }
   
   network::channel_id channel::get_id()const
@@ -370,22 +1578,45 @@ namespace bts { namespace blockchain {
    */
   const std::unordered_map<uint160,signed_transaction>& channel::get_pending_pool()const
   {
-      return my->_pending_trx;
+      return my->_pending_pool.get_transactions();
+  }
+
+  verify_stats channel::get_verify_stats()const
+  {
+      verify_stats s = my->_verify_stats;
+      s.queue_depth  = my->_verify_queue.size();
+      return s;
   }
 
        /**
         *  Called when this node wishes to pubish a trx.
         */
   void channel::broadcast( const signed_transaction& trx )
-  {
-  }
+  { try {
+     uint160 trx_id = trx.id();
+     if( !my->_pending_pool.contains( trx_id ) )
+     {
+        trx_eval eval = my->_db->evaluate_signed_transaction( trx );
+        FC_ASSERT( my->_pending_pool.store( trx, eval ), 
+                   "transaction conflicts with a pending transaction or pays too little to enter the pending pool" );
+     }
+     my->announce_trxs( std::vector<uint160>( 1, trx_id ) );
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("trx",trx) ) }
 
        /**
         *  This is called when a new block is sloved by this node.
         */
   void channel::broadcast( const trx_block& b )
-  {
-  }
+  { try {
+     fc::sha224 block_id = b.id();
+     if( my->_db->head_block_id() != block_id )
+     {
+        my->_db->push_block( b );
+        my->block_pushed( b );
+     }
+     // note: full_block(b) would slice off the trxs without filling in trx_ids
+     my->broadcast_block( b.operator full_block(), block_id );
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("block",b) ) }
         
 
 } }  // namespace bts::blockchain
@@ -1,20 +1,74 @@
 #include <bts/blockchain/blockchain_client.hpp>
 #include <bts/blockchain/blockchain_channel.hpp>
 #include <bts/blockchain/blockchain_db.hpp>
+#include <bts/blockchain/blockchain_miner.hpp>
 
 #include <fc/reflect/variant.hpp>
+#include <fc/log/logger.hpp>
 
 namespace bts { namespace blockchain {
 
   namespace detail 
   { 
-    class blockchain_client_impl
+    class blockchain_client_impl : public channel_delegate, public miner_delegate
     {
       public:
         peer::peer_channel_ptr     _peers;
         blockchain_db_ptr          _chain_db;
         blockchain::channel_ptr    _chain_chan;
         blockchain_client::config  _config;
+        address                    _coinbase;
+        /** null unless mining, destroyed first so that it stops before the channel */
+        std::unique_ptr<miner>     _miner;
+
+        /**
+         *  Gives the miner a new block on top of our head with the pending transactions.
+         */
+        void refresh_block_template()
+        {
+           if( !_miner || !_chain_chan )
+           {
+              return;
+           }
+           try {
+              const auto& pending = _chain_chan->get_pending_pool();
+              std::vector<signed_transaction> trxs;
+              trxs.reserve( pending.size() );
+              for( auto itr = pending.begin(); itr != pending.end(); ++itr )
+              {
+                 trxs.push_back( itr->second );
+              }
+              _miner->set_target( _chain_db->get_pow_target() );
+              _miner->set_block_template( _chain_db->generate_next_block( _coinbase, trxs ) );
+           } 
+           catch ( const fc::exception& e )
+           {
+              wlog( "unable to generate a block template\n${e}", ("e",e.to_detail_string()) );
+           }
+        }
+
+        virtual void handle_trx( const signed_transaction& trx )
+        {
+           refresh_block_template();
+        }
+
+        virtual void handle_trx_block( const trx_block& b )
+        {
+           refresh_block_template();
+        }
+
+        virtual void found_block( const trx_block& b )
+        {
+           try {
+              // pushing the block calls handle_trx_block which refreshes the template
+              _chain_chan->broadcast( b );
+           } 
+           catch ( const fc::exception& e )
+           {
+              wlog( "found block ${n} was not accepted\n${e}", ("n",b.block_num)("e",e.to_detail_string()) );
+              refresh_block_template();
+           }
+        }
     };
   } // namespace detail
 
@@ -33,14 +87,46 @@ namespace bts { namespace blockchain {
   {
      my->_config = aconfig;
      my->_chain_db->open( my->_config.data_dir / fc::variant(my->_config.chan_num).as_string() / "chaindb", true );
-     
-     // TODO: init chain with gensis block if necessary
+     if( my->_chain_db->head_block_num() == uint32_t(-1) )
+     {
+        my->_chain_db->push_block( create_genesis_block() );
+     }
 
      // TODO: load public wallet
 
      // TODO: connect to private wallet
 
-     // subscribe to the proper chain channel...  
+     my->_chain_chan = std::make_shared<channel>( my->_peers, my->_chain_db, my.get(),
+                                                  network::channel_id( network::bts_proto, my->_config.chan_num ) );
+  }
+
+  void blockchain_client::start_mining( float effort, const address& coinbase )
+  { try {
+     if( effort <= 0 )
+     {
+        stop_mining();
+        return;
+     }
+     FC_ASSERT( !!my->_chain_chan, "the client must be configured before mining" );
+     FC_ASSERT( coinbase != address() );
+     if( !my->_miner )
+     {
+        my->_miner.reset( new miner() );
+        my->_miner->set_delegate( my.get() );
+     }
+     my->_coinbase = coinbase;
+     my->refresh_block_template();
+     my->_miner->start( effort );
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("effort",effort)("coinbase",coinbase) ) }
+
+  void blockchain_client::stop_mining()
+  {
+     my->_miner.reset();
+  }
+
+  blockchain_db_ptr blockchain_client::get_chain()const
+  {
+     return my->_chain_db;
   }
 
   extended_address blockchain_client::get_recv_address( const std::string& contact_label )
@@ -48,7 +48,11 @@ namespace bts { namespace blockchain {
       {
          public:
             blockchain_db_impl()
-            :current_bitshare_supply(0){}
+            :current_bitshare_supply(0)
+            {
+               // TODO: derive the target from the difficulty once the chain defines one
+               memset( (char*)&_pow_target, 0xff, sizeof(_pow_target) );
+            }
 
             //std::unique_ptr<ldb::DB> blk_id2num;  // maps blocks to unique IDs
             bts::db::level_map<fc::sha224,uint32_t>             blk_id2num;
@@ -58,6 +62,8 @@ namespace bts { namespace blockchain {
             bts::db::level_map<uint32_t,std::vector<uint160> >  block_trxs; 
 
             market_db                                           _market_db;
+            pow_cache                                           _pow_cache;
+            pow_hash                                            _pow_target;
 
             /** table that accumulates all dividends that should be paid
              * based upon coinage
@@ -116,9 +122,9 @@ namespace bts { namespace blockchain {
              *   Stores a transaction and updates the spent status of all 
              *   outputs doing one last check to make sure they are unspent.
              */
-            void store( const signed_transaction& t, const trx_num& tn )
+            void store( const signed_transaction& t, const uint160& trx_id, const trx_num& tn )
             {
-               trx_id2num.store( t.id(), tn ); 
+               trx_id2num.store( trx_id, tn ); 
                meta_trxs.store( tn, meta_trx(t) );
 
                for( uint16_t i = 0; i < t.inputs.size(); ++i )
@@ -133,32 +139,37 @@ namespace bts { namespace blockchain {
                      claim_by_bid_output cbb = t.outputs[i].as<claim_by_bid_output>();
                      if( cbb.is_bid(t.outputs[i].unit) )
                      {
-                        elog( "Insert Bid: ${bid}", ("bid",market_order(cbb.ask_price, output_reference( t.id(), i )) ) );
-                        _market_db.insert_bid( market_order(cbb.ask_price, output_reference( t.id(), i )) );
+                        elog( "Insert Bid: ${bid}", ("bid",market_order(cbb.ask_price, output_reference( trx_id, i )) ) );
+                        _market_db.insert_bid( market_order(cbb.ask_price, output_reference( trx_id, i )) );
                      }
                      else
                      {
-                        elog( "Insert Ask: ${bid}", ("bid",market_order(cbb.ask_price, output_reference( t.id(), i )) ) );
-                        _market_db.insert_ask( market_order(cbb.ask_price, output_reference( t.id(), i )) );
+                        elog( "Insert Ask: ${bid}", ("bid",market_order(cbb.ask_price, output_reference( trx_id, i )) ) );
+                        _market_db.insert_ask( market_order(cbb.ask_price, output_reference( trx_id, i )) );
                      }
                   }
                   else if( t.outputs[i].claim_func == claim_by_long )
                   {
                     auto cbl = t.outputs[i].as<claim_by_long_output>();
-                    elog( "Insert Short Ask: ${bid}", ("bid",market_order(cbl.ask_price, output_reference( t.id(), i )) ) );
-                    _market_db.insert_ask( market_order(cbl.ask_price, output_reference( t.id(), i )) );
+                    elog( "Insert Short Ask: ${bid}", ("bid",market_order(cbl.ask_price, output_reference( trx_id, i )) ) );
+                    _market_db.insert_ask( market_order(cbl.ask_price, output_reference( trx_id, i )) );
                   }
                }
             }
 
             void store( const trx_block& b )
             {
+                std::vector<uint160> trx_ids = calculate_trx_ids( b.trxs );
                 for( uint16_t t = 0; t < b.trxs.size(); ++t )
                 {
-                   store( b.trxs[t], trx_num( b.block_num, t) );
+                   store( b.trxs[t], trx_ids[t], trx_num( b.block_num, t) );
                 }
                 head_block    = b;
                 head_block_id = b.id();
+
+                blocks.store( b.block_num, b );
+                block_trxs.store( b.block_num, trx_ids );
+                blk_id2num.store( head_block_id, b.block_num );
             }
 
             /**
@@ -401,6 +412,7 @@ namespace bts { namespace blockchain {
          my->blocks.open(     dir / "blocks",     create );
          my->block_trxs.open( dir / "block_trxs", create );
          my->_market_db.open( dir / "market" );
+         my->_pow_cache.open( dir / "pow_cache", create );
 
          if( !fc::exists( dir / "dividend_accumulator.dat" ) )
          {
@@ -410,9 +422,14 @@ namespace bts { namespace blockchain {
             wlog( "reset dividend table... perhaps the table needs to be recalculated" );
          }
          
-         block blk;
+         block    blk;
+         uint32_t blk_num = 0;
          // read the last block from the DB
-         my->blocks.last( my->head_block.block_num, blk );
+         if( my->blocks.last( blk_num, blk ) )
+         {
+            my->head_block    = fetch_trx_block( blk_num );
+            my->head_block_id = blk.id();
+         }
 
          my->current_bitshare_supply  = blk.state.issuance.data[asset::bts].issued;
          my->current_bitshare_supply += calculate_mining_reward( my->head_block.block_num ) / 2;
@@ -427,6 +444,7 @@ namespace bts { namespace blockchain {
         my->blocks.close();
         my->block_trxs.close();
         my->meta_trxs.close();
+        my->_pow_cache.close();
      }
 
     uint32_t blockchain_db::head_block_num()const
@@ -434,6 +452,11 @@ namespace bts { namespace blockchain {
        return my->head_block.block_num;
     }
 
+    fc::sha224 blockchain_db::head_block_id()const
+    {
+       return my->head_block_id;
+    }
+
 
     /**
      *  @pre trx must pass evaluate_signed_transaction() without exception
@@ -483,12 +506,16 @@ namespace bts { namespace blockchain {
        return fb;
     }
     trx_block  blockchain_db::fetch_trx_block( uint32_t block_num )
-    {
+    { try {
        trx_block fb = my->blocks.fetch(block_num);
-       // TODO: fetch each trx and add it to the trx block
-       //fb.trx_ids = my->block_trxs.fetch( block_num );
+       std::vector<uint160> trx_ids = my->block_trxs.fetch( block_num );
+       fb.trxs.reserve( trx_ids.size() );
+       for( uint16_t i = 0; i < trx_ids.size(); ++i )
+       {
+          fb.trxs.push_back( my->meta_trxs.fetch( trx_num( block_num, i ) ) );
+       }
        return fb;
-    }
+    } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",block_num) ) }
 
     /**
      *  Calculate the dividends due to a given asset accumulated durrning blocks from_num to to_num
@@ -578,6 +605,12 @@ namespace bts { namespace blockchain {
      *  @throw exception if trx can not be applied to the current chain state.
      */
     trx_eval blockchain_db::evaluate_signed_transaction( const signed_transaction& trx )       
+    {
+       return evaluate_signed_transaction( trx, std::unordered_set<address>() );
+    }
+
+    trx_eval blockchain_db::evaluate_signed_transaction( const signed_transaction& trx, 
+                                                         const std::unordered_set<address>& signed_addresses )
     {
        try {
            FC_ASSERT( trx.inputs.size() || trx.outputs.size() );
@@ -591,6 +624,7 @@ namespace bts { namespace blockchain {
            }
 
            trx_validation_state vstate( trx, this ); 
+           vstate.signed_addresses = signed_addresses; // recovered by validate() if empty
            vstate.validate();
 
            trx_eval e;
@@ -733,10 +767,21 @@ namespace bts { namespace blockchain {
         my->current_bitshare_supply += new_bts;
 
         my->store( b );
+        my->_pow_cache.block_pushed( b );
         
       } FC_RETHROW_EXCEPTIONS( warn, "unable to push block", ("b", b) );
     }
 
+    pow_cache& blockchain_db::get_pow_cache()
+    {
+       return my->_pow_cache;
+    }
+
+    const pow_hash& blockchain_db::get_pow_target()const
+    {
+       return my->_pow_target;
+    }
+
     /**
      *  Removes the top block from the stack and marks all spent outputs as 
      *  unspent.
@@ -11,5 +11,7 @@ const message_type get_trx_block_message::type;
 const message_type trxs_message::type;
 const message_type full_block_message::type;
 const message_type trx_block_message::type;
+const message_type get_headers_message::type;
+const message_type headers_message::type;
 
 } } // bts::bitchat
@@ -0,0 +1,271 @@
+#include <bts/blockchain/blockchain_miner.hpp>
+#include <bts/proof_of_work.hpp>
+#include <fc/thread/thread.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/log/logger.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace bts { namespace blockchain {
+
+  namespace detail
+  {
+     /** a block template along with the merkle root that is hashed with each nonce */
+     struct mining_work
+     {
+        trx_block  block;
+        uint160    root;
+     };
+     typedef std::shared_ptr<const mining_work> mining_work_ptr;
+
+     struct mining_thread
+     {
+        mining_thread( const std::string& name )
+        :thread(name),hashes(0),hash_rate(0){}
+
+        fc::thread             thread;
+        pow_buffer             buffer;
+        fc::future<void>       complete;
+        std::atomic<uint64_t>  hashes;
+        double                 hash_rate; ///< guarded by miner_impl::_mutex
+     };
+
+     class miner_impl : public std::enable_shared_from_this<miner_impl>
+     {
+        public:
+          miner_impl()
+          :_callback_thread( fc::thread::current() ),
+           _del(nullptr),
+           _effort(0),
+           _running(false)
+          {}
+
+          ~miner_impl()
+          {
+             stop();
+          }
+
+          fc::thread&                                  _callback_thread;
+          miner_delegate*                              _del;
+          std::vector<std::unique_ptr<mining_thread>>  _threads;
+
+          /** protects the state shared with the mining threads */
+          mutable std::mutex                           _mutex;
+          mining_work_ptr                              _work;
+          pow_hash                                     _target;
+          float                                        _effort;
+
+          std::atomic<bool>                            _running;
+
+          void stop()
+          {
+             _running = false;
+             for( auto itr = _threads.begin(); itr != _threads.end(); ++itr )
+             {
+                if( (*itr)->complete.valid() )
+                {
+                   (*itr)->complete.wait();
+                }
+             }
+          }
+
+          /**
+           *  Searches the thread's share of the nonce space, called on the mining thread.
+           */
+          void mine( uint32_t thread_num )
+          {
+             mining_thread& self = *_threads[thread_num];
+
+             uint64_t range = (uint64_t(1) << 32) / _threads.size();
+             uint64_t first = range * thread_num;
+             uint64_t last  = thread_num + 1 == _threads.size() ? (uint64_t(1) << 32) : first + range;
+             uint64_t nonce = first;
+
+             mining_work_ptr work;
+             fc::time_point  window_start  = fc::time_point::now();
+             uint64_t        window_hashes = 0;
+             while( _running )
+             {
+                try
+                {
+                   mining_work_ptr latest;
+                   pow_hash        target;
+                   float           effort;
+                   {
+                      std::unique_lock<std::mutex> lock( _mutex );
+                      latest = _work;
+                      target = _target;
+                      effort = _effort;
+                   }
+
+                   if( latest != work )
+                   {
+                      // new transactions keep our place in the nonce range, a new block starts over
+                      if( !work || !latest || latest->block.prev != work->block.prev )
+                      {
+                         nonce = first;
+                      }
+                      work = latest;
+                   }
+                   if( !work || nonce >= last )
+                   {
+                      fc::usleep( fc::microseconds( 100*1000 ) );
+                      continue;
+                   }
+
+                   auto start = fc::time_point::now();
+                   fc::sha256::encoder enc;
+                   fc::raw::pack( enc, uint32_t(nonce) );
+                   fc::raw::pack( enc, work->root );
+                   pow_hash pow = proof_of_work( enc.result(), self.buffer.data() );
+                   ++self.hashes;
+                   ++window_hashes;
+
+                   if( !(target < pow) )
+                   {
+                      found( work, uint32_t(nonce) );
+                   }
+                   ++nonce;
+
+                   auto end = fc::time_point::now();
+                   if( end - window_start >= fc::seconds( MINER_STATS_PERIOD_SEC ) )
+                   {
+                      std::unique_lock<std::mutex> lock( _mutex );
+                      self.hash_rate = window_hashes / ((end - window_start).count() / 1000000.0);
+                      window_start   = end;
+                      window_hashes  = 0;
+                   }
+                   if( effort < 1 && effort > 0 )
+                   {
+                      fc::usleep( fc::microseconds( int64_t( (end - start).count() * (1 - effort) / effort ) ) );
+                   }
+                }
+                catch ( const fc::exception& e )
+                {
+                   elog( "mining thread ${t} error: ${e}", ("t",thread_num)("e",e.to_detail_string()) );
+                   fc::usleep( fc::seconds(1) );
+                }
+             }
+          }
+
+          /**
+           *  A solution for an older template that builds on the current previous block 
+           *  is still a valid block, it is reported and mining waits for a new template.
+           */
+          void found( const mining_work_ptr& work, uint32_t nonce )
+          {
+             {
+                std::unique_lock<std::mutex> lock( _mutex );
+                if( !_work || _work->block.prev != work->block.prev )
+                {
+                   return; // a block was already found or the chain moved on
+                }
+                _work.reset();
+             }
+             trx_block b = work->block;
+             b.pow.nonce = nonce;
+             ilog( "found block ${n} with nonce ${nonce}", ("n",b.block_num)("nonce",nonce) );
+
+             // the miner may be destroyed before the callback thread runs this
+             std::weak_ptr<miner_impl> weak_self = shared_from_this();
+             _callback_thread.async( [=]()
+             {
+                auto self = weak_self.lock();
+                if( self && self->_del ) 
+                {
+                   self->_del->found_block( b );
+                }
+             } );
+          }
+     };
+  }
+
+  miner::miner( uint32_t threads )
+  :my( std::make_shared<detail::miner_impl>() )
+  {
+     if( threads == 0 )
+     {
+        threads = std::max<uint32_t>( 1, std::thread::hardware_concurrency() );
+     }
+     for( uint32_t i = 0; i < threads; ++i )
+     {
+        my->_threads.push_back( std::unique_ptr<detail::mining_thread>( new detail::mining_thread( "miner" ) ) );
+     }
+  }
+
+  miner::~miner()
+  {
+     // queued found_block callbacks only hold a weak reference to the impl
+     my->stop();
+     my->_del = nullptr;
+  }
+
+  void miner::set_delegate( miner_delegate* d )
+  {
+     my->_del = d;
+  }
+
+  void miner::set_target( const pow_hash& target )
+  {
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     my->_target = target;
+  }
+
+  void miner::set_block_template( const trx_block& b )
+  { try {
+     FC_ASSERT( b.pow.branch_path.mid_states.size() > 0 );
+     FC_ASSERT( b.pow.branch_path.mid_states[0] == b.digest() );
+
+     auto work   = std::make_shared<detail::mining_work>();
+     work->block = b;
+     work->root  = b.pow.branch_path.calculate_root();
+
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     my->_work = work;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("block",b) ) }
+
+  void miner::start( float effort )
+  {
+     if( effort <= 0 )
+     {
+        stop();
+        return;
+     }
+     {
+        std::unique_lock<std::mutex> lock( my->_mutex );
+        my->_effort = std::min<float>( effort, 1 );
+     }
+     if( !my->_running )
+     {
+        my->_running = true;
+        for( uint32_t i = 0; i < my->_threads.size(); ++i )
+        {
+           detail::miner_impl* self = my.get();
+           my->_threads[i]->complete = my->_threads[i]->thread.async( [=](){ self->mine( i ); } );
+        }
+     }
+  }
+
+  void miner::stop()
+  {
+     my->stop();
+  }
+
+  miner_stats miner::get_stats()const
+  {
+     miner_stats stats;
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     for( auto itr = my->_threads.begin(); itr != my->_threads.end(); ++itr )
+     {
+        stats.hashes    += (*itr)->hashes;
+        stats.hash_rate += (*itr)->hash_rate;
+        stats.thread_hash_rates.push_back( (*itr)->hash_rate );
+     }
+     return stats;
+  }
+
+} } // bts::blockchain
@@ -0,0 +1,259 @@
+#include <bts/blockchain/blockchain_pending_pool.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/log/logger.hpp>
+
+#include <map>
+#include <unordered_set>
+
+namespace bts { namespace blockchain {
+
+  namespace detail
+  {
+     typedef std::multimap<fc::uint128,uint160>     fee_index_type;
+     typedef std::multimap<fc::time_point,uint160>  time_index_type;
+
+     struct pool_entry
+     {
+        fc::uint128                fee_rate; // fees per byte in 64.64 fixed point
+        std::vector<char>          packed;
+        uint64_t                   bytes;    // memory used by packed and the unpacked trx
+        fee_index_type::iterator   fee_itr;
+        time_index_type::iterator  time_itr;
+     };
+
+     /**
+      *  @return the approximate memory used by trx, including the vectors
+      *          and signatures it owns
+      */
+     uint64_t memory_size( const signed_transaction& trx )
+     {
+        uint64_t size = sizeof(trx);
+        for( auto in = trx.inputs.begin(); in != trx.inputs.end(); ++in )
+        {
+           size += sizeof(*in) + in->input_data.size();
+        }
+        for( auto out = trx.outputs.begin(); out != trx.outputs.end(); ++out )
+        {
+           size += sizeof(*out) + out->claim_data.size();
+        }
+        // each signature is a node in a hash set
+        size += trx.sigs.size() * (sizeof(fc::ecc::compact_signature) + 2*sizeof(void*));
+        return size;
+     }
+
+     class pending_pool_impl
+     {
+        public:
+          pending_pool_impl( uint64_t max_bytes )
+          :_max_bytes(max_bytes),_bytes(0){}
+
+          uint64_t                                        _max_bytes;
+          uint64_t                                        _bytes;
+
+          std::unordered_map<uint160,signed_transaction>  _trxs;
+          std::unordered_map<uint160,pool_entry>          _entries;
+
+          /** ordered from lowest to highest fee rate */
+          fee_index_type                                  _fee_index;
+          time_index_type                                 _time_index;
+
+          /** the pending transaction that spends each output */
+          std::map<output_reference,uint160>              _spent_outputs;
+
+          void remove( const uint160& trx_id )
+          {
+             auto entry = _entries.find( trx_id );
+             if( entry == _entries.end() )
+             {
+                return;
+             }
+             const signed_transaction& trx = _trxs[trx_id];
+             for( auto in = trx.inputs.begin(); in != trx.inputs.end(); ++in )
+             {
+                auto spent = _spent_outputs.find( in->output_ref );
+                if( spent != _spent_outputs.end() && spent->second == trx_id )
+                {
+                   _spent_outputs.erase( spent );
+                }
+             }
+             _fee_index.erase( entry->second.fee_itr );
+             _time_index.erase( entry->second.time_itr );
+             _bytes -= entry->second.bytes;
+             _entries.erase( entry );
+             _trxs.erase( trx_id );
+          }
+     };
+  }
+
+  pending_pool::pending_pool( uint64_t max_bytes )
+  :my( new detail::pending_pool_impl( max_bytes ) )
+  {
+  }
+
+  pending_pool::~pending_pool()
+  {
+  }
+
+  bool pending_pool::store( const signed_transaction& trx, const trx_eval& eval, std::vector<uint160>* removed )
+  { try {
+     uint160 trx_id = trx.id();
+     if( contains( trx_id ) )
+     {
+        return true;
+     }
+
+     // both the packed and the unpacked trx are kept, the fee rate is per packed byte
+     std::vector<char> packed   = fc::raw::pack( trx );
+     uint64_t          size     = packed.size() + detail::memory_size( trx );
+     fc::uint128       fee_rate = eval.fees.amount / fc::uint128( packed.size() );
+     if( size > my->_max_bytes )
+     {
+        return false;
+     }
+
+     // a double spend replaces the transactions it conflicts with only if it pays more
+     std::unordered_set<uint160> conflicts;
+     uint64_t                    conflict_bytes = 0;
+     for( auto in = trx.inputs.begin(); in != trx.inputs.end(); ++in )
+     {
+        auto spent = my->_spent_outputs.find( in->output_ref );
+        if( spent != my->_spent_outputs.end() && conflicts.insert( spent->second ).second )
+        {
+           const detail::pool_entry& e = my->_entries[spent->second];
+           if( !(e.fee_rate < fee_rate) )
+           {
+              return false;
+           }
+           conflict_bytes += e.bytes;
+        }
+     }
+
+     // find the lowest paying transactions that must be evicted to make room
+     std::vector<uint160> evict;
+     uint64_t             new_bytes = my->_bytes - conflict_bytes + size;
+     for( auto itr = my->_fee_index.begin(); new_bytes > my->_max_bytes && itr != my->_fee_index.end(); ++itr )
+     {
+        if( !(itr->first < fee_rate) )
+        {
+           return false; // trx pays too little to displace anything
+        }
+        if( conflicts.find( itr->second ) == conflicts.end() )
+        {
+           new_bytes -= my->_entries[itr->second].bytes;
+           evict.push_back( itr->second );
+        }
+     }
+
+     evict.insert( evict.end(), conflicts.begin(), conflicts.end() );
+     for( auto itr = evict.begin(); itr != evict.end(); ++itr )
+     {
+        my->remove( *itr );
+     }
+     if( removed )
+     {
+        removed->insert( removed->end(), evict.begin(), evict.end() );
+     }
+
+     detail::pool_entry& e = my->_entries[trx_id];
+     e.fee_rate = fee_rate;
+     e.packed   = std::move( packed );
+     e.bytes    = size;
+     e.fee_itr  = my->_fee_index.insert( std::make_pair( fee_rate, trx_id ) );
+     e.time_itr = my->_time_index.insert( std::make_pair( fc::time_point::now(), trx_id ) );
+     for( auto in = trx.inputs.begin(); in != trx.inputs.end(); ++in )
+     {
+        my->_spent_outputs[in->output_ref] = trx_id;
+     }
+     my->_trxs[trx_id] = trx;
+     my->_bytes += size;
+     return true;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("trx",trx)("eval",eval) ) }
+
+  bool pending_pool::contains( const uint160& trx_id )const
+  {
+     return my->_trxs.find( trx_id ) != my->_trxs.end();
+  }
+
+  const signed_transaction& pending_pool::fetch( const uint160& trx_id )const
+  {
+     auto itr = my->_trxs.find( trx_id );
+     if( itr == my->_trxs.end() )
+     {
+        FC_THROW_EXCEPTION( key_not_found_exception, "unknown pending transaction ${trx_id}", ("trx_id",trx_id) );
+     }
+     return itr->second;
+  }
+
+  const std::vector<char>& pending_pool::fetch_packed( const uint160& trx_id )const
+  {
+     auto itr = my->_entries.find( trx_id );
+     if( itr == my->_entries.end() )
+     {
+        FC_THROW_EXCEPTION( key_not_found_exception, "unknown pending transaction ${trx_id}", ("trx_id",trx_id) );
+     }
+     return itr->second.packed;
+  }
+
+  void pending_pool::remove( const uint160& trx_id )
+  {
+     my->remove( trx_id );
+  }
+
+  void pending_pool::remove_included( const std::vector<signed_transaction>& trxs )
+  {
+     for( auto trx = trxs.begin(); trx != trxs.end(); ++trx )
+     {
+        my->remove( trx->id() );
+        for( auto in = trx->inputs.begin(); in != trx->inputs.end(); ++in )
+        {
+           auto spent = my->_spent_outputs.find( in->output_ref );
+           if( spent != my->_spent_outputs.end() )
+           {
+              my->remove( spent->second );
+           }
+        }
+     }
+  }
+
+  std::vector<uint160> pending_pool::remove_expired( const fc::time_point& older_than )
+  {
+     std::vector<uint160> expired;
+     for( auto itr = my->_time_index.begin(); itr != my->_time_index.end() && itr->first < older_than; ++itr )
+     {
+        expired.push_back( itr->second );
+     }
+     for( auto itr = expired.begin(); itr != expired.end(); ++itr )
+     {
+        my->remove( *itr );
+     }
+     return expired;
+  }
+
+  std::vector<uint160> pending_pool::get_inventory( uint32_t limit )const
+  {
+     std::vector<uint160> inv;
+     inv.reserve( std::min<size_t>( limit, my->_fee_index.size() ) );
+     for( auto itr = my->_fee_index.rbegin(); itr != my->_fee_index.rend() && inv.size() < limit; ++itr )
+     {
+        inv.push_back( itr->second );
+     }
+     return inv;
+  }
+
+  const std::unordered_map<uint160,signed_transaction>& pending_pool::get_transactions()const
+  {
+     return my->_trxs;
+  }
+
+  size_t pending_pool::size()const
+  {
+     return my->_trxs.size();
+  }
+
+  uint64_t pending_pool::size_in_bytes()const
+  {
+     return my->_bytes;
+  }
+
+} } // bts::blockchain
@@ -0,0 +1,264 @@
+#include <bts/blockchain/blockchain_pow_cache.hpp>
+#include <bts/db/level_map.hpp>
+#include <bts/proof_of_work.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/thread/future.hpp>
+#include <fc/log/logger.hpp>
+
+#include <list>
+#include <unordered_map>
+
+namespace bts { namespace blockchain {
+
+  namespace detail
+  {
+     struct pow_record
+     {
+        fc::sha256  seed;
+        pow_hash    pow;
+     };
+  }
+
+} } // bts::blockchain
+
+FC_REFLECT( bts::blockchain::detail::pow_record, (seed)(pow) )
+
+namespace bts { namespace blockchain {
+
+  namespace detail
+  {
+     class pow_cache_impl
+     {
+        public:
+          pow_cache_impl( uint32_t max_entries )
+          :_max_entries(max_entries),_evaluated(0){}
+
+          struct entry
+          {
+             pow_hash                          pow;
+             std::list<fc::sha256>::iterator   lru_itr;
+          };
+
+          uint32_t                                   _max_entries;
+
+          /** most recently used at the front */
+          std::list<fc::sha256>                      _lru;
+          std::unordered_map<fc::sha256,entry>       _entries;
+
+          /** results of the blocks at the end of the chain, indexed by block number */
+          bts::db::level_map<uint32_t,pow_record>    _chain_tail;
+
+          /**
+           *  Seeds that are being evaluated right now, pow_engine::evaluate() yields so
+           *  other callers asking for the same seed wait on the result here rather than
+           *  evaluating it a second time.
+           */
+          std::unordered_map<fc::sha256,fc::promise<pow_hash>::ptr> _in_flight;
+
+          /** number of seeds evaluated on the pow_engine, for the tests */
+          uint64_t                                   _evaluated;
+
+          void begin_evaluation( const fc::sha256& seed )
+          {
+             _in_flight[seed] = fc::promise<pow_hash>::ptr( new fc::promise<pow_hash>( "pow_cache::evaluate" ) );
+             ++_evaluated;
+          }
+
+          void end_evaluation( const fc::sha256& seed, const pow_hash& pow )
+          {
+             store( seed, pow );
+             auto itr = _in_flight.find( seed );
+             if( itr != _in_flight.end() )
+             {
+                auto prom = itr->second;
+                _in_flight.erase( itr );
+                prom->set_value( pow );
+             }
+          }
+
+          void fail_evaluation( const fc::sha256& seed, const fc::exception& e )
+          {
+             auto itr = _in_flight.find( seed );
+             if( itr != _in_flight.end() )
+             {
+                auto prom = itr->second;
+                _in_flight.erase( itr );
+                prom->set_exception( e.dynamic_copy_exception() );
+             }
+          }
+
+          bool fetch( const fc::sha256& seed, pow_hash& pow )
+          {
+             auto itr = _entries.find( seed );
+             if( itr == _entries.end() )
+             {
+                return false;
+             }
+             _lru.splice( _lru.begin(), _lru, itr->second.lru_itr );
+             pow = itr->second.pow;
+             return true;
+          }
+
+          void store( const fc::sha256& seed, const pow_hash& pow )
+          {
+             auto itr = _entries.find( seed );
+             if( itr != _entries.end() )
+             {
+                _lru.splice( _lru.begin(), _lru, itr->second.lru_itr );
+                itr->second.pow = pow;
+                return;
+             }
+             _lru.push_front( seed );
+             entry& e  = _entries[seed];
+             e.pow     = pow;
+             e.lru_itr = _lru.begin();
+
+             while( _entries.size() > _max_entries )
+             {
+                _entries.erase( _lru.back() );
+                _lru.pop_back();
+             }
+          }
+     };
+  }
+
+  pow_cache::pow_cache( uint32_t max_entries )
+  :my( new detail::pow_cache_impl( max_entries ) )
+  {
+  }
+
+  pow_cache::~pow_cache()
+  {
+  }
+
+  void pow_cache::open( const fc::path& dir, bool create )
+  { try {
+     my->_chain_tail.open( dir, create );
+
+     // the tail is loaded oldest first so the newest blocks are the last to be evicted
+     for( auto itr = my->_chain_tail.begin(); itr.valid(); ++itr )
+     {
+        detail::pow_record rec = itr.value();
+        my->store( rec.seed, rec.pow );
+     }
+     ilog( "loaded ${n} proof of work results", ("n", my->_entries.size()) );
+  } FC_RETHROW_EXCEPTIONS( warn, "unable to open pow cache ${dir}", ("dir",dir) ) }
+
+  void pow_cache::close()
+  {
+     my->_chain_tail.close();
+  }
+
+  pow_hash pow_cache::evaluate( const block_proof& h )
+  { try {
+     fc::sha256 seed = h.pow_seed();
+     pow_hash   pow;
+     if( my->fetch( seed, pow ) )
+     {
+        return pow;
+     }
+
+     auto pending = my->_in_flight.find( seed );
+     if( pending != my->_in_flight.end() )
+     {
+        return fc::future<pow_hash>( pending->second ).wait();
+     }
+
+     my->begin_evaluation( seed );
+     try {
+        pow = pow_engine::instance().evaluate( seed );
+     } 
+     catch ( const fc::exception& e )
+     {
+        my->fail_evaluation( seed, e );
+        throw;
+     }
+     my->end_evaluation( seed, pow );
+     return pow;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("header",h) ) }
+
+  std::vector<pow_hash> pow_cache::evaluate( const std::vector<block_proof>& headers )
+  { try {
+     std::vector<pow_hash>   pows( headers.size() );
+     std::vector<fc::sha256> missing;
+     std::vector<size_t>     missing_idx;
+
+     // headers that another caller (or an earlier duplicate in this batch) is evaluating
+     std::vector<std::pair<size_t,fc::future<pow_hash>>> waiting;
+     for( size_t i = 0; i < headers.size(); ++i )
+     {
+        fc::sha256 seed = headers[i].pow_seed();
+        if( my->fetch( seed, pows[i] ) )
+        {
+           continue;
+        }
+        auto pending = my->_in_flight.find( seed );
+        if( pending != my->_in_flight.end() )
+        {
+           waiting.push_back( std::make_pair( i, fc::future<pow_hash>( pending->second ) ) );
+           continue;
+        }
+        my->begin_evaluation( seed );
+        missing.push_back( seed );
+        missing_idx.push_back( i );
+     }
+
+     if( missing.size() )
+     {
+        std::vector<pow_hash> evaluated;
+        try {
+           evaluated = pow_engine::instance().evaluate( missing );
+        } 
+        catch ( const fc::exception& e )
+        {
+           for( auto itr = missing.begin(); itr != missing.end(); ++itr )
+           {
+              my->fail_evaluation( *itr, e );
+           }
+           throw;
+        }
+        for( size_t i = 0; i < missing.size(); ++i )
+        {
+           pows[missing_idx[i]] = evaluated[i];
+           my->end_evaluation( missing[i], evaluated[i] );
+        }
+     }
+
+     for( auto itr = waiting.begin(); itr != waiting.end(); ++itr )
+     {
+        pows[itr->first] = itr->second.wait();
+     }
+     return pows;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("headers",headers.size()) ) }
+
+  void pow_cache::block_pushed( const block_proof& h )
+  { try {
+     detail::pow_record rec;
+     rec.seed = h.pow_seed();
+     if( !my->fetch( rec.seed, rec.pow ) )
+     {
+        return; // the proof of work of this block was never evaluated
+     }
+     my->_chain_tail.store( h.block_num, rec );
+
+     // forget everything that is no longer part of the tail
+     auto itr = my->_chain_tail.begin();
+     while( itr.valid() && itr.key() + POW_CACHE_PERSIST_BLOCKS <= h.block_num )
+     {
+        uint32_t old_num = itr.key();
+        ++itr;
+        my->_chain_tail.remove( old_num );
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("header",h) ) }
+
+  size_t pow_cache::size()const
+  {
+     return my->_entries.size();
+  }
+
+  uint64_t pow_cache::evaluated_count()const
+  {
+     return my->_evaluated;
+  }
+
+} } // bts::blockchain
@@ -175,7 +175,7 @@ namespace bts { namespace blockchain {
      ss << "    <td align=right cellpadding=5>" << fees                                                   <<"</td>\n";
      ss << "    <td align=right cellpadding=5>" << reward                                                 <<"</td>\n";
      ss << "    <td align=right cellpadding=5>" << dividends                                              <<"</td>\n";
-     ss << "    <td cellpadding=5>" << fc::variant(b.proof_of_work()).as_string().substr(0,8) <<"</td>\n";
+     ss << "    <td cellpadding=5>" << fc::variant(db.get_pow_cache().evaluate(b)).as_string().substr(0,8) <<"</td>\n";
      ss << "  </tr>\n";
      ss << "</table>\n";
      ss << "</td></tr>\n";
@@ -31,6 +31,31 @@ namespace bts { namespace blockchain {
       return small_hash( enc.result() );
    }
 
+   std::vector<uint160> calculate_trx_ids( const std::vector<signed_transaction>& trxs )
+   {
+      // pack every transaction into one buffer and hash them all at once
+      std::vector<size_t> sizes( trxs.size() );
+      size_t              total = 0;
+      for( size_t i = 0; i < trxs.size(); ++i )
+      {
+         sizes[i] = fc::raw::pack_size( trxs[i] );
+         total   += sizes[i];
+      }
+
+      std::vector<char>        packed( total );
+      std::vector<const char*> inputs( trxs.size() );
+      fc::datastream<char*>    ds( packed.data(), packed.size() );
+      for( size_t i = 0; i < trxs.size(); ++i )
+      {
+         inputs[i] = packed.data() + ds.tellp();
+         fc::raw::pack( ds, trxs[i] );
+      }
+
+      std::vector<uint160> ids( trxs.size() );
+      small_hash( inputs.data(), sizes.data(), ids.size(), ids.data() );
+      return ids;
+   }
+
    void                                    signed_transaction::sign( const fc::ecc::private_key& k )
    {
     try {
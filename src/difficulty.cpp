@@ -15,7 +15,7 @@ namespace bts
      return m;
   }
 
-  uint64_t difficulty( const fc::sha224& hash_value )
+  uint64_t difficulty_reference( const fc::sha224& hash_value )
   {
       if( hash_value == fc::sha224() ) return uint64_t(-1); // div by 0
 
@@ -27,5 +27,90 @@ namespace bts
       return tmp;
   }
 
+#ifdef __SIZEOF_INT128__
+  namespace detail
+  {
+     typedef unsigned __int128 uint128_t;
+
+     /** @return true if q * h > max224(), h is 4 big endian limbs */
+     inline bool product_exceeds_max224( uint64_t q, const uint64_t* h )
+     {
+        uint64_t  p[5];
+        uint128_t c = 0;
+        for( int i = 3; i >= 0; --i )
+        {
+           c     += uint128_t(q) * h[i];
+           p[i+1] = uint64_t(c);
+           c    >>= 64;
+        }
+        p[0] = uint64_t(c);
+        return p[0] != 0 || (p[1] >> 32) != 0;
+     }
+  }
+
+  /**
+   *  Computes the same result as difficulty_reference() with fixed width integers.
+   *
+   *  The hash is at most 224 bits and the quotient must fit in 63 bits, so it is
+   *  estimated by dividing the top 64 bits of the hash into the corresponding bits
+   *  of max224() and then corrected by at most a couple of steps using an exact
+   *  product.
+   */
+  uint64_t difficulty( const fc::sha224& hash_value )
+  {
+      // load the hash as a 256 bit big endian number, w[0] is the most significant limb
+      uint64_t w[4] = {0,0,0,0};
+      const unsigned char* bytes = (const unsigned char*)&hash_value;
+      for( uint32_t i = 0; i < sizeof(hash_value); ++i )
+      {
+         uint32_t pos = i + 32 - sizeof(hash_value);
+         w[pos/8] |= uint64_t(bytes[i]) << (8 * (7 - pos%8));
+      }
+
+      int top = 0;
+      while( top < 4 && w[top] == 0 ) ++top;
+      if( top == 4 ) return uint64_t(-1); // div by 0
+
+      uint32_t bits = (3 - top) * 64 + 64 - __builtin_clzll( w[top] );
+      if( bits <= 224 - 63 )
+      {
+         return 0; // the quotient does not fit in an int64
+      }
+
+      // top 64 bits of the hash, shifted right by s
+      uint32_t shift = bits - 64;
+      uint32_t limb  = 3 - shift / 64;
+      uint32_t off   = shift % 64;
+      uint64_t h_top = w[limb] >> off;
+      if( off && limb > 0 )
+      {
+         h_top |= w[limb-1] << (64 - off);
+      }
+
+      detail::uint128_t m_top = (detail::uint128_t(1) << (224 - shift)) - 1; // max224() >> shift
+      uint64_t q = uint64_t( m_top / h_top );
+      while( detail::product_exceeds_max224( q, w ) ) --q;
+      while( !detail::product_exceeds_max224( q + 1, w ) ) ++q;
+      return q;
+  }
+#else
+  uint64_t difficulty( const fc::sha224& hash_value )
+  {
+      return difficulty_reference( hash_value );
+  }
+#endif
+
+  /**
+   *  max224() / h > d   <=>   max224() / h >= d + 1   <=>   h <= max224() / (d + 1)
+   */
+  fc::sha224 difficulty_target( uint64_t d )
+  {
+      std::vector<char> be = max224() / (fc::bigint( d ) + fc::bigint( uint64_t(1) ));
+      fc::sha224 target;
+      FC_ASSERT( be.size() <= sizeof(target) );
+      memcpy( (char*)&target + sizeof(target) - be.size(), be.data(), be.size() );
+      return target;
+  }
+
 
 } // bts
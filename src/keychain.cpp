@@ -18,18 +18,16 @@ namespace bts {
    */
   fc::sha512 keychain::stretch_seed( const fc::sha512& seed )
   {
-      fc::thread t("stretch_seed");
-      return t.async( [=]() {
-          fc::sha512 last = seed;
-          ilog( "stretchign seed" );
-          for( uint32_t i = 0; i < 10; ++i )
-          {
-              ilog( ".\r" );
-              auto p = proof_of_work( fc::sha256::hash( (char*)&last, sizeof(last)) );  
-              last = fc::sha512::hash( (char*)&p, sizeof(p) );
-          }
-          return last; 
-      } ).wait();
+      // each round runs on a pow_engine worker while this task waits
+      fc::sha512 last = seed;
+      ilog( "stretchign seed" );
+      for( uint32_t i = 0; i < 10; ++i )
+      {
+          ilog( ".\r" );
+          auto p = pow_engine::instance().evaluate( fc::sha256::hash( (char*)&last, sizeof(last)) );  
+          last = fc::sha512::hash( (char*)&p, sizeof(p) );
+      }
+      return last; 
   }
 
   void              keychain::set_seed( const fc::sha512& stretched_seed )
@@ -1,5 +1,5 @@
 //#include "api.hpp"
-#include "miner.hpp"
+#include <bts/blockchain/blockchain_miner.hpp>
 #include "account.hpp"
 #include "wallet.hpp"
 #include <fc/io/stdio.hpp>
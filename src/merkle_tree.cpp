@@ -3,11 +3,158 @@
 
 namespace bts {
 
+  namespace detail
+  {
+     static_assert( sizeof(uint160[2]) == 40, "validate there is no padding between array items" );
+
+     inline uint160 hash_pair( const uint160& left, const uint160& right )
+     {
+        uint160 pair[2] = { left, right };
+        return small_hash( (char*)pair, sizeof(pair) );
+     }
+
+     /**
+      *  Replaces the first (n+1)/2 nodes of layer with the hashes of the
+      *  pairs of its n nodes, the last node of an odd layer is paired with
+      *  uint160().
+      *
+      *  The pairs are hashed as one batch, which reads every pair before
+      *  writing any hash, so the layer above can be stored over the layer below.
+      *
+      *  @return the number of nodes in the layer above
+      */
+     size_t hash_layer( uint160* layer, size_t n )
+     {
+        size_t pairs = n / 2;
+        small_hash( (char*)layer, 2*sizeof(uint160), pairs, layer );
+        if( n % 2 )
+        {
+           layer[pairs] = hash_pair( layer[n-1], uint160() );
+           ++pairs;
+        }
+        return pairs;
+     }
+  }
+
   uint160 merkle_branch::calculate_root()const
   {
      if( mid_states.size() == 0 ) return uint160();
-     if( mid_states.size() == 1 ) return mid_states[0];
-     FC_ASSERT( !"TODO: Merged Mining is Not Yet Implemented" );
+     if( mid_states.size() > 8*sizeof(branch) + 1 )
+     {
+        FC_THROW_EXCEPTION( out_of_range_exception, "merkle branch of ${s} mid states is too long",
+                            ("s",mid_states.size()) );
+     }
+
+     uint160 node = mid_states[0];
+     for( uint32_t i = 1; i < mid_states.size(); ++i )
+     {
+        if( branch & (1u << (i-1)) )
+        {
+           node = detail::hash_pair( mid_states[i], node );
+        }
+        else
+        {
+           node = detail::hash_pair( node, mid_states[i] );
+        }
+     }
+     return node;
+  }
+
+  uint160 calculate_merkle_root( std::vector<uint160> leaves )
+  {
+     if( leaves.size() == 0 ) return uint160();
+
+     size_t n = leaves.size();
+     while( n > 1 )
+     {
+        n = detail::hash_layer( leaves.data(), n );
+     }
+     return leaves.front();
+  }
+
+  void merkle_tree::resize( uint64_t s )
+  {
+     std::vector<uint160> leaves;
+     if( mtree.size() )
+     {
+        leaves = std::move( mtree.front() );
+     }
+     leaves.resize( s );
+     set_leaves( std::move(leaves) );
+  }
+
+  uint64_t merkle_tree::size()const
+  {
+     return mtree.size() ? mtree.front().size() : 0;
+  }
+
+  void merkle_tree::set_leaves( std::vector<uint160> leaves )
+  {
+     mtree.clear();
+     if( leaves.size() == 0 )
+     {
+        mroot = uint160();
+        return;
+     }
+
+     mtree.push_back( std::move(leaves) );
+     while( mtree.back().size() > 1 )
+     {
+        // hash a copy of the layer in place to produce the layer above it
+        std::vector<uint160> next( mtree.back() );
+        next.resize( detail::hash_layer( next.data(), next.size() ) );
+        mtree.push_back( std::move(next) );
+     }
+     mroot = mtree.back().front();
+  }
+
+  void merkle_tree::set( uint64_t index, const uint160& val )
+  {
+     if( index >= size() )
+     {
+        FC_THROW_EXCEPTION( out_of_range_exception, "index ${i} is beyond the ${s} leaves of the tree",
+                            ("i",index)("s",size()) );
+     }
+
+     mtree[0][index] = val;
+     for( uint32_t layer = 1; layer < mtree.size(); ++layer )
+     {
+        const std::vector<uint160>& below = mtree[layer-1];
+        uint64_t left = index & ~uint64_t(1);
+        index /= 2;
+        mtree[layer][index] = detail::hash_pair( below[left],
+                                                 left + 1 < below.size() ? below[left+1] : uint160() );
+     }
+     mroot = mtree.back().front();
+  }
+
+  uint160 merkle_tree::get( uint32_t index )const
+  {
+     if( index >= size() )
+     {
+        FC_THROW_EXCEPTION( out_of_range_exception, "index ${i} is beyond the ${s} leaves of the tree",
+                            ("i",index)("s",size()) );
+     }
+     return mtree[0][index];
+  }
+
+  merkle_branch merkle_tree::get_branch( uint32_t index )const
+  {
+     merkle_branch b;
+     b.mid_states.reserve( mtree.size() );
+     b.mid_states.push_back( get( index ) );
+     for( uint32_t layer = 0; layer + 1 < mtree.size(); ++layer )
+     {
+        const std::vector<uint160>& nodes = mtree[layer];
+        uint32_t sibling = index ^ 1;
+        b.mid_states.push_back( sibling < nodes.size() ? nodes[sibling] : uint160() );
+        if( index & 1 )
+        {
+           b.branch |= 1u << layer;
+        }
+        index /= 2;
+     }
+     return b;
   }
 
 } // namespace bts
@@ -1,77 +1,130 @@
 #include <bts/network/channel_pow_stats.hpp>
-#include <fc/crypto/bigint.hpp>
 
 namespace bts { namespace network {
 
-channel_pow_stats::channel_pow_stats()
-:target_bits_per_usec(0),avg_bits_per_usec(0)
+namespace detail
 {
-  // set the initial target as high as possible
-  memset( (char*)&target_pow, 0xff, sizeof(target_pow) );
+   /** @return the 128 bit product of a and b as hi:lo */
+   inline void mul_64( uint64_t a, uint64_t b, uint64_t& hi, uint64_t& lo )
+   {
+#ifdef __SIZEOF_INT128__
+      unsigned __int128 p = (unsigned __int128)a * b;
+      hi = uint64_t(p >> 64);
+      lo = uint64_t(p);
+#else
+      fc::uint128 p = fc::uint128(a) * fc::uint128(b);
+      hi = p.high_bits();
+      lo = p.low_bits();
+#endif
+   }
+
+   /**
+    *  @pre hi < d so that the quotient fits in 64 bits
+    *  @return hi:lo / d
+    */
+   inline uint64_t div_128_64( uint64_t hi, uint64_t lo, uint64_t d, uint64_t& rem )
+   {
+#ifdef __SIZEOF_INT128__
+      unsigned __int128 n = ((unsigned __int128)hi << 64) | lo;
+      rem = uint64_t(n % d);
+      return uint64_t(n / d);
+#else
+      fc::uint128 n( hi, lo );
+      fc::uint128 q = n / fc::uint128(d);
+      rem = (n - q * fc::uint128(d)).low_bits();
+      return q.low_bits();
+#endif
+   }
+
+   /**
+    *  Calculates floor(a*b/c) with a 192 bit intermediate product.
+    *
+    *  @pre c != 0
+    *  @return the result or the largest uint128 if it does not fit in 128 bits
+    */
+   fc::uint128 mul_div( const fc::uint128& a, uint64_t b, uint64_t c )
+   {
+      uint64_t lo_hi, lo_lo, hi_hi, hi_lo;
+      mul_64( a.low_bits(),  b, lo_hi, lo_lo );
+      mul_64( a.high_bits(), b, hi_hi, hi_lo );
+
+      uint64_t p1 = lo_hi + hi_lo;
+      uint64_t p2 = hi_hi + (p1 < lo_hi);
+      if( p2 >= c )
+      {
+         return fc::uint128( uint64_t(-1), uint64_t(-1) );
+      }
+
+      uint64_t rem;
+      uint64_t q1 = div_128_64( p2, p1,    c, rem );
+      uint64_t q0 = div_128_64( rem, lo_lo, c, rem );
+      return fc::uint128( q1, q0 );
+   }
 }
 
-/**
- *   TODO: unit test channel_pow_stats::update_pbs_avg
- */
-bool channel_pow_stats::update_bps_avg( uint64_t bytes_recv, const pow_hash& msg_pow )
+channel_pow_stats::channel_pow_stats( uint64_t target_bps )
+:target_pow( uint64_t(-1), uint64_t(-1) ), // set the initial target as high as possible
+ target_bits_per_sec(target_bps),
+ avg_bits_per_sec(0)
 {
-   // normalize the proof of work for the message size
-   fc::bigint msg( &msg_pow,     sizeof(msg_pow) );
-   msg *= ( (bytes_recv / 1024) + 1); // give the average work per kb
+}
+
+bool channel_pow_stats::update_bps_avg( uint64_t bytes_recv, const fc::uint128& msg_pow,
+                                        const fc::time_point& now )
+{
+   // normalize the proof of work for the message size, giving the work per kb
+   fc::uint128 msg = detail::mul_div( msg_pow, (bytes_recv / 1024) + 1, 1 );
+
+   // check the work against the current target, every message is worked into
+   // the averages so that the target follows the work actually being done
+   bool meets_target = !(target_pow < msg);
 
    // for the purposes of this calculation, there is no such thing as a message less than
    // 1 KB in size.
-   if( bytes_recv < 1024 ) bytes_recv = 1024; 
+   if( bytes_recv < 1024 ) bytes_recv = 1024;
 
-   // first check the work, if it is valid we can work it into our
-   // POW average, otherwise we will ignore it.
-   if( msg_pow > target_pow ) return false;
+   // the first message seeds the average rather than being weighted against 0
+   if( last_recv == fc::time_point() )
+   {
+      average_pow = msg;
+   }
 
    // how much time has elapsed since the last bytes that passed
-   auto ellapsed_us = (fc::time_point::now() - last_recv).count();
-   last_recv = fc::time_point::now();
+   int64_t ellapsed_us = (now - last_recv).count();
+   last_recv = now;
 
    // prevent long delays between message from biasing the average too much
-   // also protects against OS time changes 
-   if( ellapsed_us > BITCHAT_BANDWIDTH_WINDOW_US )
+   // also protects against OS time changes
+   if( ellapsed_us > BITCHAT_BANDWIDTH_WINDOW_US || ellapsed_us < 0 )
    {
      ellapsed_us = BITCHAT_BANDWIDTH_WINDOW_US/32;
    }
 
-   // calculate the weighted average for the bitrate
-   auto total = avg_bits_per_usec*BITCHAT_BANDWIDTH_WINDOW_US + (8 * bytes_recv * ellapsed_us);
-   avg_bits_per_usec = total / (BITCHAT_BANDWIDTH_WINDOW_US + ellapsed_us);
+   const uint64_t window = BITCHAT_BANDWIDTH_WINDOW_US;
+   const uint64_t total  = window + ellapsed_us;
+
+   // calculate the weighted average for the bitrate, the bytes received after
+   // ellapsed_us contribute a rate of 8*bytes_recv*1000000/ellapsed_us
+   fc::uint128 bps = detail::mul_div( fc::uint128(avg_bits_per_sec), window, total )
+                   + detail::mul_div( fc::uint128(bytes_recv), 8*1000000ull, total );
+   avg_bits_per_sec = bps.high_bits() ? uint64_t(-1) : bps.low_bits();
 
-   // use the same weighting factors to weight the update to the average POW
-   fc::bigint avg( &average_pow, sizeof(average_pow) );
-   fc::bigint wsum = (avg * BITCHAT_BANDWIDTH_WINDOW_US + msg*ellapsed_us) 
-                     / 
-                     (BITCHAT_BANDWIDTH_WINDOW_US+ellapsed_us);
+   // use the same weighting factors to weight the update to the average POW, the
+   // weights sum to 1 so the result cannot overflow
+   average_pow = detail::mul_div( average_pow, window, total )
+               + detail::mul_div( msg, ellapsed_us, total );
 
-   fc::bigint tar( &target_pow, sizeof(target_pow) );
-   if( avg_bits_per_usec >= target_bits_per_usec )
+   if( avg_bits_per_sec >= target_bits_per_sec )
    {
-      tar *= wsum * bigint( 990000ll);
-      tar /= bigint(1000000ll);
+      // decrease target (making it harder to get under)
+      target_pow = detail::mul_div( average_pow, 99, 100 );
    }
    else
    {
       // increase target (making it easier to get under)
-      tar =  wsum * bigint(1010000ll); 
-      tar /=        bigint(1000000ll);
+      target_pow = detail::mul_div( average_pow, 101, 100 );
    }
-
-   std::vector<char> tarw(tar);
-   std::vector<char> avgw(wsum);
-   target_pow = pow_hash();
-
-   memcpy( (char*)&target_pow + sizeof(pow_hash)-tarw.size(), 
-            tarw.data(), tarw.size() );
-   
-   memcpy( (char*)&average_pow + sizeof(pow_hash)-avgw.size(), 
-            avgw.data(), avgw.size() );
-
-   return true;
+   return meets_target;
 }
 
-} } 
+} }
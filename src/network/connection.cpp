@@ -9,10 +9,9 @@
 #include <fc/io/raw.hpp>
 #include <fc/log/logger.hpp>
 #include <fc/string.hpp>
-#include <fc/thread/mutex.hpp>
-#include <fc/thread/scoped_lock.hpp>
 
 #include <unordered_map>
+#include <deque>
 
 namespace bts { namespace network {
 
@@ -22,19 +21,61 @@ namespace bts { namespace network {
      {
         public:
           connection_impl(connection& s)
-          :self(s),con_del(nullptr){}
+          :self(s),con_del(nullptr),bytes_in(0),writing(false){}
           connection&          self;
           stcp_socket_ptr      sock;
           fc::ip::endpoint     remote_ep;
           connection_delegate* con_del;
+          uint64_t             bytes_in;
 
           std::unordered_map<uint64_t,channel_data_ptr> chan_data;
 
-          /** used to ensure that messages are written completely */
-          fc::mutex              write_lock;
+          struct queued_write
+          {
+             framed_message_ptr        msg;
+             fc::promise<void>::ptr    done;
+          };
+
+          /** messages are written one at a time in the order they were queued */
+          std::deque<queued_write>  write_queue;
+          bool                      writing;
+          fc::future<void>          write_loop_complete;
 
           fc::future<void>       read_loop_complete;
 
+          fc::future<void> queue_write( const framed_message_ptr& m )
+          {
+             queued_write w;
+             w.msg  = m;
+             w.done = fc::promise<void>::ptr( new fc::promise<void>( "connection::queue_write" ) );
+             write_queue.push_back( w );
+             if( !writing )
+             {
+                writing = true;
+                write_loop_complete = fc::async( [=](){ write_loop(); } );
+             }
+             return fc::future<void>( w.done );
+          }
+
+          void write_loop()
+          {
+             while( write_queue.size() )
+             {
+                queued_write w = write_queue.front();
+                write_queue.pop_front();
+                try {
+                   sock->write( w.msg->data(), w.msg->size() );
+                   sock->flush();
+                   w.done->set_value();
+                } 
+                catch ( const fc::exception& e )
+                {
+                   w.done->set_exception( e.dynamic_copy_exception() );
+                }
+             }
+             writing = false;
+          }
+
           void read_loop()
           {
             try {
@@ -50,6 +91,7 @@ namespace bts { namespace network {
 
                   try { // message handling errors are warnings... 
                     con_del->on_connection_message( self, m );
+                    bytes_in += 8 + m.size;
                   } 
                   catch ( fc::canceled_exception& e ) { throw; }
                   catch ( fc::eof_exception& e ) { throw; }
@@ -134,6 +176,10 @@ namespace bts { namespace network {
       {
         my->read_loop_complete.wait();
       }
+      if( my->write_loop_complete.valid() )
+      {
+        my->write_loop_complete.wait(); // the closed socket fails the remaining writes
+      }
     } 
     catch ( const fc::canceled_exception& e )
     {
@@ -148,6 +194,11 @@ namespace bts { namespace network {
       elog( "unhandled exception on close ${e}", ("e", fc::except_str()) );   
     }
   }
+  uint64_t connection::bytes_received()const
+  {
+     return my->bytes_in;
+  }
+
   stcp_socket_ptr connection::get_socket()const
   {
      return my->sock;
@@ -162,12 +213,12 @@ namespace bts { namespace network {
          }
      } FC_RETHROW_EXCEPTIONS( warn, "exception thrown while closing socket" );
   }
-  void connection::connect( const fc::ip::endpoint& ep )
+  void connection::connect( const fc::ip::endpoint& ep, fc::thread* crypto_thread )
   {
      try {
        // TODO: do we have to worry about multiple calls to connect?
        my->sock = std::make_shared<stcp_socket>();
-       my->sock->connect_to(ep); 
+       my->sock->connect_to( ep, crypto_thread ); 
        my->remote_ep = remote_endpoint();
        ilog( "    connected to ${ep}", ("ep", ep) );
        my->read_loop_complete = fc::async( [=](){ my->read_loop(); } );
@@ -194,20 +245,37 @@ namespace bts { namespace network {
       FC_THROW_EXCEPTION( exception, "unable to connect to ${host_port}", ("host_port",host_port) );
   }
 
-  void connection::send( const message& m )
+  framed_message_ptr connection::frame( const message& m )
   {
-    try {
-      fc::scoped_lock<fc::mutex> lock(my->write_lock);
       size_t len = 8 + m.size;
       len = 16*((len+15)/16);
-      std::vector<char> tmp(len);
-      memcpy( tmp.data(), (char*)&m, 8 );
-      memcpy( tmp.data() + 8, m.data.data(), m.size );
-      my->sock->write( tmp.data(), tmp.size() );
-      my->sock->flush();
+      auto framed = std::make_shared<std::vector<char> >(len);
+      memcpy( framed->data(), (char*)&m, 8 );
+      memcpy( framed->data() + 8, m.data.data(), m.size );
+      return framed;
+  }
+
+  void connection::send( const message& m )
+  {
+    try {
+      send_framed( frame(m) );
     } FC_RETHROW_EXCEPTIONS( warn, "unable to send message" );
   }
 
+  void connection::send_framed( const framed_message_ptr& m )
+  {
+    try {
+      queue_framed( m ).wait();
+    } FC_RETHROW_EXCEPTIONS( warn, "unable to send framed message" );
+  }
+
+  fc::future<void> connection::queue_framed( const framed_message_ptr& m )
+  {
+      FC_ASSERT( m && m->size() % 16 == 0 );
+      FC_ASSERT( !!my->sock, "not connected" );
+      return my->queue_write( m );
+  }
+
   void connection::set_channel_data( const channel_id& cid, const channel_data_ptr& d )
   {
      my->chan_data[cid.id()] = d;
@@ -229,5 +297,41 @@ namespace bts { namespace network {
   }
 
 
+  broadcast_status broadcast( const std::vector<connection_ptr>& cons, const message& m )
+  {
+     broadcast_status status;
+     if( cons.size() == 0 ) 
+     {
+        return status;
+     }
+
+     // serialize once, every connection shares the same plain text buffer and
+     // only the encryption is performed per connection.
+     auto framed = connection::frame( m );
+
+     status.reserve( cons.size() );
+     for( auto itr = cons.begin(); itr != cons.end(); ++itr )
+     {
+        connection_ptr con = *itr;
+        broadcast_delivery delivery;
+        delivery.con      = con;
+        // queue now so that the message keeps its place ahead of later sends to con
+        fc::future<void> written = con->queue_framed( framed );
+        delivery.complete = fc::async( [con,written]() mutable
+        {
+           try {
+              written.wait();
+           } 
+           catch ( const fc::exception& e )
+           {
+              wlog( "exception thrown while broadcasting to ${ep}\n${e}", 
+                    ("ep", con->remote_endpoint())("e", e.to_detail_string() ) );
+              throw;
+           }
+        } );
+        status.push_back( std::move(delivery) );
+     }
+     return status;
+  }
 
 } } // namespace bts::network
@@ -1,5 +1,6 @@
 #include <bts/network/server.hpp>
 #include <bts/network/connection.hpp>
+#include <bts/config.hpp>
 #include <fc/network/tcp_socket.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/thread/thread.hpp>
@@ -9,8 +10,10 @@
 
 
 #include <algorithm>
+#include <list>
 #include <unordered_map>
 #include <map>
+#include <set>
 
 namespace bts { namespace network {
 
@@ -20,8 +23,13 @@ namespace bts { namespace network {
      {
         public:
           server_impl()
-          :ser_del(nullptr)
-          {}
+          :ser_del(nullptr),next_handshake_thread(0)
+          {
+             for( uint32_t i = 0; i < HANDSHAKE_THREADS; ++i )
+             {
+                handshake_threads.push_back( std::make_shared<fc::thread>( "handshake" ) );
+             }
+          }
 
           ~server_impl()
           {
@@ -31,9 +39,9 @@ namespace bts { namespace network {
           {
               try 
               {
-                  for( auto i = pending_connections.begin(); i != pending_connections.end(); ++i )
+                  for( auto i = pending_handshakes.begin(); i != pending_handshakes.end(); ++i )
                   {
-                    (*i)->close();
+                    (*i)->get_socket().close();
                   }
                   tcp_serv.close();
                   if( accept_loop_complete.valid() )
@@ -41,6 +49,21 @@ namespace bts { namespace network {
                       accept_loop_complete.cancel();
                       accept_loop_complete.wait();
                   }
+                  for( auto itr = accept_tasks.begin(); itr != accept_tasks.end(); ++itr )
+                  {
+                      itr->cancel();
+                  }
+                  for( auto itr = accept_tasks.begin(); itr != accept_tasks.end(); ++itr )
+                  {
+                      try {
+                         itr->wait();
+                      } 
+                      catch ( const fc::canceled_exception& )
+                      {
+                         // canceled before it started
+                      }
+                  }
+                  accept_tasks.clear();
               } 
               catch ( const fc::canceled_exception& e )
               {
@@ -59,11 +82,30 @@ namespace bts { namespace network {
 
           std::unordered_map<fc::ip::endpoint,connection_ptr>         connections;
 
-          std::set<connection_ptr>                                    pending_connections;
+          /** inbound sockets that have not completed the key exchange */
+          std::set<stcp_socket_ptr>                                   pending_handshakes;
+          std::unordered_map<uint32_t,uint32_t>                       handshakes_per_ip;
+
+          /**
+           *  Token bucket per ip, tokens are refilled at INBOUND_ACCEPTS_PER_IP_PER_MIN and
+           *  each accepted socket consumes one.
+           */
+          struct ip_rate
+          {
+             double          tokens;
+             fc::time_point  updated;
+          };
+          std::unordered_map<uint32_t,ip_rate>                        ip_rates;
+
+          std::vector<std::shared_ptr<fc::thread>>                    handshake_threads;
+          uint32_t                                                    next_handshake_thread;
+
           server::config                                              cfg;
           fc::tcp_server                                              tcp_serv;
                                                                      
           fc::future<void>                                            accept_loop_complete;
+          /** the accept_connection() tasks started by accept_loop(), finished ones are pruned as new ones start */
+          std::list<fc::future<void>>                                 accept_tasks;
                                                                      
           std::unordered_map<uint32_t, channel_ptr>                   channels;
 
@@ -100,13 +142,32 @@ namespace bts { namespace network {
            *
            *  
            */
-          void accept_connection( const stcp_socket_ptr& s )
+          /** the handshake threads are used in turn for inbound and outbound connections */
+          fc::thread* get_handshake_thread()
+          {
+             return handshake_threads[next_handshake_thread++ % handshake_threads.size()].get();
+          }
+
+          void accept_connection( const stcp_socket_ptr& s, uint32_t ip )
           {
              try 
              {
-                // init DH handshake, TODO: this could yield.. what happens if we exit here before
-                // adding s to connections list.
-                s->accept();
+                fc::thread* crypto_thread = get_handshake_thread();
+                auto handshake = fc::async( [=](){ s->accept( crypto_thread ); } );
+                try 
+                {
+                   handshake.wait( fc::seconds( HANDSHAKE_TIMEOUT_SEC ) );
+                }
+                catch ( const fc::timeout_exception& e )
+                {
+                   // closing the socket wakes the pending read so the handshake task exits
+                   s->get_socket().close();
+                   end_handshake( s, ip );
+                   wlog( "handshake with ${ip} timed out", ("ip", fc::ip::address(ip)) );
+                   return;
+                }
+                end_handshake( s, ip );
+
                 ilog( "accepted connection from ${ep}", 
                       ("ep", std::string(s->get_socket().remote_endpoint()) ) );
                 
@@ -116,18 +177,91 @@ namespace bts { namespace network {
              } 
              catch ( const fc::canceled_exception& e )
              {
+                end_handshake( s, ip );
                 ilog( "canceled accept operation" );
              }
              catch ( const fc::exception& e )
              {
+                end_handshake( s, ip );
                 wlog( "error accepting connection: ${e}", ("e", e.to_detail_string() ) );
              }
              catch( ... )
              {
+                end_handshake( s, ip );
                 elog( "unexpected exception" );
              }
           }
 
+          void end_handshake( const stcp_socket_ptr& s, uint32_t ip )
+          {
+             if( pending_handshakes.erase( s ) )
+             {
+                auto itr = handshakes_per_ip.find( ip );
+                if( itr != handshakes_per_ip.end() && --itr->second == 0 )
+                {
+                   handshakes_per_ip.erase( itr );
+                }
+             }
+          }
+
+          /**
+           *  @return true if a handshake with ip may be started now, consumes one
+           *          token from the ip's rate limit.
+           */
+          bool admit_handshake( uint32_t ip )
+          {
+             if( pending_handshakes.size() >= HANDSHAKE_MAX_IN_PROGRESS )
+             {
+                return false;
+             }
+             auto in_progress = handshakes_per_ip.find( ip );
+             if( in_progress != handshakes_per_ip.end() && in_progress->second >= HANDSHAKE_MAX_PER_IP )
+             {
+                return false;
+             }
+
+             auto now = fc::time_point::now();
+             if( ip_rates.size() > 4*HANDSHAKE_MAX_IN_PROGRESS )
+             {
+                prune_ip_rates( now );
+             }
+
+             auto rate = ip_rates.find( ip );
+             if( rate == ip_rates.end() )
+             {
+                ip_rate r;
+                r.tokens  = INBOUND_ACCEPTS_PER_IP_PER_MIN;
+                r.updated = now;
+                rate = ip_rates.insert( std::make_pair( ip, r ) ).first;
+             }
+             double elapsed_min = (now - rate->second.updated).count() / 60000000.0;
+             rate->second.tokens  = std::min<double>( INBOUND_ACCEPTS_PER_IP_PER_MIN, 
+                                                     rate->second.tokens + elapsed_min * INBOUND_ACCEPTS_PER_IP_PER_MIN );
+             rate->second.updated = now;
+             if( rate->second.tokens < 1 )
+             {
+                return false;
+             }
+             rate->second.tokens -= 1;
+             return true;
+          }
+
+          /** forgets ips whose buckets would have refilled completely */
+          void prune_ip_rates( const fc::time_point& now )
+          {
+             for( auto itr = ip_rates.begin(); itr != ip_rates.end(); )
+             {
+                if( now - itr->second.updated > fc::seconds(60) )
+                {
+                   itr = ip_rates.erase( itr );
+                }
+                else
+                {
+                   ++itr;
+                }
+             }
+          }
+
           /**
            *  This method is called async 
            */
@@ -140,12 +274,29 @@ namespace bts { namespace network {
                    stcp_socket_ptr sock = std::make_shared<stcp_socket>();
                    tcp_serv.accept( sock->get_socket() );
 
-                   // do the acceptance process async
-                   fc::async( [=](){ accept_connection( sock ); } );
+                   // floods are refused here, before any work is spent on the handshake
+                   uint32_t ip = 0;
+                   try 
+                   {
+                      ip = sock->get_socket().remote_endpoint().get_address();
+                   }
+                   catch ( const fc::exception& e )
+                   {
+                      continue; // disconnected before we got to it
+                   }
+                   if( !admit_handshake( ip ) )
+                   {
+                      wlog( "refusing connection from ${ip}, too many handshakes", ("ip", fc::ip::address(ip)) );
+                      sock->get_socket().close();
+                      continue;
+                   }
+                   pending_handshakes.insert( sock );
+                   ++handshakes_per_ip[ip];
+
+                   accept_tasks.remove_if( []( const fc::future<void>& f ){ return f.ready(); } );
 
-                   // limit the rate at which we accept connections to prevent
-                   // DOS attacks.
-                   fc::usleep( fc::microseconds( 1000*10 ) );
+                   // do the acceptance process async
+                   accept_tasks.push_back( fc::async( [=](){ accept_connection( sock, ip ); } ) );
                 }
              } 
              catch ( fc::eof_exception& e )
@@ -218,19 +369,9 @@ namespace bts { namespace network {
       }
       return cons;
   }
-  void server::broadcast( const message& m )
+  broadcast_status server::broadcast( const message& m )
   {
-      for( auto itr = my->connections.begin(); itr != my->connections.end(); ++itr )
-      {
-        try {
-           itr->second->send(m);
-        } 
-        catch ( const fc::exception& e ) 
-        {
-           // TODO: propagate this exception back via the delegate or some other means... don't just fail
-           wlog( "exception thrown while broadcasting ${e}", ("e", e.to_detail_string() ) );
-        }
-      }
+      return network::broadcast( get_connections(), m );
   }
 
   connection_ptr server::connect_to( const fc::ip::endpoint& ep )
@@ -240,7 +381,8 @@ namespace bts { namespace network {
        ilog( "connect to ${ep}", ("ep",ep) );
        FC_ASSERT( my->ser_del != nullptr );
        connection_ptr con = std::make_shared<connection>( my.get() );
-       con->connect(ep);
+       // the ECDH math runs on a handshake thread so dialing does not stall this one
+       con->connect( ep, my->get_handshake_thread() );
        my->connections[con->remote_endpoint()] = con;
        my->ser_del->on_connected( con );
        return con;
@@ -6,6 +6,7 @@
 #include <fc/log/logger.hpp>
 #include <fc/network/ip.hpp>
 #include <fc/exception/exception.hpp>
+#include <fc/thread/thread.hpp>
 
 namespace bts { namespace network {
 
@@ -17,17 +18,31 @@ stcp_socket::~stcp_socket()
 {
 }
 
-void     stcp_socket::connect_to( const fc::ip::endpoint& ep )
+void     stcp_socket::connect_to( const fc::ip::endpoint& ep, fc::thread* crypto_thread )
 {
     _sock.connect_to( ep );
-    _priv_key = fc::ecc::private_key::generate();
+    key_exchange( crypto_thread );
+}
+
+/**
+ *  Exchanges public keys with the remote host and derives the AES keys from the
+ *  ECDH shared secret.  The elliptic curve math is the expensive part, so it may be 
+ *  moved to another thread while the socket IO remains on this one.
+ */
+void stcp_socket::key_exchange( fc::thread* crypto_thread )
+{
+    auto generate = []() { return fc::ecc::private_key::generate(); };
+    _priv_key = crypto_thread ? crypto_thread->async( generate ).wait() : generate();
+
     fc::ecc::public_key pub = _priv_key.get_public_key();
     auto s = pub.serialize();
     _sock.write( (char*)&s, sizeof(s) );
     fc::ecc::public_key_data rpub;
     _sock.read( (char*)&rpub, sizeof(rpub) );
 
-    auto shared_secret = _priv_key.get_shared_secret( rpub );
+    fc::ecc::private_key priv = _priv_key;
+    auto calc_secret = [=]() { return priv.get_shared_secret( fc::ecc::public_key(rpub) ); };
+    auto shared_secret = crypto_thread ? crypto_thread->async( calc_secret ).wait() : calc_secret();
 //    ilog("shared secret ${s}", ("s", shared_secret) );
     _send_aes.init( fc::sha256::hash( (char*)&shared_secret, sizeof(shared_secret) ), 
                     fc::city_hash_crc_128((char*)&shared_secret,sizeof(shared_secret) ) );
@@ -99,21 +114,9 @@ void     stcp_socket::close()
   }FC_RETHROW_EXCEPTIONS( warn, "error closing stcp socket" );
 }
 
-void    stcp_socket::accept()
+void    stcp_socket::accept( fc::thread* crypto_thread )
 {
-    _priv_key = fc::ecc::private_key::generate();
-    fc::ecc::public_key pub = _priv_key.get_public_key();
-    auto s = pub.serialize();
-    _sock.write( (char*)&s, sizeof(s) );
-    fc::ecc::public_key_data rpub;
-    _sock.read( (char*)&rpub, sizeof(rpub) );
-
-    auto shared_secret = _priv_key.get_shared_secret( fc::ecc::public_key(rpub) );
-//    ilog("shared secret ${s}", ("s", shared_secret) );
-    _send_aes.init( fc::sha256::hash( (char*)&shared_secret, sizeof(shared_secret) ), 
-                    fc::city_hash_crc_128((char*)&shared_secret,sizeof(shared_secret) ) );
-    _recv_aes.init( fc::sha256::hash( (char*)&shared_secret, sizeof(shared_secret) ), 
-                    fc::city_hash_crc_128((char*)&shared_secret,sizeof(shared_secret) ) );
+    key_exchange( crypto_thread );
 }
 
 
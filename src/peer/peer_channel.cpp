@@ -1,5 +1,8 @@
 #include <bts/peer/peer_messages.hpp>
 #include <bts/peer/peer_channel.hpp>
+#include <bts/peer/peer_db.hpp>
+#include <bts/config.hpp>
+#include <fc/filesystem.hpp>
 #include <fc/log/logger.hpp>
 #include <fc/reflect/variant.hpp>
 #include <unordered_map>
@@ -14,47 +17,61 @@ namespace bts { namespace peer {
       class peer_data : public channel_data
       {
          public:
-           peer_data():requested_hosts(false){}
+           peer_data():requested_hosts(false),outbound(false),connected_time( fc::time_point::now() ){}
            // data stored with the connection
            std::unordered_set<uint32_t> subscribed_channels;
            fc::ip::endpoint             public_contact; // used for reverse connection
            fc::optional<config_msg>     peer_config;
            bool                         requested_hosts;
+           bool                         outbound; // true if we initiated the connection
+           fc::time_point               connected_time;
+           fc::time_point               hosts_requested_time; // used to measure latency
       };
 
+      /**
+       *  The connections subscribed to a channel.  The list handed out by get_connections() 
+       *  is rebuilt only after a connection is added or removed.
+       */
       class channel_connection_index
       {
          public:
-             void add_connection( connection* c )
+             void add_connection( const connection_ptr& c )
              {
-                connections.push_back(c);
-
+                if( connections.insert( std::make_pair( c.get(), c ) ).second )
+                {
+                   snapshot.reset();
+                }
              }
              void remove_connection( connection* c )
              {
-                auto p = std::find( connections.begin(), connections.end(), c );
-                assert( p != connections.end() ); // invariant, crash in debug
-                if( p != connections.end() ) // don't crash in release
+                auto erased = connections.erase( c );
+                assert( erased != 0 ); // invariant, crash in debug
+                if( erased ) // don't crash in release
                 {
-                   connections.erase(p);
+                   snapshot.reset();
                 }
                 else
                 {
                    wlog("invariant not maintained" );
                 }
              }
-             std::vector<connection_ptr> get_connections()const
+             connection_list get_connections()const
              {
-                std::vector<connection_ptr> cons;
-                cons.reserve(connections.size());
-                for( auto itr = connections.begin(); itr != connections.end(); ++itr )
+                if( !snapshot )
                 {
-                  cons.push_back( (*itr)->shared_from_this() );
+                   auto cons = std::make_shared<std::vector<connection_ptr> >();
+                   cons->reserve( connections.size() );
+                   for( auto itr = connections.begin(); itr != connections.end(); ++itr )
+                   {
+                     cons->push_back( itr->second );
+                   }
+                   snapshot = cons;
                 }
-                return cons;
+                return connection_list( snapshot );
              }
          private:
-             std::vector<connection*> connections;
+             std::unordered_map<connection*,connection_ptr>                connections;
+             mutable std::shared_ptr<const std::vector<connection_ptr> >  snapshot;
       };
 
 
@@ -68,10 +85,12 @@ namespace bts { namespace peer {
            std::unordered_set<uint32_t>                           subscribed_channels;
 
            /**
-            *  Store all hosts we know about sorted by time since we last heard about them.
-            *  This list is provided to new nodes when they connect.  Limit to 1000 nodes.
+            *  Stores all hosts we know about indexed by the time since we last heard 
+            *  about them.  The most recent are provided to new nodes when they connect.
             */
-           std::vector<host>                                      recent_hosts;
+           peer_db                                                _peer_db;
+
+           fc::future<void>                                       _connect_complete;
 
 
            /**
@@ -85,35 +104,253 @@ namespace bts { namespace peer {
                 return false;
               }
 
-              fc::time_point expire_time = fc::time_point::now() - fc::seconds(60*60*3);
+              fc::time_point expire_time = fc::time_point::now() - fc::seconds(PEER_HOST_EXPIRE_SEC);
 
               if(  h.last_com < expire_time )
               {
                 return false; // too old
               }
 
-              /** remove any expired hosts while we are at it */
-              for( auto itr = recent_hosts.begin(); itr != recent_hosts.end();  )
+              try {
+                 host known = _peer_db.fetch_record( h.ep );
+                 if( known.last_com < h.last_com )
+                 {
+                    known.last_com = h.last_com;
+                    _peer_db.store( known );
+                 }
+                 return false;
+              } 
+              catch ( const fc::key_not_found_exception& )
               {
-                  if( itr->ep == h.ep )
-                  {
-                      if( itr->last_com < h.last_com )
-                      {
-                         itr->last_com = h.last_com;
-                      }
-                      return false; 
-                  }
-                  if( itr->last_com < expire_time )
-                  {
-                    itr = recent_hosts.erase(itr);      
-                  }
-                  else
-                  {
-                    ++itr;
-                  }
               }
-              if( recent_hosts.size() >= 1000 ) return false;
-              recent_hosts.push_back(h);
+              if( _peer_db.size() >= PEER_DB_MAX_HOSTS ) return false;
+              _peer_db.store(h);
+              return true;
+           }
+
+           /**
+            *  The address stats are recorded under, the address the peer told us it 
+            *  accepts connections on if known, otherwise the address we connected to.
+            */
+           fc::ip::endpoint contact_endpoint( const connection_ptr& c, const peer_data& pd )
+           {
+              if( pd.public_contact != fc::ip::endpoint() )
+              {
+                 return pd.public_contact;
+              }
+              return c->remote_endpoint();
+           }
+
+           /**
+            *  Applies f to the stats of the host c is connected to, unless that host 
+            *  is not in the database.
+            */
+           template<typename Functor>
+           void update_stats( const fc::ip::endpoint& ep, Functor&& f )
+           {
+              try {
+                 host_stats s = _peer_db.fetch_stats( ep );
+                 f(s);
+                 _peer_db.update_stats( ep, s );
+              } 
+              catch ( const fc::key_not_found_exception& )
+              {
+              }
+           }
+
+           peer_data* get_peer_data( const connection_ptr& c )
+           {
+              auto pd = c->get_channel_data( channel_id(peer_proto) );
+              return pd ? &pd->as<peer_data>() : nullptr;
+           }
+
+           /**
+            *  Every PEER_CONNECT_INTERVAL_SEC makes sure that each subscribed channel has
+            *  DESIRED_PEER_COUNT outbound connections.
+            */
+           void connect_loop()
+           {
+              while( !_connect_complete.canceled() )
+              {
+                 try {
+                    maintain_connections();
+                 }
+                 catch ( const fc::canceled_exception& )
+                 {
+                    throw;
+                 }
+                 catch ( const fc::exception& e )
+                 {
+                    wlog( "error maintaining connections\n${e}", ("e", e.to_detail_string() ) );
+                 }
+                 fc::usleep( fc::seconds( PEER_CONNECT_INTERVAL_SEC ) );
+              }
+           }
+
+           /**
+            *  Dials the best known candidates for every channel that lacks outbound connections,
+            *  up to PEER_MAX_PARALLEL_DIALS at once, and replaces the least useful peer of a channel
+            *  that already has enough.
+            */
+           void maintain_connections()
+           {
+              std::unordered_set<fc::ip::endpoint> connected;
+              auto all = netw->get_connections();
+              for( auto c = all.begin(); c != all.end(); ++c )
+              {
+                 connected.insert( (*c)->remote_endpoint() );
+                 auto pd = get_peer_data( *c );
+                 if( pd && pd->public_contact != fc::ip::endpoint() )
+                 {
+                    connected.insert( pd->public_contact );
+                 }
+              }
+
+              std::vector<host>             best;
+              std::vector<fc::ip::endpoint> to_dial;
+              bool                          replaced = false;
+              for( auto chan = subscribed_channels.begin(); chan != subscribed_channels.end(); ++chan )
+              {
+                 connection_list cons = cons_by_channel[*chan].get_connections();
+                 uint32_t outbound = 0;
+                 for( auto c = cons.begin(); c != cons.end(); ++c )
+                 {
+                    auto pd = get_peer_data( *c );
+                    outbound += pd && pd->outbound;
+                 }
+                 if( outbound >= DESIRED_PEER_COUNT )
+                 {
+                    if( !replaced )
+                    {
+                       replaced = replace_least_useful( cons );
+                    }
+                    continue;
+                 }
+
+                 // prefer the best hosts on this channel, then the most recent on this channel, then anyone
+                 if( best.empty() )
+                 {
+                    best = _peer_db.fetch_best_hosts( DESIRED_PEER_COUNT * 8 );
+                 }
+                 std::vector<host> candidates;
+                 for( auto h = best.begin(); h != best.end(); ++h )
+                 {
+                    if( std::find( h->channels.begin(), h->channels.end(), channel_id(*chan) ) != h->channels.end() )
+                    {
+                       candidates.push_back( *h );
+                    }
+                 }
+                 auto recent = _peer_db.fetch_hosts( channel_id(*chan), DESIRED_PEER_COUNT * 4 );
+                 candidates.insert( candidates.end(), recent.begin(), recent.end() );
+                 candidates.insert( candidates.end(), best.begin(), best.end() );
+
+                 uint32_t needed = DESIRED_PEER_COUNT - outbound;
+                 for( auto h = candidates.begin(); h != candidates.end() && needed > 0 && 
+                                                   to_dial.size() < PEER_MAX_PARALLEL_DIALS; ++h )
+                 {
+                    if( connected.insert( h->ep ).second )
+                    {
+                       to_dial.push_back( h->ep );
+                       --needed;
+                    }
+                 }
+              }
+              dial( to_dial );
+           }
+
+           /**
+            *  Connects to all endpoints concurrently, giving up on those that have not 
+            *  connected within PEER_CONNECT_TIMEOUT_SEC.
+            */
+           void dial( const std::vector<fc::ip::endpoint>& eps )
+           {
+              std::vector< fc::future<connection_ptr> > attempts;
+              attempts.reserve( eps.size() );
+              auto n = netw;
+              for( auto ep = eps.begin(); ep != eps.end(); ++ep )
+              {
+                 auto e = *ep;
+                 attempts.push_back( fc::async( [=](){ return n->connect_to( e ); } ) );
+              }
+
+              auto deadline = fc::time_point::now() + fc::seconds( PEER_CONNECT_TIMEOUT_SEC );
+              for( uint32_t i = 0; i < attempts.size(); ++i )
+              {
+                 try {
+                    connection_ptr con = attempts[i].wait_until( deadline );
+                    auto pd = get_peer_data( con );
+                    if( pd ) 
+                    {
+                       pd->outbound = true;
+                    }
+                 } 
+                 catch ( const fc::canceled_exception& )
+                 {
+                    for( uint32_t j = i; j < attempts.size(); ++j )
+                    {
+                       attempts[j].cancel();
+                    }
+                    throw;
+                 }
+                 catch ( const fc::exception& e )
+                 {
+                    wlog( "unable to connect to ${ep}: ${e}", ("ep",eps[i])("e",e.to_string()) );
+                    attempts[i].cancel();
+                    update_stats( eps[i], []( host_stats& s ){ ++s.failures; } );
+
+                    // the attempt may still complete, close it rather than keep a connection
+                    // that is not counted as outbound
+                    auto late = attempts[i];
+                    fc::async( [late]() mutable { 
+                       try { 
+                          late.wait()->close(); 
+                       } 
+                       catch ( const fc::exception& ) 
+                       {
+                          // it failed or was canceled, nothing to close
+                       }
+                    } );
+                 }
+              }
+           }
+
+           /**
+            *  Disconnects the outbound connection in cons with the lowest throughput if it has been
+            *  connected long enough to judge and delivers far less than the average, its slot is 
+            *  filled by the next call to maintain_connections().
+            *
+            *  @return true if a connection was closed
+            */
+           bool replace_least_useful( const connection_list& cons )
+           {
+              auto now = fc::time_point::now();
+              connection_ptr worst;
+              uint64_t       worst_bps = 0;
+              uint64_t       total_bps = 0;
+              uint32_t       count     = 0;
+              for( auto c = cons.begin(); c != cons.end(); ++c )
+              {
+                 auto pd = get_peer_data( *c );
+                 if( !pd || !pd->outbound ) continue;
+
+                 int64_t age_sec = (now - pd->connected_time).count() / 1000000;
+                 if( age_sec < PEER_EVAL_PERIOD_SEC ) continue;
+
+                 uint64_t bps = (*c)->bytes_received() / age_sec;
+                 total_bps += bps;
+                 ++count;
+                 if( !worst || bps < worst_bps )
+                 {
+                    worst     = *c;
+                    worst_bps = bps;
+                 }
+              }
+              if( count < 2 || worst_bps * 100 >= (total_bps / count) * PEER_REPLACE_THROUGHPUT_PCT )
+              {
+                 return false;
+              }
+              ilog( "replacing slow peer ${ep} ${bps} bytes/sec", ("ep",worst->remote_endpoint())("bps",worst_bps) );
+              worst->close();
               return true;
            }
            
@@ -132,6 +369,15 @@ namespace bts { namespace peer {
                {
                   cons_by_channel[*itr].remove_connection(c.get());
                }
+
+               uint64_t uptime = (fc::time_point::now() - pd.connected_time).count() / 1000000;
+               uint64_t bytes  = c->bytes_received();
+               update_stats( contact_endpoint( c, pd ), [=]( host_stats& s )
+               {
+                  s.uptime_sec   += uptime;
+                  s.useful_bytes += bytes;
+                  s.failures      = 0;
+               } );
            }
            
            virtual void handle_subscribe( const connection_ptr& c )
@@ -171,11 +417,13 @@ namespace bts { namespace peer {
            void handle_config( const connection_ptr& c, config_msg cfg  )
            {
                peer_data& pd = c->get_channel_data( channel_id(peer_proto) )->as<peer_data>(); 
+               pd.public_contact = cfg.public_contact;
                pd.peer_config = std::move(cfg);
 
-               if( recent_hosts.size() < PEER_HOST_CACHE_QUERY_LIMIT )
+               if( _peer_db.size() < PEER_HOST_CACHE_QUERY_LIMIT )
                {
                   pd.requested_hosts = true;
+                  pd.hosts_requested_time = fc::time_point::now();
                   c->send( message( get_known_hosts_msg(), channel_id(peer_proto) ) );
                }
            }
@@ -184,6 +432,16 @@ namespace bts { namespace peer {
            {
                peer_data& pd = c->get_channel_data( channel_id(peer_proto) )->as<peer_data>(); 
 
+               if( pd.requested_hosts )
+               {
+                  uint32_t latency_ms = (fc::time_point::now() - pd.hosts_requested_time).count() / 1000;
+                  update_stats( contact_endpoint( c, pd ), [=]( host_stats& s )
+                  {
+                     s.avg_latency_ms = s.avg_latency_ms ? (s.avg_latency_ms * 3 + latency_ms) / 4 : latency_ms;
+                  } );
+               }
+               _peer_db.purge_old( fc::time_point::now() - fc::seconds( PEER_HOST_EXPIRE_SEC ) );
+
                std::vector<host> new_hosts;
                for( auto itr = m.hosts.begin(); itr != m.hosts.end(); ++itr )
                {
@@ -232,7 +490,7 @@ namespace bts { namespace peer {
                    {
                       // TODO: validate ID is an acceptable / supported channel to prevent
                       // remote hosts from sending us a ton of bogus channels
-                      cons_by_channel[itr->id()].add_connection(c.get());
+                      cons_by_channel[itr->id()].add_connection(c);
 
                       auto chan_ptr = netw->get_channel( channel_id(itr->id()) );
                       if( chan_ptr != nullptr )
@@ -276,7 +534,8 @@ namespace bts { namespace peer {
 
            void handle_get_known_hosts( const connection_ptr& c, const get_known_hosts_msg& h )
            {
-              c->send( message( known_hosts_msg( recent_hosts), channel_id(peer_proto) ) );
+              c->send( message( known_hosts_msg( _peer_db.fetch_recent_hosts( PEER_HOST_CACHE_QUERY_LIMIT ) ), 
+                                channel_id(peer_proto) ) );
            }
 
            void handle_error_report( const connection_ptr& c, const error_report_msg& m)
@@ -299,6 +558,35 @@ namespace bts { namespace peer {
    peer_channel::~peer_channel()
    {
       my->netw->unsubscribe_from_channel( channel_id(peer_proto) );
+      try {
+         if( my->_connect_complete.valid() )
+         {
+            my->_connect_complete.cancel();
+            my->_connect_complete.wait();
+         }
+      } 
+      catch ( const fc::canceled_exception& )
+      {} // expected
+      catch ( const fc::exception& e )
+      {
+         wlog( "unexpected exception\n ${e}", ("e", e.to_detail_string() ) );
+      }
+   }
+
+   void peer_channel::open( const fc::path& peer_db_dir )
+   { try {
+      my->_peer_db.open( peer_db_dir );
+
+      // everything we know is out of date until we hear about it again
+      my->_peer_db.reset_ages( fc::time_point::now() - fc::seconds( PEER_HOST_EXPIRE_SEC / 3 ) );
+
+      auto self = my;
+      my->_connect_complete = fc::async( [=](){ self->connect_loop(); } );
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("dir",peer_db_dir) ) }
+
+   std::vector<host> peer_channel::get_known_hosts()const
+   {
+      return my->_peer_db.fetch_recent_hosts( PEER_HOST_CACHE_QUERY_LIMIT );
    }
 
    void peer_channel::subscribe_to_channel( const channel_id& chan, const channel_ptr& c )
@@ -324,17 +612,14 @@ namespace bts { namespace peer {
    }
 
 
-   std::vector<network::connection_ptr> peer_channel::get_connections( const network::channel_id& chan )
+   connection_list peer_channel::get_connections( const network::channel_id& chan )
    {
-      std::vector<network::connection_ptr> cons;
-
       auto itr = my->cons_by_channel.find( chan.id() );
       if( itr != my->cons_by_channel.end() )
       {
          return itr->second.get_connections(); 
       }
-      wlog( "no connections for channel ${chan}", ("chan",chan) );
-      return cons;
+      return connection_list();
    }
 
 
@@ -1,29 +1,235 @@
 #include <bts/peer/peer_db.hpp>
+#include <bts/config.hpp>
+#include <bts/db/level_map.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/optional.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace bts { namespace peer {
+
+  namespace detail
+  {
+    inline bool endpoint_less( const fc::ip::endpoint& a, const fc::ip::endpoint& b )
+    {
+       uint32_t aa = a.get_address();
+       uint32_t ba = b.get_address();
+       return aa == ba ? a.port() < b.port() : aa < ba;
+    }
+
+    struct endpoint_key
+    {
+       endpoint_key(){}
+       endpoint_key( const fc::ip::endpoint& e ):ep(e){}
+
+       fc::ip::endpoint ep;
+
+       friend bool operator < ( const endpoint_key& a, const endpoint_key& b ) { return endpoint_less( a.ep, b.ep ); }
+       friend bool operator == ( const endpoint_key& a, const endpoint_key& b ) { return a.ep == b.ep; }
+    };
+
+    /** orders hosts from the oldest to the most recent last_com */
+    struct time_key
+    {
+       time_key():last_com(0){}
+       time_key( uint32_t t, const fc::ip::endpoint& e ):last_com(t),ep(e){}
+
+       uint32_t          last_com;
+       fc::ip::endpoint  ep;
+
+       friend bool operator < ( const time_key& a, const time_key& b )
+       {
+          return a.last_com == b.last_com ? endpoint_less( a.ep, b.ep ) : a.last_com < b.last_com;
+       }
+       friend bool operator == ( const time_key& a, const time_key& b )
+       {
+          return a.last_com == b.last_com && a.ep == b.ep;
+       }
+    };
+
+    /** groups hosts by channel, the most recent last_com first */
+    struct channel_key
+    {
+       channel_key():chan(0),age(0){}
+       channel_key( uint32_t c, uint32_t last_com, const fc::ip::endpoint& e )
+       :chan(c),age( std::numeric_limits<uint32_t>::max() - last_com ),ep(e){}
+
+       uint32_t          chan;
+       uint32_t          age;
+       fc::ip::endpoint  ep;
+
+       friend bool operator < ( const channel_key& a, const channel_key& b )
+       {
+          if( a.chan != b.chan ) return a.chan < b.chan;
+          if( a.age  != b.age  ) return a.age  < b.age;
+          return endpoint_less( a.ep, b.ep );
+       }
+       friend bool operator == ( const channel_key& a, const channel_key& b )
+       {
+          return a.chan == b.chan && a.age == b.age && a.ep == b.ep;
+       }
+    };
+
+    /** orders hosts from the highest to the lowest score, the most recent last_com first */
+    struct score_key
+    {
+       score_key():score(0),age(0){}
+       score_key( int64_t s, uint32_t last_com, const fc::ip::endpoint& e )
+       :score(s),age( std::numeric_limits<uint32_t>::max() - last_com ),ep(e){}
+
+       int64_t           score;
+       uint32_t          age;
+       fc::ip::endpoint  ep;
+
+       friend bool operator < ( const score_key& a, const score_key& b )
+       {
+          if( a.score != b.score ) return a.score > b.score;
+          if( a.age   != b.age   ) return a.age   < b.age;
+          return endpoint_less( a.ep, b.ep );
+       }
+       friend bool operator == ( const score_key& a, const score_key& b )
+       {
+          return a.score == b.score && a.age == b.age && a.ep == b.ep;
+       }
+    };
+
+    struct host_record
+    {
+       host        info;
+       host_stats  stats;
+    };
+
+} } } // bts::peer::detail
+
+FC_REFLECT( bts::peer::detail::endpoint_key, (ep) )
+FC_REFLECT( bts::peer::detail::time_key, (last_com)(ep) )
+FC_REFLECT( bts::peer::detail::channel_key, (chan)(age)(ep) )
+FC_REFLECT( bts::peer::detail::score_key, (score)(age)(ep) )
+FC_REFLECT( bts::peer::detail::host_record, (info)(stats) )
 
 namespace bts { namespace peer {
 
-  namespace detail 
+  host::host( const fc::ip::endpoint& e, const network::channel_id& c, const fc::time_point_sec& t )
+  :ep(e),last_com(t),first_com(t),channels(1,c){}
+
+  int64_t host_stats::score()const
+  {
+     int64_t s = uptime_sec / 60 + useful_bytes / (64*1024);
+     s -= avg_latency_ms / 50;
+     s -= int64_t(failures) * 30;
+     return s;
+  }
+
+  namespace detail
   {
     class peer_db_impl
     {
       public:
+        peer_db_impl():_size(0){}
+
+        db::level_map<endpoint_key,host_record>  _hosts;
+        db::level_map<time_key,uint8_t>          _by_time;
+        db::level_map<channel_key,uint8_t>       _by_channel;
+        db::level_map<score_key,uint8_t>         _by_score;
+        uint32_t                                 _size;
+
+        static score_key make_score_key( const host_record& rec )
+        {
+           return score_key( rec.stats.score(), rec.info.last_com.sec_since_epoch(), rec.info.ep );
+        }
+
+        void index( const host_record& rec )
+        {
+           const host& h = rec.info;
+           _by_score.store( make_score_key( rec ), 0 );
+           _by_time.store( time_key( h.last_com.sec_since_epoch(), h.ep ), 0 );
+           for( auto c = h.channels.begin(); c != h.channels.end(); ++c )
+           {
+              _by_channel.store( channel_key( c->id(), h.last_com.sec_since_epoch(), h.ep ), 0 );
+           }
+        }
+
+        void unindex( const host_record& rec )
+        {
+           const host& h = rec.info;
+           _by_score.remove( make_score_key( rec ) );
+           _by_time.remove( time_key( h.last_com.sec_since_epoch(), h.ep ) );
+           for( auto c = h.channels.begin(); c != h.channels.end(); ++c )
+           {
+              _by_channel.remove( channel_key( c->id(), h.last_com.sec_since_epoch(), h.ep ) );
+           }
+        }
 
+        fc::optional<host_record> find( const fc::ip::endpoint& ep )
+        {
+           auto itr = _hosts.find( endpoint_key(ep) );
+           if( itr.valid() )
+           {
+              return itr.value();
+           }
+           return fc::optional<host_record>();
+        }
+
+        /** replaces the indexed record old_rec with rec */
+        void update( const fc::optional<host_record>& old_rec, const host_record& rec )
+        {
+           if( old_rec )
+           {
+              unindex( *old_rec );
+           }
+           else
+           {
+              ++_size;
+           }
+           _hosts.store( endpoint_key( rec.info.ep ), rec );
+           index( rec );
+        }
     };
 
   }
-  
+
   peer_db::peer_db()
   :my( new detail::peer_db_impl() )
   {
   }
 
-
   peer_db::~peer_db(){}
+
   void peer_db::open( const fc::path& dbdir, bool create )
-  {
-  }
+  { try {
+     if( create )
+     {
+        fc::create_directories( dbdir );
+     }
+     my->_hosts.open( dbdir / "hosts", create );
+     my->_by_time.open( dbdir / "by_time", create );
+     my->_by_channel.open( dbdir / "by_channel", create );
+     my->_by_score.open( dbdir / "by_score", create );
+
+     my->_size = 0;
+     for( auto itr = my->_by_time.begin(); itr.valid(); ++itr )
+     {
+        ++my->_size;
+     }
+
+     // databases written before the score index existed have to build it
+     if( my->_size && !my->_by_score.begin().valid() )
+     {
+        for( auto itr = my->_hosts.begin(); itr.valid(); ++itr )
+        {
+           my->_by_score.store( my->make_score_key( itr.value() ), 0 );
+        }
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("dir",dbdir) ) }
+
   void peer_db::close()
   {
+     my->_hosts.close();
+     my->_by_time.close();
+     my->_by_channel.close();
+     my->_by_score.close();
   }
 
   /**
@@ -31,47 +237,174 @@ namespace bts { namespace peer {
    *  all hosts should be reset to 1 hour old so they can expire if we have
    *  not heard about them in 2 hours.
    */
-  void                peer_db::reset_ages( const fc::time_point_sec& s )
-  {
-  }
+  void peer_db::reset_ages( const fc::time_point_sec& s )
+  { try {
+     // hosts newer than s are at the end of the time index
+     std::vector<fc::ip::endpoint> newer;
+     for( auto itr = my->_by_time.lower_bound( detail::time_key( s.sec_since_epoch() + 1, fc::ip::endpoint() ) );
+          itr.valid(); ++itr )
+     {
+        newer.push_back( itr.key().ep );
+     }
+     for( auto itr = newer.begin(); itr != newer.end(); ++itr )
+     {
+        auto old_rec = my->find( *itr );
+        FC_ASSERT( !!old_rec );
+        detail::host_record rec = *old_rec;
+        rec.info.last_com = s;
+        my->update( old_rec, rec );
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("time",s) ) }
 
-  void                peer_db::store( const host& r )
-  {
-  }
+  void peer_db::store( const host& r )
+  { try {
+     auto old_rec = my->find( r.ep );
+     detail::host_record rec;
+     if( old_rec )
+     {
+        rec = *old_rec;
+     }
+     else
+     {
+        rec.info.first_com = r.first_com == fc::time_point_sec() ? r.last_com : r.first_com;
+     }
+     rec.info.ep       = r.ep;
+     rec.info.last_com = std::max( rec.info.last_com, r.last_com );
+     // a host announced on one channel is still subscribed to the channels we already know of,
+     // remove_channel() is used to forget one
+     for( auto c = r.channels.begin(); c != r.channels.end() && rec.info.channels.size() < MAX_CHANNELS_PER_CONNECTION; ++c )
+     {
+        if( std::find( rec.info.channels.begin(), rec.info.channels.end(), *c ) == rec.info.channels.end() )
+        {
+           rec.info.channels.push_back( *c );
+        }
+     }
+     rec.info.features = r.features;
+     my->update( old_rec, rec );
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("host",r) ) }
 
-  host                peer_db::fetch_record( const fc::ip::endpoint& ep )
-  {
-    return host();
-  }
+  host peer_db::fetch_record( const fc::ip::endpoint& ep )
+  { try {
+     return my->_hosts.fetch( detail::endpoint_key(ep) ).info;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("ep",ep) ) }
 
-  /**  Removes a host from the DB, presumably because we attempted to connect 
-   * to it and were unable to.  
+  /**  Removes a host from the DB, presumably because we attempted to connect
+   * to it and were unable to.
    *
    *   TODO: how do we prevent purging the entire DB if the internet goes down
    *   and no hosts are reachable?   Perhaps only perge nodes if we are successfully
    *   connected to other nodes.
    */
-  void                peer_db::remove( const fc::ip::endpoint& ep )
-  {
-  }
+  void peer_db::remove( const fc::ip::endpoint& ep )
+  { try {
+     auto old_rec = my->find( ep );
+     if( old_rec )
+     {
+        my->unindex( *old_rec );
+        my->_hosts.remove( detail::endpoint_key(ep) );
+        --my->_size;
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("ep",ep) ) }
 
-  void                peer_db::add_channel( const fc::ip::endpoint& e, const channel_id& c )
-  {
-  }
+  void peer_db::add_channel( const fc::ip::endpoint& e, const channel_id& c )
+  { try {
+     auto old_rec = my->find( e );
+     FC_ASSERT( !!old_rec, "unknown host" );
+     auto& chans = old_rec->info.channels;
+     if( std::find( chans.begin(), chans.end(), c ) == chans.end() )
+     {
+        detail::host_record rec = *old_rec;
+        rec.info.channels.push_back( c );
+        my->update( old_rec, rec );
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("ep",e)("channel",c) ) }
 
-  void                peer_db::remove_channel( const fc::ip::endpoint& e, const channel_id& c )
-  {
-  }
+  void peer_db::remove_channel( const fc::ip::endpoint& e, const channel_id& c )
+  { try {
+     auto old_rec = my->find( e );
+     FC_ASSERT( !!old_rec, "unknown host" );
+     detail::host_record rec = *old_rec;
+     auto itr = std::find( rec.info.channels.begin(), rec.info.channels.end(), c );
+     if( itr != rec.info.channels.end() )
+     {
+        rec.info.channels.erase( itr );
+        my->update( old_rec, rec );
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("ep",e)("channel",c) ) }
 
+  std::vector<host> peer_db::fetch_hosts( const channel_id& c, uint32_t limit )
+  { try {
+     std::vector<host> hosts;
+     for( auto itr = my->_by_channel.lower_bound( detail::channel_key( c.id(), std::numeric_limits<uint32_t>::max(), fc::ip::endpoint() ) );
+          itr.valid() && hosts.size() < limit; ++itr )
+     {
+        auto key = itr.key();
+        if( key.chan != c.id() )
+        {
+           break;
+        }
+        hosts.push_back( fetch_record( key.ep ) );
+     }
+     return hosts;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("channel",c)("limit",limit) ) }
 
-  std::vector<host>   peer_db::fetch_hosts( const channel_id& c )
-  {
-    return std::vector<host>();
-  }
+  std::vector<host> peer_db::fetch_recent_hosts( uint32_t limit )
+  { try {
+     std::vector<host> hosts;
+     for( auto itr = my->_by_time.last(); itr.valid() && hosts.size() < limit; --itr )
+     {
+        hosts.push_back( fetch_record( itr.key().ep ) );
+     }
+     return hosts;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("limit",limit) ) }
+
+  std::vector<host> peer_db::fetch_best_hosts( uint32_t limit )
+  { try {
+     std::vector<host> hosts;
+     for( auto itr = my->_by_score.begin(); itr.valid() && hosts.size() < limit; ++itr )
+     {
+        hosts.push_back( fetch_record( itr.key().ep ) );
+     }
+     return hosts;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("limit",limit) ) }
 
-  void                peer_db::purge_old( const fc::time_point& age )
+  host_stats peer_db::fetch_stats( const fc::ip::endpoint& ep )
+  { try {
+     return my->_hosts.fetch( detail::endpoint_key(ep) ).stats;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("ep",ep) ) }
+
+  void peer_db::update_stats( const fc::ip::endpoint& ep, const host_stats& s )
+  { try {
+     auto old_rec = my->_hosts.fetch( detail::endpoint_key(ep) );
+     detail::host_record rec = old_rec;
+     rec.stats = s;
+     my->_by_score.remove( my->make_score_key( old_rec ) );
+     my->_by_score.store( my->make_score_key( rec ), 0 );
+     my->_hosts.store( detail::endpoint_key(ep), rec ); // the other indexes are unchanged
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("ep",ep)("stats",s) ) }
+
+  void peer_db::purge_old( const fc::time_point& age )
+  { try {
+     uint32_t oldest_allowed = fc::time_point_sec( age ).sec_since_epoch();
+     std::vector<fc::ip::endpoint> expired;
+     for( auto itr = my->_by_time.begin(); itr.valid(); ++itr )
+     {
+        auto key = itr.key();
+        if( key.last_com >= oldest_allowed )
+        {
+           break;
+        }
+        expired.push_back( key.ep );
+     }
+     for( auto itr = expired.begin(); itr != expired.end(); ++itr )
+     {
+        remove( *itr );
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("age",age) ) }
+
+  uint32_t peer_db::size()const
   {
+     return my->_size;
   }
 
-
 } }
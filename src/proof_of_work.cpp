@@ -1,34 +1,160 @@
 #include <bts/proof_of_work.hpp>
+#include <bts/config.hpp>
 #include <fc/crypto/sha512.hpp>
 #include <fc/crypto/sha256.hpp>
 #include <fc/crypto/aes.hpp>
 #include <fc/crypto/salsa20.hpp>
 #include <fc/crypto/city.hpp>
+#include <fc/thread/thread.hpp>
+#include <fc/exception/exception.hpp>
 #include <string.h>
 
 #include <fc/io/raw.hpp>
 #include <fc/crypto/ripemd160.hpp>
+#include <atomic>
 #include <utility>
+#include <thread>
 #include <fc/log/logger.hpp>
 
-#define BUF_SIZE (8*1024*1024)
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#define BUF_SIZE (bts::pow_buffer_size)
 #define BLOCK_SIZE (32) // bytes
 
 namespace bts  {
 
-pow_hash proof_of_work( const fc::sha256& in)
+/**
+ *  Maps the buffer with huge pages if possible, falling back to normal pages and
+ *  then to the heap.
+ */
+pow_buffer::pow_buffer()
+:_data(nullptr),_mapped(false)
+{
+#ifndef WIN32
+   void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+   p = mmap( nullptr, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+#endif
+   if( p == MAP_FAILED )
+   {
+      p = mmap( nullptr, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+#ifdef MADV_HUGEPAGE
+      if( p != MAP_FAILED )
+      {
+         madvise( p, BUF_SIZE, MADV_HUGEPAGE );
+      }
+#endif
+   }
+   if( p != MAP_FAILED )
+   {
+      _data   = (unsigned char*)p;
+      _mapped = true;
+      return;
+   }
+#endif
+   _data = new unsigned char[BUF_SIZE];
+}
+
+pow_buffer::~pow_buffer()
+{
+#ifndef WIN32
+   if( _mapped )
+   {
+      munmap( _data, BUF_SIZE );
+      return;
+   }
+#endif
+   delete[] _data;
+}
+
+namespace detail
+{
+   struct pow_worker
+   {
+      pow_worker( const std::string& name )
+      :thread(name){}
+
+      fc::thread      thread;
+      pow_buffer      buffer;
+   };
+
+   class pow_engine_impl
+   {
+      public:
+        pow_engine_impl()
+        :_next_worker(0){}
+
+        std::vector<std::unique_ptr<pow_worker>> _workers;
+        /** evaluate() may be called from any thread */
+        std::atomic<uint32_t>                    _next_worker;
+   };
+}
+
+pow_engine::pow_engine( uint32_t threads )
+:my( new detail::pow_engine_impl() )
+{
+   if( threads == 0 )
+   {
+      threads = std::max<uint32_t>( 1, std::thread::hardware_concurrency() );
+   }
+   for( uint32_t i = 0; i < threads; ++i )
+   {
+      my->_workers.push_back( std::unique_ptr<detail::pow_worker>( new detail::pow_worker( "pow" ) ) );
+   }
+}
+
+pow_engine::~pow_engine()
+{
+}
+
+pow_engine& pow_engine::instance()
 {
-   unsigned char* buf = new unsigned char[BUF_SIZE];
-   pow_hash out;
-   try {
-     out = proof_of_work( in, buf );
-   } catch ( ... )
+   static pow_engine engine( POW_ENGINE_THREADS );
+   return engine;
+}
+
+pow_hash pow_engine::evaluate( const fc::sha256& seed )
+{ try {
+   detail::pow_worker* w = my->_workers[ my->_next_worker++ % my->_workers.size() ].get();
+   return w->thread.async( [=](){ return proof_of_work( seed, w->buffer.data() ); } ).wait();
+} FC_RETHROW_EXCEPTIONS( warn, "", ("seed",seed) ) }
+
+std::vector<pow_hash> pow_engine::evaluate( const std::vector<fc::sha256>& seeds )
+{ try {
+   // the workers write into shared state so that it outlives a canceled wait
+   auto in  = std::make_shared<std::vector<fc::sha256>>( seeds );
+   auto out = std::make_shared<std::vector<pow_hash>>( seeds.size() );
+
+   size_t per_worker = (seeds.size() + my->_workers.size() - 1) / my->_workers.size();
+   std::vector<fc::future<void>> done;
+   for( size_t start = 0, w = 0; start < seeds.size(); start += per_worker, ++w )
+   {
+      size_t              end    = std::min( start + per_worker, seeds.size() );
+      detail::pow_worker* worker = my->_workers[w].get();
+      done.push_back( worker->thread.async( [=]() {
+         for( size_t i = start; i < end; ++i )
+         {
+            (*out)[i] = proof_of_work( (*in)[i], worker->buffer.data() );
+         }
+      } ) );
+   }
+   for( auto itr = done.begin(); itr != done.end(); ++itr )
    {
-    delete [] buf;
-    throw;
+      itr->wait();
    }
-   delete[] buf;
-   return out;
+   return *out;
+} FC_RETHROW_EXCEPTIONS( warn, "", ("seeds",seeds.size()) ) }
+
+uint32_t pow_engine::thread_count()const
+{
+   return my->_workers.size();
+}
+
+pow_hash proof_of_work( const fc::sha256& in )
+{
+   return pow_engine::instance().evaluate( in );
 }
 
 
@@ -75,6 +201,45 @@ pow_hash proof_of_work( const fc::sha256& in)
  *  security and may change at any time prior to launch.
  */
 pow_hash proof_of_work( const fc::sha256& seed, unsigned char* buffer )
+{
+   static const bool use_aesni = detail::aesni_kernel_verified();
+   if( use_aesni )
+   {
+      return detail::proof_of_work_aesni( seed, buffer );
+   }
+   return detail::proof_of_work_reference( seed, buffer );
+}
+
+namespace detail {
+
+/**
+ *  The AES-NI kernel is only used after it reproduces the reference hash on this
+ *  machine, a mismatch would otherwise fork us off the chain.
+ */
+bool aesni_kernel_verified()
+{
+   if( !aesni_supported() )
+   {
+      return false;
+   }
+   try 
+   {
+      pow_buffer buffer;
+      fc::sha256 seed = fc::sha256::hash( "aesni", 5 );
+      if( proof_of_work_aesni( seed, buffer.data() ) == proof_of_work_reference( seed, buffer.data() ) )
+      {
+         return true;
+      }
+      elog( "AES-NI proof of work does not match the reference implementation" );
+   }
+   catch ( const fc::exception& e )
+   {
+      wlog( "${e}", ("e", e.to_detail_string() ) );
+   }
+   return false;
+}
+
+pow_hash proof_of_work_reference( const fc::sha256& seed, unsigned char* buffer )
 {
    auto key = fc::sha256(seed);
    auto iv  = fc::city_hash128((char*)&seed,sizeof(seed));
@@ -96,5 +261,7 @@ pow_hash proof_of_work( const fc::sha256& seed, unsigned char* buffer )
    return fc::ripemd160::hash((char*)&midstate, sizeof(midstate) );
 }
 
+} // namespace detail
+
 
 }  // namespace bts
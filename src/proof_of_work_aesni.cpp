@@ -0,0 +1,155 @@
+#include <bts/proof_of_work.hpp>
+#include <fc/crypto/city.hpp>
+#include <fc/exception/exception.hpp>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define BTS_HAS_AESNI_KERNEL 1
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#define BUF_SIZE (bts::pow_buffer_size)
+#define BLOCK_SIZE (32) // bytes
+
+namespace bts { namespace detail {
+
+#ifdef BTS_HAS_AESNI_KERNEL
+
+  bool aesni_supported()
+  {
+     uint32_t ecx = 0;
+#ifdef _MSC_VER
+     int info[4];
+     __cpuid( info, 1 );
+     ecx = info[2];
+#else
+     uint32_t eax, ebx, edx;
+     if( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) )
+     {
+        return false;
+     }
+#endif
+     return (ecx & (1 << 25)) != 0;
+  }
+
+  namespace
+  {
+     inline __m128i expand_even( __m128i k, __m128i t )
+     {
+        t = _mm_shuffle_epi32( t, 0xff );
+        k = _mm_xor_si128( k, _mm_slli_si128( k, 4 ) );
+        k = _mm_xor_si128( k, _mm_slli_si128( k, 4 ) );
+        k = _mm_xor_si128( k, _mm_slli_si128( k, 4 ) );
+        return _mm_xor_si128( k, t );
+     }
+
+     inline __m128i expand_odd( __m128i k, __m128i prev )
+     {
+        __m128i t = _mm_shuffle_epi32( _mm_aeskeygenassist_si128( prev, 0x00 ), 0xaa );
+        k = _mm_xor_si128( k, _mm_slli_si128( k, 4 ) );
+        k = _mm_xor_si128( k, _mm_slli_si128( k, 4 ) );
+        k = _mm_xor_si128( k, _mm_slli_si128( k, 4 ) );
+        return _mm_xor_si128( k, t );
+     }
+
+     /** AES-256 key schedule, the rcon must be an immediate so the steps are unrolled */
+     void expand_key( const unsigned char* key, __m128i* ks )
+     {
+        ks[0]  = _mm_loadu_si128( (const __m128i*)key );
+        ks[1]  = _mm_loadu_si128( (const __m128i*)(key+16) );
+        ks[2]  = expand_even( ks[0],  _mm_aeskeygenassist_si128( ks[1],  0x01 ) );
+        ks[3]  = expand_odd(  ks[1],  ks[2] );
+        ks[4]  = expand_even( ks[2],  _mm_aeskeygenassist_si128( ks[3],  0x02 ) );
+        ks[5]  = expand_odd(  ks[3],  ks[4] );
+        ks[6]  = expand_even( ks[4],  _mm_aeskeygenassist_si128( ks[5],  0x04 ) );
+        ks[7]  = expand_odd(  ks[5],  ks[6] );
+        ks[8]  = expand_even( ks[6],  _mm_aeskeygenassist_si128( ks[7],  0x08 ) );
+        ks[9]  = expand_odd(  ks[7],  ks[8] );
+        ks[10] = expand_even( ks[8],  _mm_aeskeygenassist_si128( ks[9],  0x10 ) );
+        ks[11] = expand_odd(  ks[9],  ks[10] );
+        ks[12] = expand_even( ks[10], _mm_aeskeygenassist_si128( ks[11], 0x20 ) );
+        ks[13] = expand_odd(  ks[11], ks[12] );
+        ks[14] = expand_even( ks[12], _mm_aeskeygenassist_si128( ks[13], 0x40 ) );
+     }
+
+     inline __m128i encrypt_block( __m128i b, const __m128i* ks )
+     {
+        b = _mm_xor_si128( b, ks[0] );
+        b = _mm_aesenc_si128( b, ks[1] );
+        b = _mm_aesenc_si128( b, ks[2] );
+        b = _mm_aesenc_si128( b, ks[3] );
+        b = _mm_aesenc_si128( b, ks[4] );
+        b = _mm_aesenc_si128( b, ks[5] );
+        b = _mm_aesenc_si128( b, ks[6] );
+        b = _mm_aesenc_si128( b, ks[7] );
+        b = _mm_aesenc_si128( b, ks[8] );
+        b = _mm_aesenc_si128( b, ks[9] );
+        b = _mm_aesenc_si128( b, ks[10] );
+        b = _mm_aesenc_si128( b, ks[11] );
+        b = _mm_aesenc_si128( b, ks[12] );
+        b = _mm_aesenc_si128( b, ks[13] );
+        return _mm_aesenclast_si128( b, ks[14] );
+     }
+  }
+
+  /**
+   *  Computes the same hash as proof_of_work_reference.  fc::aes_encoder is AES-256 
+   *  in CBC mode whose chaining value carries over from one encode() call to the 
+   *  next, here the chaining value and the key schedule stay in registers.  Each
+   *  16 byte block is encrypted and stored before the next one is loaded, the
+   *  block by block order of CBC, so that the result matches the reference
+   *  when the read and write positions overlap.
+   */
+  pow_hash proof_of_work_aesni( const fc::sha256& seed, unsigned char* buffer )
+  {
+     auto key = fc::sha256(seed);
+     auto iv  = fc::city_hash128((char*)&seed,sizeof(seed));
+     memset( buffer, 0, BUF_SIZE );
+
+     __m128i ks[15];
+     expand_key( (const unsigned char*)&key, ks );
+     __m128i chain = _mm_loadu_si128( (const __m128i*)&iv );
+
+     unsigned char* read_pos  = buffer;
+     unsigned char* write_pos = buffer + 32;
+     for( uint32_t i = 0; i < BUF_SIZE / (BLOCK_SIZE/2); ++i )
+     {
+        chain = encrypt_block( _mm_xor_si128( _mm_loadu_si128( (const __m128i*)read_pos ), chain ), ks );
+        _mm_storeu_si128( (__m128i*)write_pos, chain );
+        chain = encrypt_block( _mm_xor_si128( _mm_loadu_si128( (const __m128i*)(read_pos+16) ), chain ), ks );
+        _mm_storeu_si128( (__m128i*)(write_pos+16), chain );
+
+        const uint64_t* w = (const uint64_t*)write_pos;
+        read_pos  = buffer + w[0] % ( BUF_SIZE - BLOCK_SIZE );
+        _mm_prefetch( (const char*)read_pos, _MM_HINT_T0 );
+        _mm_prefetch( (const char*)read_pos + BLOCK_SIZE - 1, _MM_HINT_T0 );
+        if( w[2] % 117 == 0 && i > 32 ) { i -= w[3]%32; }
+        write_pos = buffer + w[1] % ( BUF_SIZE - BLOCK_SIZE );
+        _mm_prefetch( (const char*)write_pos, _MM_HINT_T0 );
+     }
+     auto midstate =  fc::city_hash_crc_256( (char*)buffer, BUF_SIZE ); 
+     return fc::ripemd160::hash((char*)&midstate, sizeof(midstate) );
+  }
+
+#else // BTS_HAS_AESNI_KERNEL
+
+  bool aesni_supported()
+  {
+     return false;
+  }
+
+  pow_hash proof_of_work_aesni( const fc::sha256& seed, unsigned char* buffer )
+  {
+     FC_THROW_EXCEPTION( fc::exception, "AES-NI is not available on this platform" );
+  }
+
+#endif // BTS_HAS_AESNI_KERNEL
+
+} } // bts::detail
@@ -1,6 +1,9 @@
 #include <bts/small_hash.hpp>
 #include <fc/crypto/sha512.hpp>
 
+#include <algorithm>
+#include <vector>
+
 namespace bts 
 {
   typedef fc::ripemd160  uint160;
@@ -24,4 +27,33 @@ namespace bts
      return small_hash( fc::sha512::hash(data,len) );
   }
 
+  void small_hash( const char* const* data, const size_t* len, size_t count, uint160* out )
+  {
+     static const bool use_sse2 = detail::small_hash_sse2_supported();
+     if( use_sse2 && count > 1 )
+     {
+        detail::small_hash_sse2( data, len, count, out );
+        return;
+     }
+
+     // hash everything before writing so that out may overlap the inputs
+     std::vector<uint160> result( count );
+     for( size_t i = 0; i < count; ++i )
+     {
+        result[i] = small_hash( data[i], len[i] );
+     }
+     std::copy( result.begin(), result.end(), out );
+  }
+
+  void small_hash( const char* data, size_t len, size_t count, uint160* out )
+  {
+     std::vector<const char*> inputs( count );
+     std::vector<size_t>      lens( count, len );
+     for( size_t i = 0; i < count; ++i )
+     {
+        inputs[i] = data + i * len;
+     }
+     small_hash( inputs.data(), lens.data(), count, out );
+  }
+
 }
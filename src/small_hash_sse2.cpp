@@ -0,0 +1,386 @@
+#include <bts/small_hash.hpp>
+#include <fc/exception/exception.hpp>
+#include <string.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define BTS_HAS_SSE2_SMALL_HASH 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+#endif
+
+namespace bts { namespace detail {
+
+#ifdef BTS_HAS_SSE2_SMALL_HASH
+
+  namespace
+  {
+     inline uint64_t load_be64( const unsigned char* p )
+     {
+        uint64_t v;
+        memcpy( &v, p, sizeof(v) );
+#ifdef _MSC_VER
+        return _byteswap_uint64( v );
+#else
+        return __builtin_bswap64( v );
+#endif
+     }
+
+     inline void store_be64( unsigned char* p, uint64_t v )
+     {
+#ifdef _MSC_VER
+        v = _byteswap_uint64( v );
+#else
+        v = __builtin_bswap64( v );
+#endif
+        memcpy( p, &v, sizeof(v) );
+     }
+
+     const uint64_t sha512_k[80] = {
+        0x428a2f98d728ae22ull, 0x7137449123ef65cdull, 0xb5c0fbcfec4d3b2full, 0xe9b5dba58189dbbcull,
+        0x3956c25bf348b538ull, 0x59f111f1b605d019ull, 0x923f82a4af194f9bull, 0xab1c5ed5da6d8118ull,
+        0xd807aa98a3030242ull, 0x12835b0145706fbeull, 0x243185be4ee4b28cull, 0x550c7dc3d5ffb4e2ull,
+        0x72be5d74f27b896full, 0x80deb1fe3b1696b1ull, 0x9bdc06a725c71235ull, 0xc19bf174cf692694ull,
+        0xe49b69c19ef14ad2ull, 0xefbe4786384f25e3ull, 0x0fc19dc68b8cd5b5ull, 0x240ca1cc77ac9c65ull,
+        0x2de92c6f592b0275ull, 0x4a7484aa6ea6e483ull, 0x5cb0a9dcbd41fbd4ull, 0x76f988da831153b5ull,
+        0x983e5152ee66dfabull, 0xa831c66d2db43210ull, 0xb00327c898fb213full, 0xbf597fc7beef0ee4ull,
+        0xc6e00bf33da88fc2ull, 0xd5a79147930aa725ull, 0x06ca6351e003826full, 0x142929670a0e6e70ull,
+        0x27b70a8546d22ffcull, 0x2e1b21385c26c926ull, 0x4d2c6dfc5ac42aedull, 0x53380d139d95b3dfull,
+        0x650a73548baf63deull, 0x766a0abb3c77b2a8ull, 0x81c2c92e47edaee6ull, 0x92722c851482353bull,
+        0xa2bfe8a14cf10364ull, 0xa81a664bbc423001ull, 0xc24b8b70d0f89791ull, 0xc76c51a30654be30ull,
+        0xd192e819d6ef5218ull, 0xd69906245565a910ull, 0xf40e35855771202aull, 0x106aa07032bbd1b8ull,
+        0x19a4c116b8d2d0c8ull, 0x1e376c085141ab53ull, 0x2748774cdf8eeb99ull, 0x34b0bcb5e19b48a8ull,
+        0x391c0cb3c5c95a63ull, 0x4ed8aa4ae3418acbull, 0x5b9cca4f7763e373ull, 0x682e6ff3d6b2b8a3ull,
+        0x748f82ee5defb2fcull, 0x78a5636f43172f60ull, 0x84c87814a1f0ab72ull, 0x8cc702081a6439ecull,
+        0x90befffa23631e28ull, 0xa4506cebde82bde9ull, 0xbef9a3f7b2c67915ull, 0xc67178f2e372532bull,
+        0xca273eceea26619cull, 0xd186b8c721c0c207ull, 0xeada7dd6cde0eb1eull, 0xf57d4f7fee6ed178ull,
+        0x06f067aa72176fbaull, 0x0a637dc5a2c898a6ull, 0x113f9804bef90daeull, 0x1b710b35131c471bull,
+        0x28db77f523047d84ull, 0x32caab7b40c72493ull, 0x3c9ebe0a15c9bebcull, 0x431d67c49c100d4cull,
+        0x4cc5d4becb3e42b6ull, 0x597f299cfc657e2aull, 0x5fcb6fab3ad6faecull, 0x6c44198c4a475817ull
+     };
+
+     const uint64_t sha512_iv[8] = {
+        0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull, 0xa54ff53a5f1d36f1ull,
+        0x510e527fade682d1ull, 0x9b05688c2b3e6c1full, 0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull
+     };
+
+     #define ROTR64( x, n ) _mm_or_si128( _mm_srli_epi64( x, n ), _mm_slli_epi64( x, 64 - (n) ) )
+
+     /**
+      *  Runs the SHA-512 compression function on two independent states, lane i of
+      *  state[j] and w[j] belongs to the message in lane i.
+      */
+     void sha512_compress_x2( __m128i* state, __m128i* w )
+     {
+        for( uint32_t t = 16; t < 80; ++t )
+        {
+           __m128i w15 = w[t-15];
+           __m128i w2  = w[t-2];
+           __m128i s0  = _mm_xor_si128( _mm_xor_si128( ROTR64( w15, 1 ), ROTR64( w15, 8 ) ), _mm_srli_epi64( w15, 7 ) );
+           __m128i s1  = _mm_xor_si128( _mm_xor_si128( ROTR64( w2, 19 ), ROTR64( w2, 61 ) ), _mm_srli_epi64( w2, 6 ) );
+           w[t] = _mm_add_epi64( _mm_add_epi64( w[t-16], s0 ), _mm_add_epi64( w[t-7], s1 ) );
+        }
+
+        __m128i a = state[0], b = state[1], c = state[2], d = state[3];
+        __m128i e = state[4], f = state[5], g = state[6], h = state[7];
+        for( uint32_t t = 0; t < 80; ++t )
+        {
+           __m128i S1  = _mm_xor_si128( _mm_xor_si128( ROTR64( e, 14 ), ROTR64( e, 18 ) ), ROTR64( e, 41 ) );
+           __m128i ch  = _mm_xor_si128( g, _mm_and_si128( e, _mm_xor_si128( f, g ) ) );
+           __m128i k   = _mm_set1_epi64x( sha512_k[t] );
+           __m128i t1  = _mm_add_epi64( _mm_add_epi64( h, S1 ), _mm_add_epi64( _mm_add_epi64( ch, k ), w[t] ) );
+           __m128i S0  = _mm_xor_si128( _mm_xor_si128( ROTR64( a, 28 ), ROTR64( a, 34 ) ), ROTR64( a, 39 ) );
+           __m128i maj = _mm_or_si128( _mm_and_si128( a, b ), _mm_and_si128( c, _mm_or_si128( a, b ) ) );
+           h = g; g = f; f = e;
+           e = _mm_add_epi64( d, t1 );
+           d = c; c = b; b = a;
+           a = _mm_add_epi64( t1, _mm_add_epi64( S0, maj ) );
+        }
+        state[0] = _mm_add_epi64( state[0], a ); state[1] = _mm_add_epi64( state[1], b );
+        state[2] = _mm_add_epi64( state[2], c ); state[3] = _mm_add_epi64( state[3], d );
+        state[4] = _mm_add_epi64( state[4], e ); state[5] = _mm_add_epi64( state[5], f );
+        state[6] = _mm_add_epi64( state[6], g ); state[7] = _mm_add_epi64( state[7], h );
+     }
+
+     /** a message being hashed in one of the SHA-512 lanes */
+     struct sha512_lane
+     {
+        const unsigned char* data;
+        size_t               len;
+        size_t               input;  ///< index of the message in the batch
+        uint64_t             block;  ///< index of the next 128 byte block
+        uint64_t             blocks; ///< number of blocks after padding
+     };
+
+     /**
+      *  Writes the block'th 128 byte block of the padded message to words.
+      */
+     void load_sha512_block( const sha512_lane& l, uint64_t* words )
+     {
+        size_t offset = l.block * 128;
+        if( offset + 128 <= l.len )
+        {
+           for( uint32_t i = 0; i < 16; ++i )
+           {
+              words[i] = load_be64( l.data + offset + 8*i );
+           }
+           return;
+        }
+
+        unsigned char buf[128];
+        memset( buf, 0, sizeof(buf) );
+        if( offset < l.len )
+        {
+           memcpy( buf, l.data + offset, l.len - offset );
+        }
+        if( offset <= l.len )
+        {
+           buf[l.len - offset] = 0x80;
+        }
+        if( l.block + 1 == l.blocks )
+        {
+           // the message length in bits as a 128 bit big endian number
+           store_be64( buf + 112, uint64_t(l.len) >> 61 );
+           store_be64( buf + 120, uint64_t(l.len) << 3 );
+        }
+        for( uint32_t i = 0; i < 16; ++i )
+        {
+           words[i] = load_be64( buf + 8*i );
+        }
+     }
+
+     /**
+      *  Calculates sha512( data[i], len[i] ) for every input two at a time, a lane
+      *  that finishes its message is immediately refilled with the next one so
+      *  inputs of different lengths keep both lanes busy.
+      */
+     void sha512_x2( const char* const* data, const size_t* len, size_t count, unsigned char* digests )
+     {
+        sha512_lane lanes[2];
+        bool        active[2] = { false, false };
+        uint64_t    state[8][2];
+        size_t      next = 0;
+
+        auto start_lane = [&]( uint32_t l )
+        {
+           active[l] = next < count;
+           if( !active[l] ) return;
+           lanes[l].data   = (const unsigned char*)data[next];
+           lanes[l].len    = len[next];
+           lanes[l].input  = next;
+           lanes[l].block  = 0;
+           lanes[l].blocks = (len[next] + 17 + 127) / 128;
+           for( uint32_t i = 0; i < 8; ++i )
+           {
+              state[i][l] = sha512_iv[i];
+           }
+           ++next;
+        };
+        start_lane( 0 );
+        start_lane( 1 );
+
+        while( active[0] || active[1] )
+        {
+           uint64_t words[2][16];
+           for( uint32_t l = 0; l < 2; ++l )
+           {
+              if( active[l] ) load_sha512_block( lanes[l], words[l] );
+              else            memset( words[l], 0, sizeof(words[l]) );
+           }
+
+           __m128i s[8];
+           __m128i w[80];
+           for( uint32_t i = 0; i < 8; ++i )
+           {
+              s[i] = _mm_set_epi64x( state[i][1], state[i][0] );
+           }
+           for( uint32_t i = 0; i < 16; ++i )
+           {
+              w[i] = _mm_set_epi64x( words[1][i], words[0][i] );
+           }
+           sha512_compress_x2( s, w );
+           for( uint32_t i = 0; i < 8; ++i )
+           {
+              _mm_storeu_si128( (__m128i*)state[i], s[i] );
+           }
+
+           for( uint32_t l = 0; l < 2; ++l )
+           {
+              if( active[l] && ++lanes[l].block == lanes[l].blocks )
+              {
+                 unsigned char* out = digests + 64 * lanes[l].input;
+                 for( uint32_t i = 0; i < 8; ++i )
+                 {
+                    store_be64( out + 8*i, state[i][l] );
+                 }
+                 start_lane( l );
+              }
+           }
+        }
+     }
+
+     #define ROTL32( x, n ) _mm_or_si128( _mm_sll_epi32( x, _mm_cvtsi32_si128(n) ), \
+                                          _mm_srl_epi32( x, _mm_cvtsi32_si128(32-(n)) ) )
+
+     const uint8_t rmd_r[80] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,15,
+        7, 4,13, 1,10, 6,15, 3,12, 0, 9, 5, 2,14,11, 8,
+        3,10,14, 4, 9,15, 8, 1, 2, 7, 0, 6,13,11, 5,12,
+        1, 9,11,10, 0, 8,12, 4,13, 3, 7,15,14, 5, 6, 2,
+        4, 0, 5, 9, 7,12, 2,10,14, 1, 3, 8,11, 6,15,13
+     };
+     const uint8_t rmd_rp[80] = {
+        5,14, 7, 0, 9, 2,11, 4,13, 6,15, 8, 1,10, 3,12,
+        6,11, 3, 7, 0,13, 5,10,14,15, 8,12, 4, 9, 1, 2,
+       15, 5, 1, 3, 7,14, 6, 9,11, 8,12, 2,10, 0, 4,13,
+        8, 6, 4, 1, 3,11,15, 0, 5,12, 2,13, 9, 7,10,14,
+       12,15,10, 4, 1, 5, 8, 7, 6, 2,13,14, 0, 3, 9,11
+     };
+     const uint8_t rmd_s[80] = {
+       11,14,15,12, 5, 8, 7, 9,11,13,14,15, 6, 7, 9, 8,
+        7, 6, 8,13,11, 9, 7,15, 7,12,15, 9,11, 7,13,12,
+       11,13, 6, 7,14, 9,13,15,14, 8,13, 6, 5,12, 7, 5,
+       11,12,14,15,14,15, 9, 8, 9,14, 5, 6, 8, 6, 5,12,
+        9,15, 5,11, 6, 8,13,12, 5,12,13,14,11, 8, 5, 6
+     };
+     const uint8_t rmd_sp[80] = {
+        8, 9, 9,11,13,15,15, 5, 7, 7, 8,11,14,14,12, 6,
+        9,13,15, 7,12, 8, 9,11, 7, 7,12, 7, 6,15,13,11,
+        9, 7,15,11, 8, 6, 6,14,12,13, 5,14,13,13, 7, 5,
+       15, 5, 8,11,14,14, 6,14, 6, 9,12, 9,12, 5,15, 8,
+        8, 5,12, 9,12, 5,14, 6, 8,13, 6, 5,15,13,11,11
+     };
+     const uint32_t rmd_k[5]  = { 0x00000000, 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xA953FD4E };
+     const uint32_t rmd_kp[5] = { 0x50A28BE6, 0x5C4DD124, 0x6D703EF3, 0x7A6D76E9, 0x00000000 };
+     const uint32_t rmd_iv[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+     /** the RIPEMD-160 boolean function for round j of 0..4 */
+     inline __m128i rmd_f( uint32_t j, __m128i x, __m128i y, __m128i z )
+     {
+        const __m128i ones = _mm_set1_epi32( -1 );
+        switch( j )
+        {
+           case 0:  return _mm_xor_si128( _mm_xor_si128( x, y ), z );
+           case 1:  return _mm_or_si128( _mm_and_si128( x, y ), _mm_andnot_si128( x, z ) );
+           case 2:  return _mm_xor_si128( _mm_or_si128( x, _mm_xor_si128( y, ones ) ), z );
+           case 3:  return _mm_or_si128( _mm_and_si128( x, z ), _mm_andnot_si128( z, y ) );
+           default: return _mm_xor_si128( x, _mm_or_si128( y, _mm_xor_si128( z, ones ) ) );
+        }
+     }
+
+     /**
+      *  Runs the RIPEMD-160 compression function on four independent states, x[i]
+      *  holds word i of the block of each lane.
+      */
+     void ripemd160_compress_x4( __m128i* h, const __m128i* x )
+     {
+        __m128i al = h[0], bl = h[1], cl = h[2], dl = h[3], el = h[4];
+        __m128i ar = h[0], br = h[1], cr = h[2], dr = h[3], er = h[4];
+        for( uint32_t t = 0; t < 80; ++t )
+        {
+           uint32_t j = t / 16;
+
+           __m128i tl = _mm_add_epi32( _mm_add_epi32( al, rmd_f( j, bl, cl, dl ) ),
+                                       _mm_add_epi32( x[rmd_r[t]], _mm_set1_epi32( rmd_k[j] ) ) );
+           tl = _mm_add_epi32( ROTL32( tl, rmd_s[t] ), el );
+           al = el; el = dl; dl = ROTL32( cl, 10 ); cl = bl; bl = tl;
+
+           __m128i tr = _mm_add_epi32( _mm_add_epi32( ar, rmd_f( 4 - j, br, cr, dr ) ),
+                                       _mm_add_epi32( x[rmd_rp[t]], _mm_set1_epi32( rmd_kp[j] ) ) );
+           tr = _mm_add_epi32( ROTL32( tr, rmd_sp[t] ), er );
+           ar = er; er = dr; dr = ROTL32( cr, 10 ); cr = br; br = tr;
+        }
+        __m128i t = _mm_add_epi32( _mm_add_epi32( h[1], cl ), dr );
+        h[1] = _mm_add_epi32( _mm_add_epi32( h[2], dl ), er );
+        h[2] = _mm_add_epi32( _mm_add_epi32( h[3], el ), ar );
+        h[3] = _mm_add_epi32( _mm_add_epi32( h[4], al ), br );
+        h[4] = _mm_add_epi32( _mm_add_epi32( h[0], bl ), cr );
+        h[0] = t;
+     }
+
+     /**
+      *  Calculates ripemd160 of count 64 byte inputs four at a time.
+      */
+     void ripemd160_x4( const unsigned char* in, size_t count, uint160* out )
+     {
+        // a 64 byte message is followed by a block holding only the padding and length
+        __m128i pad[16];
+        for( uint32_t i = 0; i < 16; ++i )
+        {
+           pad[i] = _mm_setzero_si128();
+        }
+        pad[0]  = _mm_set1_epi32( 0x80 );
+        pad[14] = _mm_set1_epi32( 64*8 );
+
+        for( size_t n = 0; n < count; n += 4 )
+        {
+           uint32_t words[4][16];
+           for( uint32_t l = 0; l < 4; ++l )
+           {
+              if( n + l < count ) memcpy( words[l], in + 64*(n+l), 64 );
+              else                memset( words[l], 0, 64 );
+           }
+
+           __m128i x[16];
+           for( uint32_t i = 0; i < 16; ++i )
+           {
+              x[i] = _mm_set_epi32( words[3][i], words[2][i], words[1][i], words[0][i] );
+           }
+
+           __m128i h[5];
+           for( uint32_t i = 0; i < 5; ++i )
+           {
+              h[i] = _mm_set1_epi32( rmd_iv[i] );
+           }
+           ripemd160_compress_x4( h, x );
+           ripemd160_compress_x4( h, pad );
+
+           uint32_t result[5][4];
+           for( uint32_t i = 0; i < 5; ++i )
+           {
+              _mm_storeu_si128( (__m128i*)result[i], h[i] );
+           }
+           for( uint32_t l = 0; l < 4 && n + l < count; ++l )
+           {
+              uint32_t digest[5] = { result[0][l], result[1][l], result[2][l], result[3][l], result[4][l] };
+              memcpy( (char*)&out[n+l], digest, sizeof(digest) );
+           }
+        }
+     }
+
+     #undef ROTR64
+     #undef ROTL32
+  }
+
+  bool small_hash_sse2_supported()
+  {
+     return true;
+  }
+
+  void small_hash_sse2( const char* const* data, const size_t* len, size_t count, uint160* out )
+  {
+     static_assert( sizeof(uint160) == 20, "uint160 must be the raw ripemd160 digest" );
+
+     // every input is read before any output is written so out may overlap the inputs
+     std::vector<unsigned char> digests( 64 * count );
+     sha512_x2( data, len, count, digests.data() );
+     ripemd160_x4( digests.data(), count, out );
+  }
+
+#else // BTS_HAS_SSE2_SMALL_HASH
+
+  bool small_hash_sse2_supported()
+  {
+     return false;
+  }
+
+  void small_hash_sse2( const char* const* data, const size_t* len, size_t count, uint160* out )
+  {
+     FC_THROW_EXCEPTION( fc::exception, "SSE2 small_hash is not supported on this platform" );
+  }
+
+#endif // BTS_HAS_SSE2_SMALL_HASH
+
+} } // bts::detail
@@ -19,16 +19,14 @@ namespace bts
     */
    fc::sha256 stretch_seed( const fc::sha256& seed )
    {
-      fc::thread t("stretch_seed");
-      return t.async( [=]() {
-          fc::sha256 last = seed;
-          for( uint32_t i = 0; i < 10; ++i )
-          {
-              auto p = proof_of_work( last );  
-              last = fc::sha256::hash( (char*)&p, sizeof(p) );
-          }
-          return last; 
-      } ).wait();
+      // each round runs on a pow_engine worker while this task waits
+      fc::sha256 last = seed;
+      for( uint32_t i = 0; i < 10; ++i )
+      {
+          auto p = pow_engine::instance().evaluate( last );  
+          last = fc::sha256::hash( (char*)&p, sizeof(p) );
+      }
+      return last; 
    }
 
    fc::sha256 calc_sequence( const fc::ecc::public_key& mpub, uint32_t seq )
@@ -13,6 +13,20 @@
 #include <fc/io/raw.hpp>
 #include <fc/filesystem.hpp>
 #include <bts/blockchain/blockchain_printer.hpp>
+#include <bts/blockchain/blockchain_pending_pool.hpp>
+#include <bts/blockchain/blockchain_channel.hpp>
+#include <bts/blockchain/blockchain_messages.hpp>
+#include <bts/blockchain/blockchain_client.hpp>
+#include <bts/blockchain/blockchain_pow_cache.hpp>
+#include <bts/merkle_tree.hpp>
+#include <bts/network/channel_pow_stats.hpp>
+#include <bts/network/broadcast_manager.hpp>
+#include <bts/network/rolling_bloom_filter.hpp>
+#include <bts/peer/peer_db.hpp>
+#include <bts/peer/peer_channel.hpp>
+#include <bts/network/server.hpp>
+#include <fc/crypto/city.hpp>
+#include <fc/thread/thread.hpp>
 #include <bts/keychain.hpp>
 #include <bts/bitname/bitname_db.hpp>
 #include <bts/bitname/bitname_block.hpp>
@@ -225,6 +239,180 @@ BOOST_AUTO_TEST_CASE( fixed_math )
   }
 }
 
+/** a trx spending output 0 of the trx with the id small_hash(input), variant changes its id */
+static bts::blockchain::signed_transaction pool_trx( uint32_t input, uint32_t variant = 0 )
+{
+  bts::blockchain::signed_transaction trx;
+  trx.valid_after = variant;
+  trx.inputs.push_back( bts::blockchain::trx_input( 
+       bts::blockchain::output_reference( bts::small_hash( (char*)&input, sizeof(input) ), 0 ) ) );
+  return trx;
+}
+
+static bts::blockchain::trx_eval pool_fees( uint64_t fees )
+{
+  bts::blockchain::trx_eval eval;
+  eval.fees = asset( fees, asset::bts );
+  return eval;
+}
+
+BOOST_AUTO_TEST_CASE( pending_pool_eviction )
+{
+  try {
+   using bts::blockchain::pending_pool;
+
+   // every trx has the same size, make room for two of them
+   pending_pool probe;
+   BOOST_REQUIRE( probe.store( pool_trx( 0 ), pool_fees( 1 ) ) );
+   uint64_t trx_bytes = probe.size_in_bytes();
+   BOOST_REQUIRE( trx_bytes > fc::raw::pack_size( pool_trx( 0 ) ) ); // packed and unpacked copies
+
+   pending_pool pool( 2 * trx_bytes );
+   auto t1 = pool_trx( 1 );
+   auto t2 = pool_trx( 2 );
+   auto t3 = pool_trx( 3 );
+   BOOST_REQUIRE( pool.store( t1, pool_fees( 1000 ) ) );
+   BOOST_REQUIRE( pool.store( t2, pool_fees( 2000 ) ) );
+   BOOST_CHECK( pool.size_in_bytes() == 2 * trx_bytes );
+
+   // too low a fee rate to displace anything
+   BOOST_CHECK( !pool.store( t3, pool_fees( 500 ) ) );
+   BOOST_CHECK( !pool.contains( t3.id() ) );
+
+   // the lowest fee rate is evicted to make room
+   std::vector<uint160> removed;
+   BOOST_REQUIRE( pool.store( t3, pool_fees( 3000 ), &removed ) );
+   BOOST_CHECK( removed.size() == 1 && removed[0] == t1.id() );
+   BOOST_CHECK( !pool.contains( t1.id() ) );
+   BOOST_CHECK( pool.size() == 2 );
+   BOOST_CHECK( pool.size_in_bytes() <= 2 * trx_bytes );
+
+   auto inv = pool.get_inventory( 10 );
+   BOOST_REQUIRE( inv.size() == 2 );
+   BOOST_CHECK( inv[0] == t3.id() && inv[1] == t2.id() );
+  } 
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( pending_pool_conflicts )
+{
+  try {
+   using bts::blockchain::pending_pool;
+   pending_pool pool;
+
+   auto t2        = pool_trx( 2 );
+   auto t3        = pool_trx( 3 );
+   auto t2_double = pool_trx( 2, 1 ); // spends the same output as t2
+   BOOST_REQUIRE( pool.store( t2, pool_fees( 2000 ) ) );
+   BOOST_REQUIRE( pool.store( t3, pool_fees( 2000 ) ) );
+
+   // a double spend must pay a higher fee rate than the trx it replaces
+   BOOST_CHECK( !pool.store( t2_double, pool_fees( 2000 ) ) );
+   BOOST_CHECK( pool.contains( t2.id() ) );
+
+   std::vector<uint160> removed;
+   BOOST_REQUIRE( pool.store( t2_double, pool_fees( 4000 ), &removed ) );
+   BOOST_CHECK( removed.size() == 1 && removed[0] == t2.id() );
+   BOOST_CHECK( !pool.contains( t2.id() ) );
+   BOOST_CHECK( pool.contains( t2_double.id() ) );
+
+   // a block including t3 and another spend of t2_double's output removes both
+   std::vector<bts::blockchain::signed_transaction> included;
+   included.push_back( t3 );
+   included.push_back( pool_trx( 2, 2 ) );
+   pool.remove_included( included );
+   BOOST_CHECK( pool.size() == 0 );
+   BOOST_CHECK( pool.size_in_bytes() == 0 );
+  } 
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( channel_pow_stats_random_ids )
+{
+  // ten 200 byte messages per second is well below BITCHAT_TARGET_BPS, messages
+  // without proof of work have random ids and about half of them should keep
+  // meeting a target 1% above the average.
+  bts::network::channel_pow_stats stats;
+  fc::time_point now = fc::time_point::now();
+  uint32_t accepted = 0;
+  for( uint32_t i = 0; i < 20000; ++i )
+  {
+     now += fc::microseconds( 100000 );
+     bool met = stats.update_bps_avg( 200, fc::city_hash128( (char*)&i, sizeof(i) ), now );
+     if( i >= 10000 ) accepted += met;
+  }
+  BOOST_CHECK( stats.avg_bits_per_sec < BITCHAT_TARGET_BPS );
+  BOOST_CHECK( accepted > 4000 );
+}
+
+BOOST_AUTO_TEST_CASE( small_hash_batch )
+{
+  // inputs of every length up to a few sha512 blocks so that lanes finish at different times
+  std::vector<std::vector<char>> inputs;
+  std::vector<const char*>       data;
+  std::vector<size_t>            lens;
+  for( uint32_t i = 0; i < 400; ++i )
+  {
+     inputs.push_back( std::vector<char>( i ) );
+     for( uint32_t c = 0; c < i; ++c )
+     {
+        inputs.back()[c] = char(i * 31 + c);
+     }
+  }
+  for( auto itr = inputs.begin(); itr != inputs.end(); ++itr )
+  {
+     data.push_back( itr->data() );
+     lens.push_back( itr->size() );
+  }
+
+  std::vector<bts::uint160> out( inputs.size() );
+  bts::small_hash( data.data(), lens.data(), data.size(), out.data() );
+  for( uint32_t i = 0; i < inputs.size(); ++i )
+  {
+     BOOST_REQUIRE( out[i] == bts::small_hash( data[i], lens[i] ) );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( merkle_branches )
+{
+  try{
+   for( uint32_t count = 1; count < 40; ++count )
+   {
+      std::vector<bts::uint160> leaves;
+      for( uint32_t i = 0; i < count; ++i )
+      {
+         leaves.push_back( bts::small_hash( (char*)&i, sizeof(i) ) );
+      }
+
+      bts::merkle_tree tree;
+      tree.set_leaves( leaves );
+      BOOST_REQUIRE( tree.mroot == bts::calculate_merkle_root( leaves ) );
+
+      for( uint32_t i = 0; i < count; ++i )
+      {
+         BOOST_REQUIRE( tree.get_branch(i).calculate_root() == tree.mroot );
+      }
+
+      // updating a leaf in place must match rebuilding the whole tree
+      leaves[count/2] = bts::uint160();
+      tree.set( count/2, leaves[count/2] );
+      BOOST_REQUIRE( tree.mroot == bts::calculate_merkle_root( leaves ) );
+   }
+  } catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
 /**
  *  Test the process of validating the block chain given
  *  a known initial condition and fixed transactions. 
@@ -463,3 +651,613 @@ BOOST_AUTO_TEST_CASE( wallet_test )
    */
 }
 
+BOOST_AUTO_TEST_CASE( peer_db_indexes )
+{
+  try {
+   using bts::peer::host;
+   using bts::peer::host_stats;
+   using bts::network::channel_id;
+
+   fc::temp_directory temp_dir;
+   channel_id chat( bts::network::chat_proto, 1 );
+   channel_id name( bts::network::name_proto, 0 );
+   fc::time_point_sec now( 1000000 );
+   auto ago = [&]( uint32_t sec ) { return fc::time_point_sec( now.sec_since_epoch() - sec ); };
+   auto ep = []( uint16_t n ) { return fc::ip::endpoint( fc::ip::address( 0x0a000000 + n ), 9000 ); };
+
+   {
+     bts::peer::peer_db db;
+     db.open( temp_dir.path() / "peers" );
+
+     // host n was last heard from n*10 seconds before now
+     for( uint16_t n = 1; n <= 5; ++n )
+     {
+        db.store( host( ep(n), n % 2 ? chat : name, ago( n*10 ) ) );
+     }
+     BOOST_CHECK( db.size() == 5 );
+
+     // storing a known host does not change the size or move its first_com
+     db.store( host( ep(5), name, now ) );
+     BOOST_CHECK( db.size() == 5 );
+     BOOST_CHECK( db.fetch_record( ep(5) ).first_com == ago( 50 ) );
+     BOOST_CHECK( db.fetch_record( ep(5) ).last_com  == now );
+
+     auto recent = db.fetch_recent_hosts( 10 );
+     BOOST_REQUIRE( recent.size() == 5 );
+     BOOST_CHECK( recent[0].ep == ep(5) );
+     BOOST_CHECK( recent[1].ep == ep(1) );
+     BOOST_CHECK( recent[4].ep == ep(4) );
+
+     // storing host 5 for name did not forget that it is also on chat
+     BOOST_CHECK( db.fetch_record( ep(5) ).channels.size() == 2 );
+     auto chat_hosts = db.fetch_hosts( chat );
+     BOOST_REQUIRE( chat_hosts.size() == 3 );
+     BOOST_CHECK( chat_hosts[0].ep == ep(5) && chat_hosts[1].ep == ep(1) && chat_hosts[2].ep == ep(3) );
+
+     db.add_channel( ep(2), chat );
+     db.remove_channel( ep(1), chat );
+     chat_hosts = db.fetch_hosts( chat );
+     BOOST_REQUIRE( chat_hosts.size() == 3 );
+     BOOST_CHECK( chat_hosts[0].ep == ep(5) && chat_hosts[1].ep == ep(2) && chat_hosts[2].ep == ep(3) );
+     BOOST_CHECK( db.fetch_hosts( name ).size() == 3 );
+
+     // without stats the best hosts are the most recent
+     BOOST_CHECK( db.fetch_best_hosts( 1 ).front().ep == ep(5) );
+     host_stats good;
+     good.uptime_sec = 60*60;
+     db.update_stats( ep(3), good );
+     host_stats bad;
+     bad.failures = 2;
+     db.update_stats( ep(5), bad );
+     auto best = db.fetch_best_hosts( 10 );
+     BOOST_REQUIRE( best.size() == 5 );
+     BOOST_CHECK( best[0].ep == ep(3) );
+     BOOST_CHECK( best[1].ep == ep(1) );
+     BOOST_CHECK( best[4].ep == ep(5) );
+     BOOST_CHECK( db.fetch_stats( ep(3) ).uptime_sec == good.uptime_sec );
+
+     // everything newer than 25 seconds ago becomes 25 seconds old
+     db.reset_ages( ago( 25 ) );
+     BOOST_CHECK( db.fetch_record( ep(1) ).last_com == ago( 25 ) );
+     BOOST_CHECK( db.fetch_record( ep(4) ).last_com == ago( 40 ) );
+
+     // hosts 3 and 4 were last heard from before 25 seconds ago
+     db.purge_old( ago( 25 ) );
+     BOOST_CHECK( db.size() == 3 );
+     BOOST_CHECK_THROW( db.fetch_record( ep(3) ), fc::exception );
+     BOOST_CHECK( db.fetch_recent_hosts( 10 ).size() == 3 );
+     BOOST_CHECK( db.fetch_best_hosts( 10 ).size() == 3 );
+     BOOST_CHECK( db.fetch_hosts( chat ).size() == 2 );
+
+     db.remove( ep(2) );
+     BOOST_CHECK( db.size() == 2 );
+     db.close();
+   }
+
+   bts::peer::peer_db db;
+   db.open( temp_dir.path() / "peers" );
+   BOOST_CHECK( db.size() == 2 );
+   auto best = db.fetch_best_hosts( 10 );
+   BOOST_REQUIRE( best.size() == 2 );
+   BOOST_CHECK( best[0].ep == ep(1) && best[1].ep == ep(5) );
+   BOOST_CHECK( db.fetch_hosts( chat ).size() == 1 );
+   BOOST_CHECK( db.fetch_hosts( name ).size() == 1 );
+  } 
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+/**
+ *  A node with its own server, peer channel and chain that starts with
+ *  the genesis block.
+ */
+struct sync_test_node
+{
+   sync_test_node( const fc::path& dir, uint16_t port )
+   :netw( std::make_shared<bts::network::server>() ),
+    db( std::make_shared<bts::blockchain::blockchain_db>() )
+   {
+      bts::network::server::config cfg;
+      cfg.port = port;
+      netw->configure( cfg );
+      peers = std::make_shared<bts::peer::peer_channel>( netw );
+      db->open( dir / "chain" );
+      db->push_block( create_genesis_block() );
+   }
+
+   ~sync_test_node()
+   {
+      chan.reset();
+      peers.reset();
+      netw->close();
+   }
+
+   void add_blocks( const bts::address& coinbase, uint32_t count )
+   {
+      for( uint32_t i = 0; i < count; ++i )
+      {
+         db->push_block( db->generate_next_block( coinbase, std::vector<signed_transaction>() ) );
+      }
+   }
+
+   /** subscribes to the blockchain channel, headers are exchanged with every peer that connects */
+   void start()
+   {
+      chan = std::make_shared<bts::blockchain::channel>( peers, db, nullptr );
+   }
+
+   void connect_to( uint16_t port )
+   {
+      netw->connect_to( fc::ip::endpoint( fc::ip::address( "127.0.0.1" ), port ) );
+   }
+
+   bts::network::server_ptr            netw;
+   bts::peer::peer_channel_ptr         peers;
+   bts::blockchain::blockchain_db_ptr  db;
+   bts::blockchain::channel_ptr        chan;
+};
+
+/** @return false if pred was not true within timeout */
+template<typename Predicate>
+static bool wait_for( Predicate&& pred, const fc::microseconds& timeout = fc::seconds( 30 ) )
+{
+   auto deadline = fc::time_point::now() + timeout;
+   while( !pred() )
+   {
+      if( fc::time_point::now() > deadline )
+      {
+         return false;
+      }
+      fc::usleep( fc::microseconds( 10000 ) );
+   }
+   return true;
+}
+
+BOOST_AUTO_TEST_CASE( blockchain_sync_two_dbs )
+{
+  try {
+   fc::temp_directory temp_dir;
+   bts::address miner = fc::ecc::private_key::generate_from_seed( fc::sha256::hash( "miner", 5 ) ).get_public_key();
+
+   sync_test_node node_a( temp_dir.path() / "a", 19311 );
+   node_a.add_blocks( miner, 5 );
+
+   sync_test_node node_b( temp_dir.path() / "b", 19312 );
+   node_a.start();
+   node_b.start();
+   node_b.connect_to( 19311 );
+
+   BOOST_REQUIRE( wait_for( [&](){ return node_b.db->head_block_num() == node_a.db->head_block_num(); } ) );
+   BOOST_CHECK( node_b.db->head_block_id() == node_a.db->head_block_id() );
+
+   // a new block on a reaches b as a compact block
+   node_a.chan->broadcast( node_a.db->generate_next_block( miner, std::vector<signed_transaction>() ) );
+   BOOST_REQUIRE( wait_for( [&](){ return node_b.db->head_block_num() == node_a.db->head_block_num(); } ) );
+   BOOST_CHECK( node_b.db->head_block_id() == node_a.db->head_block_id() );
+  } 
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( blockchain_sync_refuses_fork_below_head )
+{
+  try {
+   fc::temp_directory temp_dir;
+   bts::address miner_a = fc::ecc::private_key::generate_from_seed( fc::sha256::hash( "miner_a", 7 ) ).get_public_key();
+   bts::address miner_b = fc::ecc::private_key::generate_from_seed( fc::sha256::hash( "miner_b", 7 ) ).get_public_key();
+
+   // both chains share the genesis block and then fork
+   sync_test_node node_a( temp_dir.path() / "a", 19313 );
+   node_a.add_blocks( miner_a, 3 );
+   sync_test_node node_b( temp_dir.path() / "b", 19314 );
+   node_b.add_blocks( miner_b, 1 );
+   auto head_a = node_a.db->head_block_id();
+   auto head_b = node_b.db->head_block_id();
+
+   node_a.start();
+   node_b.start();
+   node_b.connect_to( 19313 );
+
+   // the blockchain db cannot pop blocks, the peers disconnect instead of switching forks
+   BOOST_REQUIRE( wait_for( [&](){ return node_a.netw->get_connections().empty() && 
+                                          node_b.netw->get_connections().empty(); } ) );
+   BOOST_CHECK( node_a.db->head_block_id() == head_a );
+   BOOST_CHECK( node_b.db->head_block_id() == head_b );
+  } 
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+/**
+ *  Stands in for the blockchain channel of a remote peer, announces any 
+ *  transaction, valid or not, and serves it when it is requested.
+ */
+class scripted_trx_peer : public bts::network::channel
+{
+   public:
+      scripted_trx_peer( const bts::network::channel_id& id )
+      :chan_id(id){}
+
+      virtual void handle_subscribe( const bts::network::connection_ptr& c )   { con = c; }
+      virtual void handle_unsubscribe( const bts::network::connection_ptr& c ) { con.reset(); }
+
+      virtual void handle_message( const bts::network::connection_ptr& c, const bts::network::message& m )
+      {
+         if( m.msg_type != get_trxs_message::type )
+         {
+            return;
+         }
+         auto request = m.as<get_trxs_message>();
+         trxs_message reply;
+         for( auto itr = request.items.begin(); itr != request.items.end(); ++itr )
+         {
+            auto trx = trxs.find( *itr );
+            if( trx != trxs.end() )
+            {
+               reply.trxs.push_back( trx->second );
+            }
+         }
+         c->send( bts::network::message( reply, chan_id ) );
+      }
+
+      void announce()
+      {
+         trx_inv_message inv;
+         for( auto itr = trxs.begin(); itr != trxs.end(); ++itr )
+         {
+            inv.items.push_back( itr->first );
+         }
+         con->send( bts::network::message( inv, chan_id ) );
+      }
+
+      bts::network::channel_id                          chan_id;
+      bts::network::connection_ptr                      con;
+      std::unordered_map<uint160,signed_transaction>    trxs;
+};
+
+BOOST_AUTO_TEST_CASE( blockchain_channel_verifies_announced_trxs )
+{
+  try {
+   fc::temp_directory temp_dir;
+   auto miner_key = fc::ecc::private_key::generate_from_seed( fc::sha256::hash( "miner", 5 ) );
+   auto other_key = fc::ecc::private_key::generate_from_seed( fc::sha256::hash( "other", 5 ) );
+   bts::address miner = miner_key.get_public_key();
+   bts::address other = other_key.get_public_key();
+
+   sync_test_node node_a( temp_dir.path() / "a", 19315 );
+   node_a.add_blocks( miner, 2 );
+   node_a.start();
+
+   auto netw = std::make_shared<bts::network::server>();
+   bts::network::server::config cfg;
+   cfg.port = 19316;
+   netw->configure( cfg );
+   auto peers = std::make_shared<bts::peer::peer_channel>( netw );
+   auto remote = std::make_shared<scripted_trx_peer>( bts::network::channel_id( bts::network::bts_proto, 0 ) );
+   peers->subscribe_to_channel( remote->chan_id, remote );
+   netw->connect_to( fc::ip::endpoint( fc::ip::address( "127.0.0.1" ), 19315 ) );
+   BOOST_REQUIRE( wait_for( [&](){ return !!remote->con; } ) );
+
+   auto coinbase = node_a.db->fetch_trx_block( 1 ).trxs[0];
+   auto spend = [&]( uint64_t amount ) -> signed_transaction
+   {
+      signed_transaction trx;
+      trx.inputs.push_back( trx_input( output_reference( coinbase.id(), 0 ) ) );
+      trx.outputs.push_back( trx_output( claim_by_signature_output( other ), amount, asset::bts ) );
+      return trx;
+   };
+
+   signed_transaction valid = spend( coinbase.outputs[0].amount / 2 );
+   valid.sign( miner_key );
+
+   signed_transaction wrong_key = spend( coinbase.outputs[0].amount / 3 );
+   wrong_key.sign( other_key );
+
+   signed_transaction corrupt = spend( coinbase.outputs[0].amount / 4 );
+   corrupt.sign( miner_key );
+   auto sig = *corrupt.sigs.begin();
+   sig.data[0] ^= 0xff;
+   corrupt.sigs.clear();
+   corrupt.sigs.insert( sig );
+
+   remote->trxs[valid.id()]     = valid;
+   remote->trxs[wrong_key.id()] = wrong_key;
+   remote->trxs[corrupt.id()]   = corrupt;
+   remote->announce();
+
+   // the announced trxs are fetched and only the correctly signed one is accepted
+   BOOST_REQUIRE( wait_for( [&](){ auto s = node_a.chan->get_verify_stats(); return s.accepted + s.rejected == 3; } ) );
+   auto stats = node_a.chan->get_verify_stats();
+   BOOST_CHECK( stats.accepted == 1 );
+   BOOST_CHECK( stats.rejected == 2 );
+   BOOST_CHECK( node_a.chan->get_pending_pool().count( valid.id() ) == 1 );
+   BOOST_CHECK( node_a.chan->get_pending_pool().count( wrong_key.id() ) == 0 );
+
+   peers.reset();
+   netw->close();
+  } 
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( blockchain_client_mining )
+{
+  try {
+   fc::temp_directory temp_dir;
+   bts::address miner = fc::ecc::private_key::generate_from_seed( fc::sha256::hash( "miner", 5 ) ).get_public_key();
+
+   auto netw  = std::make_shared<bts::network::server>();
+   auto peers = std::make_shared<bts::peer::peer_channel>( netw );
+   bts::blockchain::blockchain_client client( peers );
+   bts::blockchain::blockchain_client::config cfg;
+   cfg.data_dir = temp_dir.path();
+   client.configure( cfg );
+
+   auto chain = client.get_chain();
+   BOOST_REQUIRE( chain->head_block_num() == 0 );
+
+   // the chain does not define a difficulty yet, every hash meets the target so
+   // mining the second block shows that the template is refreshed after a push
+   client.start_mining( 1, miner );
+   BOOST_REQUIRE( wait_for( [&](){ return chain->head_block_num() >= 2; } ) );
+   client.stop_mining();
+
+   auto block1 = chain->fetch_trx_block( 1 );
+   BOOST_CHECK( block1.prev == chain->fetch_block( 0 ).id() );
+   BOOST_CHECK( !(chain->get_pow_target() < block1.proof_of_work()) );
+  } 
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+/** a header whose pow_seed() is unique for each nonce */
+static block_proof make_pow_header( uint32_t nonce )
+{
+   block_proof h;
+   h.block_num = nonce;
+   h.pow.nonce = nonce;
+   h.pow.branch_path.mid_states.resize(1);
+   h.pow.branch_path.mid_states[0] = h.digest();
+   return h;
+}
+
+BOOST_AUTO_TEST_CASE( pow_cache_lru_and_hits )
+{
+  try {
+   pow_cache cache( 4 );
+
+   auto first = cache.evaluate( make_pow_header( 0 ) );
+   BOOST_CHECK( first == make_pow_header( 0 ).proof_of_work() );
+   BOOST_CHECK( cache.evaluated_count() == 1 );
+
+   // a hit does not evaluate again
+   BOOST_CHECK( cache.evaluate( make_pow_header( 0 ) ) == first );
+   BOOST_CHECK( cache.evaluated_count() == 1 );
+
+   for( uint32_t n = 1; n < 4; ++n )
+   {
+      cache.evaluate( make_pow_header( n ) );
+   }
+   BOOST_CHECK( cache.size() == 4 );
+
+   // touch 0 so that 1 is the least recently used, then overflow the cache
+   cache.evaluate( make_pow_header( 0 ) );
+   cache.evaluate( make_pow_header( 4 ) );
+   BOOST_CHECK( cache.size() == 4 );
+   BOOST_CHECK( cache.evaluated_count() == 5 );
+
+   cache.evaluate( make_pow_header( 0 ) );
+   BOOST_CHECK( cache.evaluated_count() == 5 );
+   cache.evaluate( make_pow_header( 1 ) );
+   BOOST_CHECK( cache.evaluated_count() == 6 );
+
+   // the batch overload only evaluates what is missing, and duplicates once
+   std::vector<block_proof> batch;
+   batch.push_back( make_pow_header( 1 ) );
+   batch.push_back( make_pow_header( 7 ) );
+   batch.push_back( make_pow_header( 7 ) );
+   auto pows = cache.evaluate( batch );
+   BOOST_REQUIRE( pows.size() == 3 );
+   BOOST_CHECK( pows[1] == make_pow_header( 7 ).proof_of_work() );
+   BOOST_CHECK( pows[2] == pows[1] );
+   BOOST_CHECK( cache.evaluated_count() == 7 );
+  } 
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( pow_cache_concurrent_callers )
+{
+  try {
+   pow_cache cache;
+   auto h = make_pow_header( 42 );
+
+   auto a = fc::async( [&]() { return cache.evaluate( h ); } );
+   auto b = fc::async( [&]() { return cache.evaluate( h ); } );
+   std::vector<block_proof> batch( 2, h );
+   auto c = fc::async( [&]() { return cache.evaluate( batch ); } );
+
+   auto pow = a.wait();
+   BOOST_CHECK( b.wait() == pow );
+   auto pows = c.wait();
+   BOOST_CHECK( pows[0] == pow && pows[1] == pow );
+   BOOST_CHECK( cache.evaluated_count() == 1 );
+  } 
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( pow_cache_persists_chain_tail )
+{
+  try {
+   fc::temp_directory temp_dir;
+   pow_hash pow;
+   {
+      pow_cache cache;
+      cache.open( temp_dir.path() / "pow_cache" );
+      pow = cache.evaluate( make_pow_header( 1 ) );
+      cache.evaluate( make_pow_header( 2 ) );
+      cache.block_pushed( make_pow_header( 1 ) );
+      cache.close();
+   }
+
+   pow_cache cache;
+   cache.open( temp_dir.path() / "pow_cache" );
+   // only the pushed block survives the restart
+   BOOST_CHECK( cache.size() == 1 );
+   BOOST_CHECK( cache.evaluate( make_pow_header( 1 ) ) == pow );
+   BOOST_CHECK( cache.evaluated_count() == 0 );
+
+   // blocks older than the persisted tail are forgotten
+   cache.evaluate( make_pow_header( 1 + POW_CACHE_PERSIST_BLOCKS ) );
+   cache.block_pushed( make_pow_header( 1 + POW_CACHE_PERSIST_BLOCKS ) );
+   cache.close();
+
+   pow_cache reopened;
+   reopened.open( temp_dir.path() / "pow_cache" );
+   BOOST_CHECK( reopened.size() == 1 );
+   reopened.evaluate( make_pow_header( 1 + POW_CACHE_PERSIST_BLOCKS ) );
+   BOOST_CHECK( reopened.evaluated_count() == 0 );
+   reopened.close();
+  } 
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( broadcast_manager_requery )
+{
+  try {
+   bts::network::broadcast_manager<uint64_t,std::string> mgr;
+   bts::network::connection_ptr none;
+
+   mgr.received_inventory_notice( 1, none );
+   mgr.received_inventory_notice( 2, none );
+   mgr.received_inventory_notice( 2, none );
+
+   std::vector<uint64_t> keys;
+   BOOST_REQUIRE( mgr.find_next_queries( keys, 10 ) == 2 );
+   BOOST_CHECK( keys[0] == 2 && keys[1] == 1 );
+   mgr.item_queried( 1 );
+   mgr.item_queried( 2 );
+
+   keys.clear();
+   BOOST_CHECK( mgr.find_next_queries( keys, 10 ) == 0 );
+
+   // a failed query is requested again, but only once
+   mgr.query_failed( 1 );
+   keys.clear();
+   BOOST_REQUIRE( mgr.find_next_queries( keys, 10 ) == 1 );
+   BOOST_CHECK( keys[0] == 1 );
+   uint64_t key = 0;
+   BOOST_CHECK( mgr.find_next_query( key ) && key == 1 );
+
+   // more notices while queued do not duplicate it either
+   mgr.received_inventory_notice( 1, none );
+   keys.clear();
+   BOOST_CHECK( mgr.find_next_queries( keys, 10 ) == 1 );
+
+   // once the value arrives it is no longer queried
+   mgr.item_queried( 1 );
+   mgr.validated( 1, "one", true );
+   mgr.query_failed( 1 );
+   keys.clear();
+   BOOST_CHECK( mgr.find_next_queries( keys, 10 ) == 0 );
+
+   // an item is dropped after FETCH_MAX_ATTEMPTS failed queries
+   for( uint32_t i = 1; i < FETCH_MAX_ATTEMPTS; ++i )
+   {
+      mgr.query_failed( 2 );
+      keys.clear();
+      BOOST_REQUIRE( mgr.find_next_queries( keys, 10 ) == 1 );
+      mgr.item_queried( 2 );
+   }
+   mgr.query_failed( 2 );
+   keys.clear();
+   BOOST_CHECK( mgr.find_next_queries( keys, 10 ) == 0 );
+   BOOST_CHECK( !mgr.get_value( 2 ) );
+  } 
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( rolling_bloom_filter_generations )
+{
+  try {
+   // 3 generations of 4096 bits that each hold 100 items
+   bts::network::rolling_bloom_filter<uint64_t> filter( 4096, 3, 100, fc::seconds( 60*60 ) );
+
+   for( uint64_t i = 0; i < 99; ++i )
+   {
+      BOOST_CHECK( filter.insert( i ) );
+   }
+   BOOST_CHECK( !filter.insert( 7 ) ); // already known, fills the first generation
+   for( uint64_t i = 0; i < 99; ++i )
+   {
+      BOOST_CHECK( filter.contains( i ) );
+   }
+
+   // items survive until every generation that held them has been recycled
+   for( uint64_t i = 1000; i < 1200; ++i )
+   {
+      filter.insert( i );
+   }
+   BOOST_CHECK( filter.contains( 50 ) );
+   for( uint64_t i = 2000; i < 2200; ++i )
+   {
+      filter.insert( i );
+   }
+   uint32_t remembered = 0;
+   for( uint64_t i = 0; i < 99; ++i )
+   {
+      remembered += filter.contains( i );
+   }
+   BOOST_CHECK( remembered < 10 ); // only false positives remain
+   for( uint64_t i = 2000; i < 2200; ++i )
+   {
+      BOOST_CHECK( filter.contains( i ) );
+   }
+
+   // the false positive rate of full generations stays near the configured rate
+   uint32_t false_positives = 0;
+   for( uint64_t i = 1000000; i < 1010000; ++i )
+   {
+      false_positives += filter.contains( i );
+   }
+   BOOST_CHECK_LT( false_positives, 10000 * 3 / 100 );
+
+   filter.clear();
+   BOOST_CHECK( !filter.contains( 2100 ) );
+  } 
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
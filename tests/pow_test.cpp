@@ -1,4 +1,6 @@
 #include <bts/proof_of_work.hpp>
+#include <bts/difficulty.hpp>
+#include <bts/network/channel_pow_stats.hpp>
 #include <string.h>
 #include <fc/io/stdio.hpp>
 #include <fc/thread/thread.hpp>
@@ -59,6 +61,106 @@ int main( int argc, char** argv )
    auto out = bts::proof_of_work( in );
    ilog( "out: ${out}", ("out",out));
 
+   // the engine must produce the same hashes as a serial evaluation
+   {
+      std::vector<fc::sha256> seeds;
+      for( uint32_t i = 0; i < 16; ++i )
+      {
+         seeds.push_back( fc::sha256::hash( (char*)&i, sizeof(i) ) );
+      }
+      auto start = fc::time_point::now();
+      auto pows  = bts::pow_engine::instance().evaluate( seeds );
+      auto end   = fc::time_point::now();
+      fc::cerr << bts::pow_engine::instance().thread_count() << " threads  "
+               << (seeds.size() / ((end-start).count() / 1000000.0)) << " hash / sec\n";
+
+      unsigned char* tmp = new unsigned char[bts::pow_buffer_size];
+      for( uint32_t i = 0; i < seeds.size(); ++i )
+      {
+         if( bts::proof_of_work( seeds[i], tmp ) != pows[i] )
+         {
+            elog( "pow_engine result ${i} does not match", ("i",i) );
+            return 1;
+         }
+      }
+      delete[] tmp;
+   }
+
+   // the fixed width difficulty must match the bigint implementation
+   {
+      const uint32_t count = 100000;
+      std::vector<fc::sha224> hashes;
+      for( uint32_t i = 0; i < count; ++i )
+      {
+         hashes.push_back( fc::sha224::hash( (char*)&i, sizeof(i) ) );
+         // shift some hashes right so that large difficulties are covered
+         memmove( (char*)&hashes.back() + i%24, (char*)&hashes.back(), sizeof(fc::sha224) - i%24 );
+         memset( (char*)&hashes.back(), 0, i%24 );
+      }
+
+      uint64_t sum   = 0;
+      auto     start = fc::time_point::now();
+      for( uint32_t i = 0; i < count; ++i ) sum += bts::difficulty_reference( hashes[i] );
+      auto     mid   = fc::time_point::now();
+      for( uint32_t i = 0; i < count; ++i ) sum -= bts::difficulty( hashes[i] );
+      auto     end   = fc::time_point::now();
+      for( uint32_t i = 0; i < count; ++i )
+      {
+         if( bts::difficulty( hashes[i] ) != bts::difficulty_reference( hashes[i] ) )
+         {
+            elog( "difficulty of ${h} does not match", ("h",hashes[i]) );
+            return 1;
+         }
+      }
+      fc::cerr << "difficulty_reference " << (mid - start).count() * 1000.0 / count << " ns\n";
+      fc::cerr << "difficulty           " << (end - mid).count()   * 1000.0 / count << " ns  (" << sum << ")\n";
+   }
+
+   // the AES-NI kernel must match the reference bit for bit
+   if( bts::detail::aesni_supported() )
+   {
+      unsigned char* tmp = new unsigned char[bts::pow_buffer_size];
+      const uint32_t rounds = 8;
+      fc::microseconds ref_time, aesni_time;
+      for( uint32_t i = 0; i < rounds; ++i )
+      {
+         auto seed  = fc::sha256::hash( (char*)&i, sizeof(i) );
+         auto start = fc::time_point::now();
+         auto ref   = bts::detail::proof_of_work_reference( seed, tmp );
+         auto mid   = fc::time_point::now();
+         auto fast  = bts::detail::proof_of_work_aesni( seed, tmp );
+         auto end   = fc::time_point::now();
+         ref_time   += mid - start;
+         aesni_time += end - mid;
+         if( ref != fast )
+         {
+            elog( "AES-NI result ${i} does not match the reference", ("i",i) );
+            return 1;
+         }
+      }
+      delete[] tmp;
+      fc::cerr << "reference " << (rounds / (ref_time.count() / 1000000.0))   << " hash / sec\n";
+      fc::cerr << "aes-ni    " << (rounds / (aesni_time.count() / 1000000.0)) << " hash / sec\n";
+   }
+
+   {
+      // one million synthetic messages of 200 bytes to 4 KB arriving every 1 to 4 ms
+      bts::network::channel_pow_stats stats;
+      const uint32_t messages = 1000000;
+      uint32_t       accepted = 0;
+      fc::time_point recv_time = fc::time_point::now();
+      auto start = fc::time_point::now();
+      for( uint32_t i = 0; i < messages; ++i )
+      {
+         fc::uint128 mid = fc::city_hash128( (char*)&i, sizeof(i) );
+         recv_time += fc::microseconds( 1000 + (mid.low_bits() % 3000) );
+         accepted += stats.update_bps_avg( 200 + mid.high_bits() % 3896, mid, recv_time );
+      }
+      auto end = fc::time_point::now();
+      fc::cerr << "channel_pow_stats " << ((end-start).count() * 1000.0 / messages) << " ns / message, "
+               << accepted << " met the target, " << stats.avg_bits_per_sec << " bits / sec\n";
+   }
+
    static fc::thread _threads[THREADS]; 
 
    size_t buf_size = BUF_SIZE;